@@ -0,0 +1,519 @@
+// Copyright 2019 René Ladan
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include "binlog.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/** length of the header */
+#define HDRLEN 8
+/** length of the trailer */
+#define TRLLEN 16
+/** nibble codes, see binlog.h */
+#define C_ACC 11
+#define C_ESCAPE 14
+#define C_PAD 15
+
+static const unsigned char header[HDRLEN] = { 'N', 'P', 'L', 'B', 1, 0, 0, 0 };
+static const char trailer_magic[4] = { 'N', 'P', 'L', 'X' };
+/* symbols for codes 0-13, the escape and padding codes follow */
+static const char codes[] = "01234xr#*_\na<>";
+/* symbols after an escape code */
+static const int escaped[] = { '!', BINLOG_NEWLOG, '5', '\0', BINLOG_END };
+
+/* reader for the nibbles of the data part */
+struct nreader {
+	const unsigned char *data;
+	unsigned long long pos, end;
+};
+
+static int
+get_nibble(struct nreader *r)
+{
+	int n;
+
+	if (r->pos >= r->end) {
+		return -1;
+	}
+	n = r->data[r->pos / 2];
+	n = (r->pos % 2 == 0) ? n >> 4 : n & 0xf;
+	r->pos++;
+	return n;
+}
+
+/*
+ * Read the next symbol, *val is set for 'a'. Returns -1 at the end of the
+ * data and -2 for an incomplete or invalid symbol.
+ */
+static int
+next_symbol(struct nreader *r, unsigned *val)
+{
+	int n;
+
+	do {
+		n = get_nibble(r);
+	} while (n == C_PAD);
+	if (n == -1) {
+		return -1;
+	}
+	if (n == C_ACC) {
+		unsigned long long v = 0;
+		unsigned shift = 0;
+		int g;
+
+		do {
+			g = get_nibble(r);
+			if (g == -1 || shift > 30) {
+				return -2;
+			}
+			v |= (unsigned long long)(g & 7) << shift;
+			shift += 3;
+		} while ((g & 8) != 0);
+		if (v > UINT_MAX) {
+			return -2;
+		}
+		*val = (unsigned)v;
+		return 'a';
+	}
+	if (n == C_ESCAPE) {
+		n = get_nibble(r);
+		if (n < 0 || n >= (int)(sizeof(escaped) / sizeof(escaped[0]))) {
+			return -2;
+		}
+		return escaped[n];
+	}
+	return (unsigned char)codes[n];
+}
+
+static int
+add_index(unsigned long long **index, unsigned *count, unsigned *size,
+    unsigned long long off)
+{
+	if (*count == *size) {
+		unsigned long long *nindex;
+		unsigned nsize = (*size == 0) ? 1024 : *size * 2;
+
+		nindex = realloc(*index, nsize * sizeof(**index));
+		if (nindex == NULL) {
+			return errno;
+		}
+		*index = nindex;
+		*size = nsize;
+	}
+	(*index)[(*count)++] = off;
+	return 0;
+}
+
+/* Read the minute index from the footer, if the trailer is valid. */
+static bool
+read_footer(const unsigned char *buf, size_t len, unsigned long long *end,
+    unsigned long long **index, unsigned *count)
+{
+	unsigned long long footer = 0, off = 0;
+	unsigned n = 0, size = 0, i;
+	size_t pos;
+
+	*index = NULL;
+	*count = 0;
+	if (len < HDRLEN + TRLLEN ||
+	    memcmp(buf + len - 4, trailer_magic, 4) != 0) {
+		return false;
+	}
+	for (i = 0; i < 8; i++) {
+		footer |= (unsigned long long)buf[len - TRLLEN + i] << (8 * i);
+	}
+	for (i = 0; i < 4; i++) {
+		n |= (unsigned)buf[len - 8 + i] << (8 * i);
+	}
+	if (footer < HDRLEN || footer > len - TRLLEN) {
+		return false;
+	}
+	*end = (footer - HDRLEN) * 2;
+	pos = (size_t)footer;
+	for (i = 0; i < n; i++) {
+		unsigned long long delta = 0;
+		unsigned shift = 0;
+
+		do {
+			if (pos >= len - TRLLEN || shift > 56) {
+				free(*index);
+				*index = NULL;
+				*count = 0;
+				return false;
+			}
+			delta |= (unsigned long long)(buf[pos] & 0x7f) << shift;
+			shift += 7;
+		} while ((buf[pos++] & 0x80) != 0);
+		off += delta;
+		if (off > *end || add_index(index, count, &size, off) != 0) {
+			free(*index);
+			*index = NULL;
+			*count = 0;
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Find the end of the data and the minute index, from the footer or by
+ * scanning the data. A scan stops at the first invalid symbol.
+ */
+static int
+load_index(const unsigned char *buf, size_t len, unsigned long long *end,
+    unsigned long long **index, unsigned *count)
+{
+	struct nreader r;
+	unsigned size = 0;
+	int ch;
+
+	if (read_footer(buf, len, end, index, count)) {
+		return 0;
+	}
+	r.data = buf + HDRLEN;
+	r.pos = 0;
+	r.end = (len - HDRLEN) * 2;
+	*end = 0;
+	for (;;) {
+		unsigned val;
+		int res;
+
+		ch = next_symbol(&r, &val);
+		if (ch < 0) {
+			break;
+		}
+		*end = r.pos;
+		if (ch == '\n' || ch == BINLOG_NEWLOG) {
+			res = add_index(index, count, &size, r.pos);
+			if (res != 0) {
+				free(*index);
+				*index = NULL;
+				return res;
+			}
+		}
+	}
+	if (ch == -1) {
+		/* include trailing padding */
+		*end = r.end;
+	}
+	return 0;
+}
+
+bool
+binlog_detect(const unsigned char *buf, size_t len)
+{
+	return len >= HDRLEN && memcmp(buf, header, 4) == 0 &&
+	    buf[4] == header[4];
+}
+
+static void
+put_nibble(struct binlog *bl, int n)
+{
+	if (bl->half == -1) {
+		bl->half = n;
+	} else {
+		bl->out[bl->outlen++] = (unsigned char)(bl->half << 4 | n);
+		bl->half = -1;
+	}
+	bl->nibbles++;
+}
+
+/* Write the bytes of the current symbol. */
+static void
+emit(struct binlog *bl)
+{
+	if (bl->outlen == 0) {
+		return;
+	}
+	if (bl->sink != NULL) {
+		bl->sink(bl->arg, bl->out, bl->outlen);
+	} else {
+		(void)fwrite(bl->out, 1, bl->outlen, bl->f);
+	}
+	bl->outlen = 0;
+}
+
+int
+binlog_open(struct binlog *bl, const char *name)
+{
+	unsigned char *buf;
+	unsigned long long end;
+	off_t len, start;
+	int res;
+
+	bl->half = -1;
+	bl->nibbles = 0;
+	bl->index = NULL;
+	bl->count = bl->size = 0;
+	bl->noindex = false;
+	bl->outlen = 0;
+	bl->sink = NULL;
+	bl->arg = NULL;
+	bl->f = fopen(name, "r+b");
+	if (bl->f == NULL) {
+		if (errno != ENOENT) {
+			return errno;
+		}
+		bl->f = fopen(name, "w+b");
+		if (bl->f == NULL) {
+			return errno;
+		}
+	}
+	if (fseeko(bl->f, 0, SEEK_END) == -1 || (len = ftello(bl->f)) == -1) {
+		res = errno;
+		(void)fclose(bl->f);
+		return res;
+	}
+	if (len == 0) {
+		if (fwrite(header, HDRLEN, 1, bl->f) != 1 ||
+		    fflush(bl->f) == EOF) {
+			res = errno;
+			(void)fclose(bl->f);
+			return res;
+		}
+		return 0;
+	}
+	buf = malloc((size_t)len);
+	if (buf == NULL) {
+		res = errno;
+		(void)fclose(bl->f);
+		return res;
+	}
+	rewind(bl->f);
+	if (fread(buf, (size_t)len, 1, bl->f) != 1) {
+		res = ferror(bl->f) ? errno : EINVAL;
+		free(buf);
+		(void)fclose(bl->f);
+		return res;
+	}
+	if (!binlog_detect(buf, (size_t)len)) {
+		free(buf);
+		(void)fclose(bl->f);
+		return EINVAL;
+	}
+	res = load_index(buf, (size_t)len, &end, &bl->index, &bl->count);
+	if (res != 0) {
+		free(buf);
+		(void)fclose(bl->f);
+		return res;
+	}
+	bl->size = bl->count;
+	bl->nibbles = end;
+	/* continue after the last complete symbol */
+	start = (off_t)(HDRLEN + end / 2);
+	if (end % 2 == 1) {
+		bl->half = buf[start] >> 4;
+	}
+	free(buf);
+	if (fflush(bl->f) == EOF || ftruncate(fileno(bl->f), start) == -1 ||
+	    fseeko(bl->f, start, SEEK_SET) == -1 ||
+	    lseek(fileno(bl->f), start, SEEK_SET) == -1) {
+		res = errno;
+		free(bl->index);
+		(void)fclose(bl->f);
+		return res;
+	}
+	return 0;
+}
+
+void
+binlog_put(struct binlog *bl, int ch, unsigned acc_minlen)
+{
+	const char *c;
+	unsigned e;
+
+	for (e = 0; e < sizeof(escaped) / sizeof(escaped[0]); e++) {
+		if (ch == escaped[e]) {
+			put_nibble(bl, C_ESCAPE);
+			put_nibble(bl, (int)e);
+			break;
+		}
+	}
+	if (e == sizeof(escaped) / sizeof(escaped[0])) {
+		if (ch <= 0 || ch > UCHAR_MAX ||
+		    (c = strchr(codes, ch)) == NULL) {
+			return;
+		}
+		put_nibble(bl, (int)(c - codes));
+		if (ch == 'a') {
+			do {
+				put_nibble(bl, (acc_minlen & 7) |
+				    (acc_minlen > 7 ? 8 : 0));
+				acc_minlen >>= 3;
+			} while (acc_minlen > 0);
+		}
+	}
+	if ((ch == '\n' || ch == BINLOG_NEWLOG) && !bl->noindex &&
+	    add_index(&bl->index, &bl->count, &bl->size, bl->nibbles) != 0) {
+		/* readers rebuild the index by scanning */
+		bl->noindex = true;
+	}
+	emit(bl);
+}
+
+int
+binlog_close(struct binlog *bl)
+{
+	int res = 0;
+
+	/* a sink may have written to the file descriptor directly */
+	if (fseeko(bl->f, 0, SEEK_END) == -1) {
+		res = errno;
+	}
+	if (bl->half != -1) {
+		put_nibble(bl, C_PAD);
+		emit(bl);
+	}
+	if (!bl->noindex) {
+		unsigned char trailer[TRLLEN];
+		unsigned long long prev = 0, footer;
+		unsigned i;
+		off_t pos;
+
+		pos = ftello(bl->f);
+		footer = (pos == -1) ? 0 : (unsigned long long)pos;
+		for (i = 0; i < bl->count; i++) {
+			unsigned long long delta = bl->index[i] - prev;
+
+			prev = bl->index[i];
+			do {
+				(void)putc((int)(delta & 0x7f) |
+				    (delta > 0x7f ? 0x80 : 0), bl->f);
+				delta >>= 7;
+			} while (delta > 0);
+		}
+		for (i = 0; i < 8; i++) {
+			trailer[i] = (unsigned char)(footer >> (8 * i));
+		}
+		for (i = 0; i < 4; i++) {
+			trailer[8 + i] = (unsigned char)(bl->count >> (8 * i));
+		}
+		memcpy(trailer + 12, trailer_magic, 4);
+		if (pos != -1) {
+			(void)fwrite(trailer, TRLLEN, 1, bl->f);
+		}
+	}
+	if (ferror(bl->f)) {
+		res = EIO;
+	}
+	if (fclose(bl->f) == EOF && res == 0) {
+		res = errno;
+	}
+	bl->f = NULL;
+	free(bl->index);
+	bl->index = NULL;
+	return res;
+}
+
+/* Append to a malloc()-ed buffer, doubling its size when needed. */
+static bool
+append(unsigned char **buf, size_t *len, size_t *size, const char *s,
+    size_t slen)
+{
+	if (*len + slen > *size) {
+		unsigned char *nbuf;
+		size_t nsize = *size;
+
+		while (*len + slen > nsize) {
+			nsize *= 2;
+		}
+		nbuf = realloc(*buf, nsize);
+		if (nbuf == NULL) {
+			return false;
+		}
+		*buf = nbuf;
+		*size = nsize;
+	}
+	memcpy(*buf + *len, s, slen);
+	*len += slen;
+	return true;
+}
+
+int
+binlog_decode(const unsigned char *buf, size_t len, unsigned minute,
+    unsigned char **text, size_t *textlen)
+{
+	struct nreader r;
+	unsigned long long *index;
+	unsigned count, val;
+	size_t size;
+	bool after_acc = false;
+	int ch, res;
+
+	if (!binlog_detect(buf, len)) {
+		return EINVAL;
+	}
+	res = load_index(buf, len, &r.end, &index, &count);
+	if (res != 0) {
+		return res;
+	}
+	if (minute > count) {
+		free(index);
+		return EINVAL;
+	}
+	r.data = buf + HDRLEN;
+	r.pos = (minute == 0) ? 0 : index[minute - 1];
+	free(index);
+
+	size = 4096;
+	while (size < (len - HDRLEN) * 2) {
+		size *= 2;
+	}
+	*text = malloc(size);
+	if (*text == NULL) {
+		return errno;
+	}
+	*textlen = 0;
+	while ((ch = next_symbol(&r, &val)) >= 0) {
+		char s[16];
+		size_t slen;
+
+		if (ch == BINLOG_NEWLOG) {
+			slen = (size_t)sprintf(s, "\n--new log--\n\n");
+		} else if (ch == BINLOG_END) {
+			slen = (size_t)sprintf(s, "a");
+		} else if (ch == 'a') {
+			slen = (size_t)sprintf(s, "a%u", val);
+		} else if (after_acc && ch >= '0' && ch <= '9') {
+			/* do not extend the acc_minlen value */
+			slen = (size_t)sprintf(s, " %c", ch);
+		} else {
+			s[0] = (char)ch;
+			slen = 1;
+		}
+		if (!append(text, textlen, &size, s, slen)) {
+			res = errno;
+			free(*text);
+			return res;
+		}
+		if (ch == BINLOG_END) {
+			break;
+		}
+		after_acc = (ch == 'a');
+	}
+	if (ch == -2) {
+		free(*text);
+		return EINVAL;
+	}
+	return 0;
+}
+
+unsigned
+binlog_minutes(const unsigned char *buf, size_t len)
+{
+	unsigned long long end, *index;
+	unsigned count;
+
+	if (!binlog_detect(buf, len) ||
+	    load_index(buf, len, &end, &index, &count) != 0) {
+		return 0;
+	}
+	free(index);
+	return count + 1;
+}
@@ -0,0 +1,128 @@
+// Copyright 2019 René Ladan
+// SPDX-License-Identifier: BSD-2-Clause
+
+#ifndef NPLPI_BINLOG_H
+#define NPLPI_BINLOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+ * Binary log file layout:
+ *
+ * - header: "NPLB", version, three zero bytes
+ * - data: 4-bit codes, high nibble first:
+ *   0-4 bits '0'-'4', 5 'x', 6 'r', 7 '#', 8 '*', 9 '_', 10 newline,
+ *   11 'a' followed by acc_minlen as a varint of 3-bit groups (least
+ *   significant first, bit 3 set on all but the last group), 12 '<',
+ *   13 '>', 14 escape followed by 0 '!', 1 new log, 2 '5', 3 NUL, 4 end,
+ *   15 padding
+ * - footer: the minute index, the number of nibbles between the start
+ *   of the previous and the current minute as LEB128 varints
+ * - trailer: offset of the footer (8 bytes) and number of index entries
+ *   (4 bytes), both little endian, and "NPLX"
+ *
+ * A minute starts after each newline or new log mark. A file without a
+ * valid trailer (e.g. after a crash) is still readable, the index is then
+ * rebuilt by scanning the data.
+ */
+
+/** Symbol for the new log mark, "\n--new log--\n\n" in text logs */
+#define BINLOG_NEWLOG 256
+/** Symbol for a malformed acc_minlen value, which ends text log parsing */
+#define BINLOG_END 257
+
+/** State of a binary log file being written. */
+struct binlog {
+	/** the log file */
+	FILE *f;
+	/** high nibble waiting for its low nibble, or -1 */
+	int half;
+	/** number of nibbles in the data part */
+	unsigned long long nibbles;
+	/** nibble offsets of the start of each minute except the first one */
+	unsigned long long *index;
+	/** number of entries in index */
+	unsigned count;
+	/** number of allocated entries in index */
+	unsigned size;
+	/** out of memory for the index, no footer is written */
+	bool noindex;
+	/** bytes of the current symbol */
+	unsigned char out[8];
+	/** number of bytes in out */
+	unsigned outlen;
+	/**
+	 * if not NULL, called with the bytes of each symbol instead of writing
+	 * them to f
+	 */
+	void (*sink)(void *arg, const unsigned char *buf, size_t len);
+	/** argument for sink */
+	void *arg;
+};
+
+/**
+ * Check if the buffer contains a binary log file.
+ *
+ * @param buf The contents of the file.
+ * @param len The length of the file.
+ * @return The file starts with a binary log header.
+ */
+bool binlog_detect(const unsigned char *buf, size_t len);
+
+/**
+ * Open a binary log file for appending, creating it if needed. The footer
+ * of an existing file is removed until binlog_close() writes it again.
+ * Both f and its file descriptor are positioned at the end of the data.
+ *
+ * @param bl The binary log state.
+ * @param name The name of the log file.
+ * @return Opening was successful (0), or errno otherwise (EINVAL if the
+ * file exists but is not a binary log file).
+ */
+int binlog_open(struct binlog *bl, const char *name);
+
+/**
+ * Append a symbol to the binary log file.
+ *
+ * @param bl The binary log state.
+ * @param ch The symbol, one of "012345\nxr#*_a<>!", NUL,
+ * {@link BINLOG_NEWLOG} or {@link BINLOG_END}. Other symbols are ignored.
+ * @param acc_minlen The value to store for 'a'.
+ */
+void binlog_put(struct binlog *bl, int ch, unsigned acc_minlen);
+
+/**
+ * Write the footer and close the binary log file. If a sink was used, it
+ * must have written all data before and be reset to NULL.
+ *
+ * @param bl The binary log state.
+ * @return Closing was successful (0), or errno otherwise.
+ */
+int binlog_close(struct binlog *bl);
+
+/**
+ * Convert a binary log file to its text form, as written in live mode.
+ *
+ * @param buf The contents of the binary log file.
+ * @param len The length of buf.
+ * @param minute The minute to start at, 0 for the start of the file.
+ * @param text Set to the malloc()-ed text on success.
+ * @param textlen Set to the length of the text, which may contain NUL.
+ * @return Conversion was successful (0), or errno otherwise (EINVAL for a
+ * corrupt file or a minute past the end).
+ */
+int binlog_decode(const unsigned char *buf, size_t len, unsigned minute,
+    unsigned char **text, size_t *textlen);
+
+/**
+ * Count the minutes in a binary log file.
+ *
+ * @param buf The contents of the binary log file.
+ * @param len The length of buf.
+ * @return The number of minutes, or 0 for a corrupt file.
+ */
+unsigned binlog_minutes(const unsigned char *buf, size_t len);
+
+#endif
@@ -13,51 +13,120 @@ const int dayinleapyear[12] =
 const char * const weekday[8] =
     { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat", "???" };
 
-/* based on: xx00-02-28 is a Monday if and only if xx00 is a leap year */
+/* number of days in the 400-year cycle of the Gregorian calendar */
+#define CYCLE_DAYS 146097
+
+/*
+ * Number of days from base_year-01-01 until January 1st of each year of the
+ * 400-year cycle, and until the end of the cycle. The length of each year
+ * and the day of the week of each January 1st follow from it. The table
+ * stays valid when base_year moves by 400 years.
+ */
+static const int yearstart[401] = {
+	     0,    365,    730,   1095,   1460,   1826,   2191,   2556,
+	  2921,   3287,   3652,   4017,   4382,   4748,   5113,   5478,
+	  5843,   6209,   6574,   6939,   7304,   7670,   8035,   8400,
+	  8765,   9131,   9496,   9861,  10226,  10592,  10957,  11322,
+	 11687,  12053,  12418,  12783,  13148,  13514,  13879,  14244,
+	 14609,  14975,  15340,  15705,  16070,  16436,  16801,  17166,
+	 17531,  17897,  18262,  18627,  18992,  19358,  19723,  20088,
+	 20453,  20819,  21184,  21549,  21914,  22280,  22645,  23010,
+	 23375,  23741,  24106,  24471,  24836,  25202,  25567,  25932,
+	 26297,  26663,  27028,  27393,  27758,  28124,  28489,  28854,
+	 29219,  29585,  29950,  30315,  30680,  31046,  31411,  31776,
+	 32141,  32507,  32872,  33237,  33602,  33968,  34333,  34698,
+	 35063,  35429,  35794,  36159,  36524,  36890,  37255,  37620,
+	 37985,  38351,  38716,  39081,  39446,  39812,  40177,  40542,
+	 40907,  41273,  41638,  42003,  42368,  42734,  43099,  43464,
+	 43829,  44195,  44560,  44925,  45290,  45656,  46021,  46386,
+	 46751,  47117,  47482,  47847,  48212,  48578,  48943,  49308,
+	 49673,  50039,  50404,  50769,  51134,  51500,  51865,  52230,
+	 52595,  52961,  53326,  53691,  54056,  54422,  54787,  55152,
+	 55517,  55883,  56248,  56613,  56978,  57344,  57709,  58074,
+	 58439,  58805,  59170,  59535,  59900,  60266,  60631,  60996,
+	 61361,  61727,  62092,  62457,  62822,  63188,  63553,  63918,
+	 64283,  64649,  65014,  65379,  65744,  66110,  66475,  66840,
+	 67205,  67571,  67936,  68301,  68666,  69032,  69397,  69762,
+	 70127,  70493,  70858,  71223,  71588,  71954,  72319,  72684,
+	 73049,  73414,  73779,  74144,  74509,  74875,  75240,  75605,
+	 75970,  76336,  76701,  77066,  77431,  77797,  78162,  78527,
+	 78892,  79258,  79623,  79988,  80353,  80719,  81084,  81449,
+	 81814,  82180,  82545,  82910,  83275,  83641,  84006,  84371,
+	 84736,  85102,  85467,  85832,  86197,  86563,  86928,  87293,
+	 87658,  88024,  88389,  88754,  89119,  89485,  89850,  90215,
+	 90580,  90946,  91311,  91676,  92041,  92407,  92772,  93137,
+	 93502,  93868,  94233,  94598,  94963,  95329,  95694,  96059,
+	 96424,  96790,  97155,  97520,  97885,  98251,  98616,  98981,
+	 99346,  99712, 100077, 100442, 100807, 101173, 101538, 101903,
+	102268, 102634, 102999, 103364, 103729, 104095, 104460, 104825,
+	105190, 105556, 105921, 106286, 106651, 107017, 107382, 107747,
+	108112, 108478, 108843, 109208, 109573, 109938, 110303, 110668,
+	111033, 111399, 111764, 112129, 112494, 112860, 113225, 113590,
+	113955, 114321, 114686, 115051, 115416, 115782, 116147, 116512,
+	116877, 117243, 117608, 117973, 118338, 118704, 119069, 119434,
+	119799, 120165, 120530, 120895, 121260, 121626, 121991, 122356,
+	122721, 123087, 123452, 123817, 124182, 124548, 124913, 125278,
+	125643, 126009, 126374, 126739, 127104, 127470, 127835, 128200,
+	128565, 128931, 129296, 129661, 130026, 130392, 130757, 131122,
+	131487, 131853, 132218, 132583, 132948, 133314, 133679, 134044,
+	134409, 134775, 135140, 135505, 135870, 136236, 136601, 136966,
+	137331, 137697, 138062, 138427, 138792, 139158, 139523, 139888,
+	140253, 140619, 140984, 141349, 141714, 142080, 142445, 142810,
+	143175, 143541, 143906, 144271, 144636, 145002, 145367, 145732,
+	146097,
+};
+
+/* number of days in each month, for normal and leap years */
+static const int monthdays[2][13] = {
+	{ 0, 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 },
+	{ 0, 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 }
+};
+
+/* the year of the cycle of an absolute year */
+static int
+cycle_year(int year)
+{
+	return ((year - base_year) % 400 + 400) % 400;
+}
+
+/* the year of the cycle is a leap year */
+static bool
+cycle_leap(int y)
+{
+	return yearstart[y + 1] - yearstart[y] == 366;
+}
+
+/* number of days from January 1st until the first day of the month */
+static int
+days_before_month(int mon, bool leap)
+{
+	return dayinleapyear[mon - 1] - (mon > 2 && !leap ? 1 : 0);
+}
+
+/*
+ * The day of the week of a date only matches in one of the four centuries of
+ * the cycle, because each century starts on a different day of the week.
+ */
 int
 century_offset(struct tm time)
 {
-	int d, nw, nd, wd;
-	int tmp; /* resulting day of year, 02-28 if xx00 is leap */
-
-	/* substract year days from weekday, including normal leap years */
-	wd = (time.tm_wday - time.tm_year - time.tm_year / 4 -
-	    (((time.tm_year % 4) > 0) ? 1 : 0)) % 7;
-	if (wd < 1) {
-		wd += 7;
-	}
-
-	/*
-	 * weekday 1 is a Monday, assume this year is a leap year
-	 * if leap, we should reach Monday xx00-02-28
-	 */
-	d = dayinleapyear[time.tm_mon - 1] + time.tm_mday;
-	if (d < 60) {
-		/* at or before 02-28 (day 59) */
-		nw = (59 - d) / 7;
-		nd = wd == 1 ? 0 : (8 - wd);
-		tmp = d + (nw * 7) + nd;
-	} else {
-		/* after 02-28 (day 59) */
-		if ((time.tm_year % 4) > 0) {
-			d--; /* no 02-29 for obvious non-leap years */
-		}
-		nw = (d - 59) / 7;
-		nd = wd - 1;
-		tmp = d - (nw * 7) - nd;
-	}
-	/* if day-in-year is 59, this year (xx00) is leap */
-	if (tmp == 59) {
-		return 1;
-	}
-	if (tmp == 53 || tmp == 54 || tmp == 60 || tmp == 61) {
-		return 2;
-	}
-	if (tmp == 55 || tmp == 56 || tmp == 62 || tmp == 63) {
-		return 3;
+	int century;
+
+	if (time.tm_year < 0 || time.tm_year > 99 || time.tm_mon < 1 ||
+	    time.tm_mon > 12 || time.tm_mday < 1 || time.tm_mday > 31 ||
+	    time.tm_wday < 0 || time.tm_wday > 7) {
+		return -1; /* ERROR */
 	}
-	if (tmp == 57 || tmp == 58 || tmp == 64 || tmp == 65) {
-		return 0;
+	for (century = 0; century < 4; century++) {
+		int y = 100 * century + time.tm_year;
+		bool leap = cycle_leap(y);
+
+		/* base_year-01-01 is a Monday */
+		if (time.tm_mday <= monthdays[leap][time.tm_mon] &&
+		    (yearstart[y] + days_before_month(time.tm_mon, leap) +
+		    time.tm_mday) % 7 == time.tm_wday % 7) {
+			return century;
+		}
 	}
 	return -1; /* ERROR */
 }
@@ -65,21 +134,16 @@ century_offset(struct tm time)
 bool
 isleapyear(struct tm time)
 {
-	return (time.tm_year % 4 == 0 && time.tm_year % 100 != 0) ||
-	    time.tm_year % 400 == 0;
+	return cycle_leap(cycle_year(time.tm_year));
 }
 
 int
 lastday(struct tm time)
 {
-	if (time.tm_mon == 2) {
-		return 28 + (isleapyear(time) ? 1 : 0);
-	}
-	if (time.tm_mon == 4 || time.tm_mon == 6 || time.tm_mon == 9 ||
-	    time.tm_mon == 11) {
-		return 30;
+	if (time.tm_mon < 1 || time.tm_mon > 12) {
+		return 31;
 	}
-	return 31;
+	return monthdays[isleapyear(time)][time.tm_mon];
 }
 
 static void
@@ -174,6 +238,79 @@ substract_minute(struct tm time, bool dst_changes)
 	return dt;
 }
 
+struct tm
+add_minutes(struct tm time, int n, bool dst_changes)
+{
+	struct tm dt;
+	long long minutes, day, days;
+	int y, mon;
+	bool leap;
+
+	memcpy((void *)&dt, (const void*)&time, sizeof(time));
+	if (time.tm_year < base_year || time.tm_year >= base_year + 400 ||
+	    time.tm_mon < 1 || time.tm_mon > 12 || time.tm_mday < 1 ||
+	    time.tm_mday > lastday(time) || time.tm_hour < 0 ||
+	    time.tm_hour > 23 || time.tm_min < 0 || time.tm_min > 59) {
+		/* not a date, such as the time before the first decoding */
+		for (; n > 0; n--) {
+			dt = add_minute(dt, dst_changes);
+		}
+		for (; n < 0; n++) {
+			dt = substract_minute(dt, dst_changes);
+		}
+		return dt;
+	}
+	if (n == 0) {
+		return dt;
+	}
+	/* the time offset changes once, at the first hour boundary passed */
+	if (dst_changes && (time.tm_min + n >= 60 || time.tm_min + n < 0)) {
+		if (time.tm_isdst == 1) {
+			n += n > 0 ? -60 : 60;
+		}
+		if (time.tm_isdst == 0) {
+			n += n > 0 ? 60 : -60;
+		}
+	}
+
+	/* minutes since base_year-01-01 00:00, within the 400-year cycle */
+	y = cycle_year(time.tm_year);
+	day = yearstart[y] + days_before_month(time.tm_mon, cycle_leap(y)) +
+	    time.tm_mday - 1;
+	minutes = (day * 24 + time.tm_hour) * 60 + time.tm_min + n;
+
+	/* the number of days passed sets the day of the week */
+	days = (minutes >= 0 ? minutes / 1440 : (minutes - 1439) / 1440) - day;
+	if (days != 0) {
+		dt.tm_wday = (int)(((dt.tm_wday - 1 + days) % 7 + 7) % 7) + 1;
+	}
+
+	minutes %= (long long)CYCLE_DAYS * 1440;
+	if (minutes < 0) {
+		minutes += (long long)CYCLE_DAYS * 1440;
+	}
+	dt.tm_min = (int)(minutes % 60);
+	dt.tm_hour = (int)(minutes / 60 % 24);
+	day = minutes / 1440;
+
+	/* the estimate is off by at most one year */
+	y = (int)(day * 400 / CYCLE_DAYS);
+	while (y > 0 && yearstart[y] > day) {
+		y--;
+	}
+	while (y < 399 && yearstart[y + 1] <= day) {
+		y++;
+	}
+	dt.tm_year = base_year + y;
+	day -= yearstart[y];
+	leap = cycle_leap(y);
+	for (mon = 12; mon > 1 && days_before_month(mon, leap) > day; mon--)
+		;
+	dt.tm_mon = mon;
+	dt.tm_mday = (int)(day - days_before_month(mon, leap)) + 1;
+	return dt;
+}
+
 struct tm
 get_npltime(struct tm isotime)
 {
@@ -85,6 +85,22 @@ struct tm add_minute(struct tm time, bool dst_changes);
  */
 struct tm substract_minute(struct tm time, bool dst_changes);
 
+/**
+ * Adds n minutes to the current time, or substracts them if n is negative.
+ *
+ * The result is the same as calling {@link add_minute} or
+ * {@link substract_minute} n times, except that the time offset changes
+ * only once at the first hour boundary passed if dst_changes is true. The
+ * computation takes constant time, so it is suitable for long gaps. A time
+ * which is not a valid date is stepped one minute at a time instead.
+ *
+ * @param time The current time to be increased with n minutes.
+ * @param n The number of minutes to add.
+ * @param dst_changes The daylight saving time is about to start or end.
+ * @return The increased time.
+ */
+struct tm add_minutes(struct tm time, int n, bool dst_changes);
+
 /**
  * Convert the given time in ISO format to NPL format.
  *
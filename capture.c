@@ -0,0 +1,209 @@
+// Copyright 2019 René Ladan
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include "capture.h"
+
+#include <errno.h>
+#include <string.h>
+
+static const unsigned char magic[5] = { 'N', 'P', 'L', 'C', 1 };
+
+static void
+put_varint(FILE *f, unsigned long long v)
+{
+	do {
+		(void)putc((int)(v & 0x7f) | (v > 0x7f ? 0x80 : 0), f);
+		v >>= 7;
+	} while (v > 0);
+}
+
+static bool
+get_varint(FILE *f, unsigned long long *v)
+{
+	unsigned shift = 0;
+	int ch;
+
+	*v = 0;
+	do {
+		ch = getc(f);
+		if (ch == EOF || shift > 63) {
+			return false;
+		}
+		*v |= (unsigned long long)(ch & 0x7f) << shift;
+		shift += 7;
+	} while ((ch & 0x80) != 0);
+	return true;
+}
+
+bool
+capture_detect(const unsigned char *buf, size_t len)
+{
+	return len >= CAPTURE_HDRLEN && memcmp(buf, magic, sizeof(magic)) == 0;
+}
+
+int
+capture_create(struct capture *c, const char *name, unsigned freq,
+    bool edges, long long start_ns)
+{
+	unsigned char hdr[CAPTURE_HDRLEN];
+	unsigned i;
+
+	c->f = fopen(name, "wb");
+	if (c->f == NULL) {
+		return errno;
+	}
+	memset(hdr, 0, sizeof(hdr));
+	memcpy(hdr, magic, sizeof(magic));
+	hdr[5] = edges ? 1 : 0;
+	for (i = 0; i < 4; i++) {
+		hdr[8 + i] = (unsigned char)(freq >> (8 * i));
+	}
+	if (fwrite(hdr, sizeof(hdr), 1, c->f) != 1) {
+		int res = errno;
+
+		(void)fclose(c->f);
+		c->f = NULL;
+		return res;
+	}
+	c->writing = true;
+	c->edges = edges;
+	c->freq = freq;
+	c->value = -1;
+	c->run = 0;
+	c->ns = 0;
+	c->start_ns = start_ns;
+	return 0;
+}
+
+void
+capture_sample(struct capture *c, int p)
+{
+	if (p == c->value) {
+		c->run++;
+		return;
+	}
+	if (c->run > 0) {
+		put_varint(c->f, c->run << 2 | (unsigned)c->value);
+	}
+	c->value = p;
+	c->run = 1;
+}
+
+void
+capture_edge(struct capture *c, int level, long long ts)
+{
+	long long delta = ts - c->start_ns - c->ns;
+
+	if (delta < 0) {
+		delta = 0;
+	}
+	put_varint(c->f, (unsigned long long)delta << 1 | (level & 1));
+	c->ns += delta;
+}
+
+/* Read the next edge for replaying, next_ns becomes -1 at the end. */
+static void
+next_edge(struct capture *c)
+{
+	unsigned long long v;
+
+	if (!get_varint(c->f, &v)) {
+		c->next_ns = -1;
+		return;
+	}
+	c->next_ns += (long long)(v >> 1);
+	c->next_value = (int)(v & 1);
+}
+
+int
+capture_open(struct capture *c, const char *name)
+{
+	unsigned char hdr[CAPTURE_HDRLEN];
+	unsigned i;
+
+	c->f = fopen(name, "rb");
+	if (c->f == NULL) {
+		return errno;
+	}
+	if (fread(hdr, sizeof(hdr), 1, c->f) != 1 ||
+	    !capture_detect(hdr, sizeof(hdr)) || hdr[5] > 1) {
+		(void)fclose(c->f);
+		c->f = NULL;
+		return EINVAL;
+	}
+	c->writing = false;
+	c->edges = hdr[5] == 1;
+	c->freq = 0;
+	for (i = 0; i < 4; i++) {
+		c->freq |= (unsigned)hdr[8 + i] << (8 * i);
+	}
+	c->run = 0;
+	c->ns = 0;
+	c->rem = 0;
+	c->value = 0;
+	if (c->edges) {
+		c->next_ns = 0;
+		c->next_value = 0;
+		next_edge(c);
+		/* the level before the first edge */
+		c->value = 1 - c->next_value;
+	}
+	return 0;
+}
+
+int
+capture_next(struct capture *c)
+{
+	if (!c->edges) {
+		while (c->run == 0) {
+			unsigned long long v;
+
+			if (!get_varint(c->f, &v)) {
+				return -1;
+			}
+			c->run = v >> 2;
+			c->value = (int)(v & 3);
+		}
+		c->run--;
+		return c->value;
+	}
+
+	while (c->next_ns != -1 && c->next_ns <= c->ns) {
+		c->value = c->next_value;
+		next_edge(c);
+	}
+	if (c->next_ns == -1) {
+		return -1;
+	}
+	/* time of the next sample, without drift */
+	c->ns += 1000000000 / c->freq;
+	c->rem += 1000000000 % c->freq;
+	if (c->rem >= c->freq) {
+		c->ns++;
+		c->rem -= c->freq;
+	}
+	return c->value;
+}
+
+int
+capture_close(struct capture *c)
+{
+	int res = 0;
+
+	if (c->f == NULL) {
+		return 0;
+	}
+	if (c->writing) {
+		if (!c->edges && c->run > 0) {
+			put_varint(c->f, c->run << 2 | (unsigned)c->value);
+		}
+		if (ferror(c->f)) {
+			res = EIO;
+		}
+	}
+	if (fclose(c->f) == EOF && res == 0) {
+		res = errno;
+	}
+	c->f = NULL;
+	return res;
+}
@@ -0,0 +1,117 @@
+// Copyright 2019 René Ladan
+// SPDX-License-Identifier: BSD-2-Clause
+
+#ifndef NPLPI_CAPTURE_H
+#define NPLPI_CAPTURE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+ * Capture file layout:
+ *
+ * - header: "NPLC", version, kind (0 for samples, 1 for edges), two zero
+ *   bytes, sample rate in Hz (4 bytes, little endian)
+ * - samples: LEB128 varints of (run length << 2 | sample), with sample
+ *   being 0, 1 or 2 (I/O error)
+ * - edges: LEB128 varints of (nanoseconds since the previous edge << 1 |
+ *   new level), the first edge relative to the start of the capture
+ */
+
+/** Length of the capture file header */
+#define CAPTURE_HDRLEN 12
+
+/** State of a capture file being written or replayed. */
+struct capture {
+	/** the capture file */
+	FILE *f;
+	/** the file is being written instead of replayed */
+	bool writing;
+	/** the file contains edges instead of samples */
+	bool edges;
+	/** sample rate in Hz */
+	unsigned freq;
+	/** current sample or level */
+	int value;
+	/** length of the current run of samples */
+	unsigned long long run;
+	/** time of the previous edge or sample in ns since the start */
+	long long ns;
+	/** remainder of ns in 1/freq ns units, for replaying edges */
+	unsigned rem;
+	/** time of the next edge when replaying edges, -1 at the end */
+	long long next_ns;
+	/** level after the next edge when replaying edges */
+	int next_value;
+	/** start of the capture in ns of CLOCK_MONOTONIC when writing */
+	long long start_ns;
+};
+
+/**
+ * Check if the buffer starts with a capture file header.
+ *
+ * @param buf The start of the file.
+ * @param len The length of buf.
+ * @return The buffer starts with a capture file header.
+ */
+bool capture_detect(const unsigned char *buf, size_t len);
+
+/**
+ * Create a capture file, overwriting any existing file.
+ *
+ * @param c The capture state.
+ * @param name The name of the capture file.
+ * @param freq The sample rate in Hz.
+ * @param edges Store edges instead of samples.
+ * @param start_ns The start of the capture in ns of CLOCK_MONOTONIC.
+ * @return Creation was successful (0), or errno otherwise.
+ */
+int capture_create(struct capture *c, const char *name, unsigned freq,
+    bool edges, long long start_ns);
+
+/**
+ * Append a sample to a capture file of samples.
+ *
+ * @param c The capture state.
+ * @param p The sample, 0, 1 or 2 for an I/O error.
+ */
+void capture_sample(struct capture *c, int p);
+
+/**
+ * Append an edge to a capture file of edges.
+ *
+ * @param c The capture state.
+ * @param level The level after the edge.
+ * @param ts The time of the edge in ns of CLOCK_MONOTONIC.
+ */
+void capture_edge(struct capture *c, int level, long long ts);
+
+/**
+ * Open a capture file for replaying.
+ *
+ * @param c The capture state, c->freq is set from the header.
+ * @param name The name of the capture file.
+ * @return Opening was successful (0), or errno otherwise (EINVAL if the
+ * file is not a capture file).
+ */
+int capture_open(struct capture *c, const char *name);
+
+/**
+ * Replay the next sample from a capture file. Edges are converted to
+ * samples at the rate in the header.
+ *
+ * @param c The capture state.
+ * @return The sample (0, 1 or 2), or -1 at the end of the file.
+ */
+int capture_next(struct capture *c);
+
+/**
+ * Close a capture file, writing any pending run of samples first.
+ *
+ * @param c The capture state.
+ * @return Closing was successful (0), or errno otherwise.
+ */
+int capture_close(struct capture *c);
+
+#endif
@@ -5,98 +5,158 @@
 
 #include "calendar.h"
 
+#include <limits.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
-static int dst_count, minute_count;
-static struct DT_result dt_res;
+static struct DT_state dt_default;
+
+/* number of seconds in the bit buffer, including a leap second */
+#define MINBITS 61
+
+/*
+ * The A and B bits of a minute, second i is bit 63 - i so that a range of
+ * seconds reads as a binary number with the last second as the least
+ * significant bit.
+ */
+struct minute_bits {
+	uint64_t a, b;
+	bool bit0;      /* second 0 contains the minute marker */
+};
+
+/*
+ * Value of a BCD number, 100 if the least significant digit is invalid
+ * like the historic bit-by-bit decoder did.
+ */
+static const unsigned char bcd[256] = {
+	  0,   1,   2,   3,   4,   5,   6,   7,
+	  8,   9, 100, 100, 100, 100, 100, 100,
+	 10,  11,  12,  13,  14,  15,  16,  17,
+	 18,  19, 100, 100, 100, 100, 100, 100,
+	 20,  21,  22,  23,  24,  25,  26,  27,
+	 28,  29, 100, 100, 100, 100, 100, 100,
+	 30,  31,  32,  33,  34,  35,  36,  37,
+	 38,  39, 100, 100, 100, 100, 100, 100,
+	 40,  41,  42,  43,  44,  45,  46,  47,
+	 48,  49, 100, 100, 100, 100, 100, 100,
+	 50,  51,  52,  53,  54,  55,  56,  57,
+	 58,  59, 100, 100, 100, 100, 100, 100,
+	 60,  61,  62,  63,  64,  65,  66,  67,
+	 68,  69, 100, 100, 100, 100, 100, 100,
+	 70,  71,  72,  73,  74,  75,  76,  77,
+	 78,  79, 100, 100, 100, 100, 100, 100,
+	 80,  81,  82,  83,  84,  85,  86,  87,
+	 88,  89, 100, 100, 100, 100, 100, 100,
+	 90,  91,  92,  93,  94,  95,  96,  97,
+	 98,  99, 100, 100, 100, 100, 100, 100,
+	100, 101, 102, 103, 104, 105, 106, 107,
+	108, 109, 100, 100, 100, 100, 100, 100,
+	110, 111, 112, 113, 114, 115, 116, 117,
+	118, 119, 100, 100, 100, 100, 100, 100,
+	120, 121, 122, 123, 124, 125, 126, 127,
+	128, 129, 100, 100, 100, 100, 100, 100,
+	130, 131, 132, 133, 134, 135, 136, 137,
+	138, 139, 100, 100, 100, 100, 100, 100,
+	140, 141, 142, 143, 144, 145, 146, 147,
+	148, 149, 100, 100, 100, 100, 100, 100,
+	150, 151, 152, 153, 154, 155, 156, 157,
+	158, 159, 100, 100, 100, 100, 100, 100,
+};
 
-static bool
-getpar(const int buffer[], unsigned start, unsigned stop, unsigned parity)
+static void
+pack_bits(const int buffer[], struct minute_bits *mb)
 {
-	int par = 0;
+	uint64_t a = 0, b = 0;
 
-	for (unsigned i = start; i <= stop; i++) {
-		par += (buffer[i] & 1); /* check A bits */
+	for (unsigned i = 0; i < MINBITS; i++) {
+		a = a << 1 | (uint64_t)(buffer[i] & 1);
+		b = b << 1 | (uint64_t)((buffer[i] >> 1) & 1);
 	}
-	par += (buffer[parity] >> 1); /* parity is B bit */
-	return (par & 1) == 1;
+	mb->a = a << (64 - MINBITS);
+	mb->b = b << (64 - MINBITS);
+}
+
+/* Seconds start..stop of w, at most 32 of them. */
+static unsigned
+getbits(uint64_t w, unsigned start, unsigned stop)
+{
+	return (unsigned)(w >> (63 - stop)) &
+	    (0xffffffffU >> (31 - (stop - start)));
+}
+
+static bool
+getpar(const struct minute_bits *mb, unsigned start, unsigned stop,
+    unsigned parity)
+{
+	/* A bits, parity is B bit */
+	return ((__builtin_popcount(getbits(mb->a, start, stop)) +
+	    getbits(mb->b, parity, parity)) & 1) == 1;
 }
 
 static int
-getbcd(const int buffer[], unsigned start, unsigned stop)
+getbcd(const struct minute_bits *mb, unsigned start, unsigned stop)
 {
-	int mul = 1, val = 0;
-
-	for (unsigned i = stop; i >= start; i--) {
-		val += mul * (buffer[i] & 1); /* A bits only */
-		mul *= 2;
-		if (mul == 16) {
-			if (val > 9) {
-				return 100;
-			}
-			mul = 10;
-		}
-	}
-	return val;
+	return bcd[getbits(mb->a, start, stop)]; /* A bits only, 8 at most */
 }
 
 static bool
-check_time_sanity(int minlen, const int buffer[])
+check_time_sanity(struct DT_state *s, int minlen,
+    const struct minute_bits *mb)
 {
 	int marker_offset;
 
 	if (minlen == -1 || minlen > 61) {
-		dt_res.minute_length = emin_long;
+		s->dt_res.minute_length = emin_long;
 	} else if (minlen < 59) {
-		dt_res.minute_length = emin_short;
+		s->dt_res.minute_length = emin_short;
 	} else {
-		dt_res.minute_length = emin_ok;
+		s->dt_res.minute_length = emin_ok;
 	}
 
 	/* NPL time only has one bit for DST, so always OK, changed or jumped */
-	dt_res.dst_status = eDST_ok;
+	s->dt_res.dst_status = eDST_ok;
 
-	dt_res.bit0_ok = buffer[0] == 4;
+	s->dt_res.bit0_ok = mb->bit0;
 
-	if (dt_res.bit0_ok && dt_res.minute_length == emin_ok) {
-		int pattern[8] = { 0, 1, 1, 1, 1, 1, 1, 0 };
-		int offset, pos;
+	if (s->dt_res.bit0_ok && s->dt_res.minute_length == emin_ok) {
+		int offset;
 
 		/* search for 01111110 pattern in A bits */
 		for (offset = -1; offset < 2; offset++) {
-			for (pos = 0; pos < 8 && pattern[pos] == (buffer[pos + 52 + offset] & 1); pos++)
-				;
-			if (pos == 8)
+			if (getbits(mb->a, 52 + offset, 59 + offset) == 0x7e)
 				break;
 		}
 		switch (offset) {
 			case -1:
-				dt_res.marker_status = emk_min1;
+				s->dt_res.marker_status = emk_min1;
 				break;
 			case 0:
-				dt_res.marker_status = emk_zero;
+				s->dt_res.marker_status = emk_zero;
 				break;
 			case 1:
-				dt_res.marker_status = emk_plus1;
+				s->dt_res.marker_status = emk_plus1;
 				break;
 			default:
-				dt_res.marker_status = emk_error;
+				s->dt_res.marker_status = emk_error;
 				return false;
 		}
 	}
 
-	marker_offset = dt_res.marker_status == emk_min1 ? -1 :
-	    dt_res.marker_status == emk_zero ? 0 : 1;
+	marker_offset = s->dt_res.marker_status == emk_min1 ? -1 :
+	    s->dt_res.marker_status == emk_zero ? 0 : 1;
 
-	dt_res.bit52_ok = (buffer[52 + marker_offset] & 1) == 0;
-	dt_res.bit59_ok = (buffer[59 + marker_offset] & 1) == 0;
+	s->dt_res.bit52_ok = getbits(mb->a, 52 + marker_offset,
+	    52 + marker_offset) == 0;
+	s->dt_res.bit59_ok = getbits(mb->a, 59 + marker_offset,
+	    59 + marker_offset) == 0;
 
 	/* only decode if set */
-	return (dt_res.minute_length == emin_ok) && dt_res.bit0_ok &&
-	    dt_res.bit52_ok && dt_res.bit59_ok &&
-	    dt_res.marker_status != emk_error;
+	return (s->dt_res.minute_length == emin_ok) && s->dt_res.bit0_ok &&
+	    s->dt_res.bit52_ok && s->dt_res.bit59_ok &&
+	    s->dt_res.marker_status != emk_error;
 }
 
 static void
@@ -105,165 +165,171 @@ handle_special_bits(const int buffer[])
 }
 
 static int
-increase_old_time(unsigned init_min, int minlen, unsigned acc_minlen,
-    struct tm * const time)
+increase_old_time(struct DT_state *s, unsigned init_min, int minlen,
+    unsigned acc_minlen, struct tm * const time)
 {
-	static unsigned acc_minlen_partial;
 	int increase;
 
 	/* See if there are any partial / split minutes to be combined: */
 	if (acc_minlen <= 59000) {
-		acc_minlen_partial += acc_minlen;
-		if (acc_minlen_partial >= 60000) {
-			acc_minlen = acc_minlen_partial;
-			acc_minlen_partial %= 60000;
+		s->acc_minlen_partial += acc_minlen;
+		if (s->acc_minlen_partial >= 60000) {
+			acc_minlen = s->acc_minlen_partial;
+			s->acc_minlen_partial %= 60000;
 		}
 	}
 	/* Calculate number of minutes to increase time with: */
 	increase = acc_minlen / 60000;
 	if (acc_minlen >= 60000) {
-		acc_minlen_partial %= 60000;
+		s->acc_minlen_partial %= 60000;
 	}
 	/* Account for complete minutes with a short acc_minlen: */
 	if (acc_minlen % 60000 > 59000) {
 		increase++;
-		acc_minlen_partial %= 60000;
+		s->acc_minlen_partial %= 60000;
 	}
 
 	/* There is no previous time on the very first (partial) minute: */
 	if (init_min < 2) {
-		for (int i = increase; increase > 0 && i > 0; i--) {
-			*time = add_minute(*time, dt_res.dst_announce);
-		}
-		for (int i = increase; increase < 0 && i < 0; i++) {
-			*time = substract_minute(*time, dt_res.dst_announce);
-		}
+		*time = add_minutes(*time, increase, s->dt_res.dst_announce);
 	}
 	return increase;
 }
 
 static unsigned
-calculate_date_time(unsigned init_min, unsigned errflags, int increase,
-    const int buffer[], struct tm time, struct tm * const newtime)
+calculate_date_time(struct DT_state *s, unsigned init_min, unsigned errflags,
+    int increase, const struct minute_bits *mb, struct tm time,
+    struct tm * const newtime)
 {
 	int tmp0, tmp1;
 	bool p1, p2, p3, p4;
 	int centofs;
 	int marker_offset;
 
-	marker_offset = dt_res.marker_status == emk_min1 ? -1 :
-	    dt_res.marker_status == emk_zero ? 0 : 1;
+	marker_offset = s->dt_res.marker_status == emk_min1 ? -1 :
+	    s->dt_res.marker_status == emk_zero ? 0 : 1;
 
-	p1 = getpar(buffer, 17 + marker_offset, 24 + marker_offset,
+	p1 = getpar(mb, 17 + marker_offset, 24 + marker_offset,
 	    54 + marker_offset); /* year */
-	tmp0 = getbcd(buffer, 17 + marker_offset, 24 + marker_offset);
+	tmp0 = getbcd(mb, 17 + marker_offset, 24 + marker_offset);
 	if (!p1) {
-		dt_res.year_status = eval_parity;
+		s->dt_res.year_status = eval_parity;
 	} else if (tmp0 > 99) {
-		dt_res.year_status = eval_bcd;
+		s->dt_res.year_status = eval_bcd;
 		p1 = false;
 	} else {
-		dt_res.year_status = eval_ok;
+		s->dt_res.year_status = eval_ok;
 	}
 	if ((init_min == 2 || increase != 0) && p1 && errflags == 0) {
 		newtime->tm_year = tmp0;
 		/* check for jumps once month and mday are known and correct */
 	}
 
-	p2 = getpar(buffer, 25 + marker_offset, 35 + marker_offset, 55 + marker_offset); /* month and mday */
-	tmp0 = getbcd(buffer, 25 + marker_offset, 29 + marker_offset);
-	tmp1 = getbcd(buffer, 30 + marker_offset, 35 + marker_offset);
+	p2 = getpar(mb, 25 + marker_offset, 35 + marker_offset, 55 + marker_offset); /* month and mday */
+	tmp0 = getbcd(mb, 25 + marker_offset, 29 + marker_offset);
+	tmp1 = getbcd(mb, 30 + marker_offset, 35 + marker_offset);
 	if (!p2) {
-		dt_res.month_status = eval_parity;
-		dt_res.mday_status = eval_parity;
+		s->dt_res.month_status = eval_parity;
+		s->dt_res.mday_status = eval_parity;
 	} else {
 		if (tmp0 == 0 || tmp0 > 12) {
-			dt_res.month_status = eval_bcd;
+			s->dt_res.month_status = eval_bcd;
 			p2 = false;
 		} else {
-			dt_res.month_status = eval_ok;
+			s->dt_res.month_status = eval_ok;
 		}
 		if (tmp1 == 0 || tmp1 > 31) {
-			dt_res.mday_status = eval_bcd;
+			s->dt_res.mday_status = eval_bcd;
 			p2 = false;
 		} else {
-			dt_res.mday_status = eval_ok;
+			s->dt_res.mday_status = eval_ok;
 		}
 	}
 	if ((init_min == 2 || increase != 0) && p2 && errflags == 0) {
 		newtime->tm_mon = tmp0;
 		if (init_min == 0 && time.tm_mon != newtime->tm_mon) {
-			dt_res.month_status = eval_jump;
+			s->dt_res.month_status = eval_jump;
 		}
 		newtime->tm_mday = tmp1;
 		if (init_min == 0 && time.tm_mday != newtime->tm_mday) {
-			dt_res.mday_status = eval_jump;
+			s->dt_res.mday_status = eval_jump;
 		}
 	}
 
-	p3 = getpar(buffer, 36 + marker_offset, 38 + marker_offset, 56 + marker_offset); /* wday */
-	tmp0 = getbcd(buffer, 36 + marker_offset, 38 + marker_offset);
+	p3 = getpar(mb, 36 + marker_offset, 38 + marker_offset, 56 + marker_offset); /* wday */
+	tmp0 = getbcd(mb, 36 + marker_offset, 38 + marker_offset);
 	if (!p3) {
-		dt_res.wday_status = eval_parity;
+		s->dt_res.wday_status = eval_parity;
 	} else {
 		if (tmp0 == 7) {
-			dt_res.wday_status = eval_bcd;
+			s->dt_res.wday_status = eval_bcd;
 			p3 = false;
 		} else {
-			dt_res.wday_status = eval_ok;
+			s->dt_res.wday_status = eval_ok;
 		}
 	}
 	if ((init_min == 2 || increase != 0) && p3 && errflags == 0) {
 		newtime->tm_wday = tmp0;
 		if (init_min == 0 && time.tm_wday != newtime->tm_wday) {
-			dt_res.wday_status = eval_jump;
+			s->dt_res.wday_status = eval_jump;
 		}
 	}
 
-	centofs = century_offset(*newtime);
-	if (centofs == -1) {
-		dt_res.year_status = eval_bcd;
+	if (newtime->tm_mon == 0) {
+		/*
+		 * The date is not known, so neither is the century. Do not
+		 * stamp the zeroed date over the time.
+		 */
+		s->dt_res.year_status = eval_bcd;
+		p1 = false;
+	} else if ((centofs = century_offset(*newtime)) == -1) {
+		if (p1 && p2 && p3) {
+			/* the day of the week does not match the date */
+			s->dt_res.wday_status = eval_bcd;
+			p3 = false;
+		}
+		s->dt_res.year_status = eval_bcd;
 		p1 = false;
 	} else {
 		if (init_min == 0 && time.tm_year != base_year +
 		    100 * centofs + newtime->tm_year) {
-			dt_res.year_status = eval_jump;
+			s->dt_res.year_status = eval_jump;
 		}
 		newtime->tm_year += base_year + 100 * centofs;
 		if (newtime->tm_mday > lastday(*newtime)) {
-			dt_res.mday_status = eval_bcd;
+			s->dt_res.mday_status = eval_bcd;
 			p1 = p2 = p3 = false;
 		}
 	}
 
-	p4 = getpar(buffer, 39 + marker_offset, 51 + marker_offset, 57 + marker_offset); /* hour and minute */
-	tmp0 = getbcd(buffer, 39 + marker_offset, 44 + marker_offset);
-	tmp1 = getbcd(buffer, 45 + marker_offset, 51 + marker_offset);
+	p4 = getpar(mb, 39 + marker_offset, 51 + marker_offset, 57 + marker_offset); /* hour and minute */
+	tmp0 = getbcd(mb, 39 + marker_offset, 44 + marker_offset);
+	tmp1 = getbcd(mb, 45 + marker_offset, 51 + marker_offset);
 	if (!p4) {
-		dt_res.hour_status = eval_parity;
-		dt_res.minute_status = eval_parity;
+		s->dt_res.hour_status = eval_parity;
+		s->dt_res.minute_status = eval_parity;
 	} else {
 		if (tmp0 > 23) {
-			dt_res.hour_status = eval_bcd;
+			s->dt_res.hour_status = eval_bcd;
 			p4 = false;
 		} else {
-			dt_res.hour_status = eval_ok;
+			s->dt_res.hour_status = eval_ok;
 		}
 		if (tmp1 > 59) {
-			dt_res.minute_status = eval_bcd;
+			s->dt_res.minute_status = eval_bcd;
 			p4 = false;
 		} else {
-			dt_res.minute_status = eval_ok;
+			s->dt_res.minute_status = eval_ok;
 		}
 	}
 	if ((init_min == 2 || increase != 0) && p4 && errflags == 0) {
 		newtime->tm_hour = tmp0;
 		if (init_min == 0 && time.tm_hour != newtime->tm_hour) {
-			dt_res.hour_status = eval_jump;
+			s->dt_res.hour_status = eval_jump;
 		}
 		newtime->tm_min = tmp1;
 		if (init_min == 0 && time.tm_min != newtime->tm_min) {
-			dt_res.minute_status = eval_jump;
+			s->dt_res.minute_status = eval_jump;
 		}
 	}
 
@@ -272,41 +338,42 @@ calculate_date_time(unsigned init_min, unsigned errflags, int increase,
 }
 
 static void
-stamp_date_time(unsigned errflags, struct tm newtime, struct tm * const time)
+stamp_date_time(struct DT_state *s, unsigned errflags, struct tm newtime,
+    struct tm * const time)
 {
-	if ((dt_res.minute_length == emin_ok) && ((errflags & 0x1f) == 0)) {
+	if ((s->dt_res.minute_length == emin_ok) && ((errflags & 0x1f) == 0)) {
 		time->tm_min = newtime.tm_min;
 		time->tm_hour = newtime.tm_hour;
 		time->tm_mday = newtime.tm_mday;
 		time->tm_mon = newtime.tm_mon;
 		time->tm_year = newtime.tm_year;
 		time->tm_wday = newtime.tm_wday;
-		if (dt_res.dst_status != eDST_jump) {
+		if (s->dt_res.dst_status != eDST_jump) {
 			time->tm_isdst = newtime.tm_isdst;
 		}
 	}
 }
 
 static unsigned
-handle_leap_second(unsigned errflags, int minlen, const int buffer[],
-    struct tm time)
+handle_leap_second(struct DT_state *s, unsigned errflags, int minlen,
+    const int buffer[], struct tm time)
 {
 	/* process possible leap second */
 	if (time.tm_min == 0) {
-		dt_res.leapsecond_status = els_done;
+		s->dt_res.leapsecond_status = els_done;
 		if (minlen == 60) {
 			/* leap second processed, but missing */
-			dt_res.minute_length = emin_short;
+			s->dt_res.minute_length = emin_short;
 			errflags |= (1 << 5);
 		} else if (minlen == 61 && buffer[17] == 1) {
-			dt_res.leapsecond_status = els_one;
+			s->dt_res.leapsecond_status = els_one;
 		}
 	} else {
-		dt_res.leapsecond_status = els_none;
+		s->dt_res.leapsecond_status = els_none;
 	}
-	if (minlen == 61 && dt_res.leapsecond_status == els_none) {
+	if (minlen == 61 && s->dt_res.leapsecond_status == els_none) {
 		/* leap second not processed, so bad minute */
-		dt_res.minute_length = emin_long;
+		s->dt_res.minute_length = emin_long;
 		errflags |= (1 << 5);
 	}
 
@@ -314,20 +381,20 @@ handle_leap_second(unsigned errflags, int minlen, const int buffer[],
 }
 
 static unsigned
-handle_dst(unsigned errflags, bool olderr, const int buffer[], struct tm time,
-    struct tm * const newtime)
+handle_dst(struct DT_state *s, unsigned errflags, const int buffer[],
+    struct tm time, struct tm * const newtime)
 {
 	int marker_offset;
 
-	marker_offset = dt_res.marker_status == emk_min1 ? -1 :
-	    dt_res.marker_status == emk_zero ? 0 : 1;
+	marker_offset = s->dt_res.marker_status == emk_min1 ? -1 :
+	    s->dt_res.marker_status == emk_zero ? 0 : 1;
 
 	/* determine if a DST change is announced */
 	if ((buffer[53 + marker_offset] >> 1) == 1 && errflags == 0) {
-		dst_count++;
+		s->dst_count++;
 	}
 	if (time.tm_min > 0) {
-		dt_res.dst_announce = 2 * dst_count > minute_count;
+		s->dt_res.dst_announce = 2 * s->dst_count > s->minute_count;
 	}
 
 	if ((buffer[58 + marker_offset] >> 1) != time.tm_isdst) {
@@ -338,38 +405,321 @@ handle_dst(unsigned errflags, bool olderr, const int buffer[], struct tm time,
 		 *   at startup is problematic)
 		 * - initial state (otherwise DST would never be valid)
 		 */
-		if ((dt_res.dst_announce && time.tm_min == 0) ||
-		    (olderr && errflags == 0) ||
+		if ((s->dt_res.dst_announce && time.tm_min == 0) ||
+		    (s->olderr && errflags == 0) ||
 		    (time.tm_isdst == -1)) {
 			newtime->tm_isdst = buffer[58 + marker_offset] >> 1; /* expected change */
 		} else {
-			dt_res.dst_status = eDST_jump;
+			s->dt_res.dst_status = eDST_jump;
 			/* sudden change, ignore */
 			errflags |= (1 << 6);
 		}
 	}
 
 	/* done with DST */
-	if (dt_res.dst_announce && time.tm_min == 0) {
+	if (s->dt_res.dst_announce && time.tm_min == 0) {
 		/* always clear the DST announcement at hh:00 */
-		dt_res.dst_status = eDST_done;
+		s->dt_res.dst_status = eDST_done;
 	}
 	if (time.tm_min == 0) {
-		dt_res.dst_announce = false;
-		dst_count = 0;
+		s->dt_res.dst_announce = false;
+		s->dst_count = 0;
 	}
 	return errflags;
 }
 
-struct DT_result
-decode_time(unsigned init_min, int minlen, unsigned acc_minlen,
-    const int buffer[], struct tm * const time)
+/* minimum lead of the best soft candidate, in units of bit confidence */
+#define SOFT_MARGIN 1000
+/* scores are halved beyond this, which also forgets old minutes */
+#define SOFT_LIMIT (1 << 24)
+/* minutes per day, the candidates for the time of day */
+#define SOFT_DAY (24 * 60)
+
+static unsigned
+tobcd(unsigned v)
+{
+	return (v / 10) << 4 | v % 10;
+}
+
+/* Score of the n bits of x against the A bits starting at pos. */
+static int
+soft_field(const int sa[], unsigned pos, unsigned n, unsigned x)
+{
+	int score = 0;
+
+	for (unsigned j = 0; j < n; j++) {
+		score += ((x >> (n - 1 - j)) & 1) != 0 ? sa[pos + j] :
+		    -sa[pos + j];
+	}
+	return score;
+}
+
+/* Score of a value matching the A bits start..stop and B bit parity. */
+static int
+soft_weight(const int sa[], const int sb[], unsigned start, unsigned stop,
+    unsigned parity)
+{
+	int w = abs(sb[parity]);
+
+	for (unsigned j = start; j <= stop; j++) {
+		w += abs(sa[j]);
+	}
+	return w;
+}
+
+/* Score of the odd parity bit in B bit pos for a field with ones set bits. */
+static int
+soft_parity(const int sb[], unsigned pos, unsigned ones)
+{
+	return (ones & 1) == 0 ? sb[pos] : -sb[pos];
+}
+
+/* Halve all scores if they can grow too large. */
+static void
+soft_limit(int score[], unsigned n, int *max)
+{
+	if (*max >= SOFT_LIMIT) {
+		for (unsigned i = 0; i < n; i++) {
+			score[i] /= 2;
+		}
+		*max /= 2;
+	}
+}
+
+/*
+ * Find the best candidate, returns if it leads by at least SOFT_MARGIN and
+ * matches at least three quarters of the evidence, so that noise which
+ * happens to favour one candidate is not taken for a signal.
+ */
+static bool
+soft_best(const int score[], unsigned n, int max, unsigned *best)
+{
+	unsigned b = 0;
+	int second = INT_MIN;
+
+	for (unsigned i = 1; i < n; i++) {
+		if (score[i] > score[b]) {
+			second = score[b];
+			b = i;
+		} else if (score[i] > second) {
+			second = score[i];
+		}
+	}
+	*best = b;
+	return (long long)score[b] - second >= SOFT_MARGIN &&
+	    score[b] >= max / 2;
+}
+
+static void
+soft_reset_date(struct DT_soft *sd)
+{
+	memset(sd->date, 0, sizeof(sd->date));
+	memset(sd->year, 0, sizeof(sd->year));
+	memset(sd->wday, 0, sizeof(sd->wday));
+	sd->date_max = sd->year_max = sd->wday_max = 0;
+}
+
+/* Any field of the minute differs from the time it was expected to be. */
+static bool
+soft_jumped(const struct DT_result *r)
+{
+	return r->minute_status == eval_jump || r->hour_status == eval_jump ||
+	    r->mday_status == eval_jump || r->wday_status == eval_jump ||
+	    r->month_status == eval_jump || r->year_status == eval_jump;
+}
+
+/*
+ * Add the evidence of this minute to the soft decoder. The candidate times
+ * of day are those of the start of the accumulation, so accumulating only
+ * needs the number of minutes since then. The date is only accumulated
+ * since the last midnight according to the best time of day.
+ *
+ * That number is only known while the decoded time follows the minutes
+ * counted by the decoder. A jump or a minute with missed minute markers
+ * means that it no longer does, so all evidence is dropped then.
+ */
+static void
+soft_accumulate(struct DT_state *s, int minlen, int increase,
+    const struct minute_bits *mb, const unsigned char conf[], struct tm time)
 {
-	static bool olderr;
+	struct DT_soft *sd = &s->soft;
+	int sa[MINBITS], sb[MINBITS], hs[24], ms[60], ds[31];
+	unsigned hp[24], mp[60], dp[31], best, tod, i, j;
+	int off;
+
+	/*
+	 * A change of the time offset shifts the time of day, start over
+	 * instead of trusting a single DST bit, and likewise if the number of
+	 * minutes since the start is uncertain. The date is only kept while
+	 * the time of day is known and does not pass midnight.
+	 */
+	if (sd->isdst != time.tm_isdst || soft_jumped(&s->dt_res) ||
+	    s->dt_res.minute_length == emin_long) {
+		memset(sd->tod, 0, sizeof(sd->tod));
+		sd->tod_max = 0;
+		sd->elapsed = 0;
+		sd->isdst = time.tm_isdst;
+		soft_reset_date(sd);
+	} else if (!soft_best(sd->tod, SOFT_DAY, sd->tod_max, &best)) {
+		soft_reset_date(sd);
+	} else {
+		tod = (best + (unsigned)sd->elapsed) % SOFT_DAY;
+		if (increase < 0 || (int)tod + increase >= SOFT_DAY) {
+			soft_reset_date(sd);
+		}
+	}
+	sd->elapsed = ((sd->elapsed + increase) % SOFT_DAY + SOFT_DAY) %
+	    SOFT_DAY;
+
+	if (s->dt_res.minute_length != emin_ok) {
+		return;
+	}
+	if (s->dt_res.marker_status == emk_error) {
+		if (minlen != 59) {
+			return;
+		}
+		off = 0;
+	} else {
+		off = s->dt_res.marker_status == emk_min1 ? -1 :
+		    s->dt_res.marker_status == emk_zero ? 0 : 1;
+	}
+	for (i = 0; i < MINBITS; i++) {
+		int c = conf != NULL ? conf[i] : 100;
+
+		sa[i] = ((mb->a >> (63 - i)) & 1) != 0 ? c : -c;
+		sb[i] = ((mb->b >> (63 - i)) & 1) != 0 ? c : -c;
+	}
+
+	for (i = 0; i < 24; i++) {
+		hs[i] = soft_field(sa, 39 + off, 6, tobcd(i));
+		hp[i] = (unsigned)__builtin_popcount(tobcd(i));
+	}
+	for (i = 0; i < 60; i++) {
+		ms[i] = soft_field(sa, 45 + off, 7, tobcd(i));
+		mp[i] = (unsigned)__builtin_popcount(tobcd(i));
+	}
+	tod = 0;
+	for (i = 0; i < 24; i++) {
+		for (j = 0; j < 60; j++, tod++) {
+			sd->tod[(tod + SOFT_DAY - (unsigned)sd->elapsed) %
+			    SOFT_DAY] += hs[i] + ms[j] +
+			    soft_parity(sb, 57 + off, hp[i] + mp[j]);
+		}
+	}
+
+	for (j = 0; j < 31; j++) {
+		ds[j] = soft_field(sa, 30 + off, 6, tobcd(j + 1));
+		dp[j] = (unsigned)__builtin_popcount(tobcd(j + 1));
+	}
+	for (i = 0; i < 12; i++) {
+		int mos = soft_field(sa, 25 + off, 5, tobcd(i + 1));
+		unsigned mop = (unsigned)__builtin_popcount(tobcd(i + 1));
+
+		for (j = 0; j < 31; j++) {
+			sd->date[i * 31 + j] += mos + ds[j] +
+			    soft_parity(sb, 55 + off, mop + dp[j]);
+		}
+	}
+	for (i = 0; i < 100; i++) {
+		sd->year[i] += soft_field(sa, 17 + off, 8, tobcd(i)) +
+		    soft_parity(sb, 54 + off,
+		    (unsigned)__builtin_popcount(tobcd(i)));
+	}
+	for (i = 0; i < 7; i++) {
+		sd->wday[i] += soft_field(sa, 36 + off, 3, i) +
+		    soft_parity(sb, 56 + off, (unsigned)__builtin_popcount(i));
+	}
+
+	sd->tod_max += soft_weight(sa, sb, 39 + off, 51 + off, 57 + off);
+	sd->date_max += soft_weight(sa, sb, 25 + off, 35 + off, 55 + off);
+	sd->year_max += soft_weight(sa, sb, 17 + off, 24 + off, 54 + off);
+	sd->wday_max += soft_weight(sa, sb, 36 + off, 38 + off, 56 + off);
+	soft_limit(sd->tod, SOFT_DAY, &sd->tod_max);
+	soft_limit(sd->date, 12 * 31, &sd->date_max);
+	soft_limit(sd->year, 100, &sd->year_max);
+	soft_limit(sd->wday, 7, &sd->wday_max);
+}
 
+/* Store the n bits of x in the A bits of mb starting at pos. */
+static void
+soft_put(struct minute_bits *mb, unsigned pos, unsigned n, unsigned x)
+{
+	mb->a |= (uint64_t)x << (63 - (pos + n - 1));
+}
+
+/* Set the odd parity B bit for the A bits start..stop. */
+static void
+soft_put_parity(struct minute_bits *mb, unsigned start, unsigned stop,
+    unsigned parity)
+{
+	if ((__builtin_popcount(getbits(mb->a, start, stop)) & 1) == 0) {
+		mb->b |= 1ULL << (63 - parity);
+	}
+}
+
+/*
+ * Replace a minute with errors by the best candidates of the soft decoder
+ * if they are all confident. The candidates are encoded as an error-free
+ * minute which is then decoded as usual, so that the same checks apply.
+ */
+static unsigned
+soft_recover(struct DT_state *s, unsigned init_min, unsigned errflags,
+    int increase, struct tm time, struct tm * const newtime)
+{
+	struct DT_soft *sd = &s->soft;
+	struct DT_result saved = s->dt_res;
+	struct minute_bits mb;
+	struct tm softtime = *newtime;
+	unsigned tod, date, year, wday;
+	int off;
+
+	/* only a minute with a known increase replaces all fields */
+	if ((init_min != 2 && increase == 0) ||
+	    !soft_best(sd->tod, SOFT_DAY, sd->tod_max, &tod) ||
+	    !soft_best(sd->date, 12 * 31, sd->date_max, &date) ||
+	    !soft_best(sd->year, 100, sd->year_max, &year) ||
+	    !soft_best(sd->wday, 7, sd->wday_max, &wday)) {
+		return errflags;
+	}
+	tod = (tod + (unsigned)sd->elapsed) % SOFT_DAY;
+
+	/* use the offset which calculate_date_time() uses */
+	off = s->dt_res.marker_status == emk_min1 ? -1 :
+	    s->dt_res.marker_status == emk_zero ? 0 : 1;
+	mb.a = 0;
+	mb.b = 0;
+	mb.bit0 = true;
+	soft_put(&mb, 17 + off, 8, tobcd(year));
+	soft_put(&mb, 25 + off, 5, tobcd(date / 31 + 1));
+	soft_put(&mb, 30 + off, 6, tobcd(date % 31 + 1));
+	soft_put(&mb, 36 + off, 3, wday);
+	soft_put(&mb, 39 + off, 6, tobcd(tod / 60));
+	soft_put(&mb, 45 + off, 7, tobcd(tod % 60));
+	soft_put_parity(&mb, 17 + off, 24 + off, 54 + off);
+	soft_put_parity(&mb, 25 + off, 35 + off, 55 + off);
+	soft_put_parity(&mb, 36 + off, 38 + off, 56 + off);
+	soft_put_parity(&mb, 39 + off, 51 + off, 57 + off);
+
+	/* the candidates must continue the decoded time */
+	if (calculate_date_time(s, init_min, 0, increase, &mb, time,
+	    &softtime) != 0 || soft_jumped(&s->dt_res)) {
+		s->dt_res = saved;
+		return errflags;
+	}
+	*newtime = softtime;
+	s->dt_res.soft_fix = true;
+	return 0;
+}
+
+struct DT_result
+decode_time_r(struct DT_state *s, unsigned init_min, int minlen,
+    unsigned acc_minlen, const int buffer[], const uint64_t bits[2],
+    const unsigned char conf[], struct tm * const time)
+{
 	unsigned errflags;
 	int increase;
 	struct tm newtime;
+	struct minute_bits mb;
 
 	memset(&newtime, 0, sizeof(newtime));
 	/* Initially, set time offset to unknown */
@@ -377,34 +727,64 @@ decode_time(unsigned init_min, int minlen, unsigned acc_minlen,
 		time->tm_isdst = -1;
 	}
 	newtime.tm_isdst = time->tm_isdst; /* save DST value */
+	s->dt_res.soft_fix = false;
+	if (init_min == 2) {
+		/* start accumulating from scratch */
+		bool soft = s->soft.enabled;
+
+		memset(&s->soft, 0, sizeof(s->soft));
+		s->soft.enabled = soft;
+	}
 
-	errflags = check_time_sanity(minlen, buffer) ? 0 : 1;
+	if (bits != NULL) {
+		mb.a = bits[0];
+		mb.b = bits[1];
+	} else {
+		pack_bits(buffer, &mb);
+	}
+	mb.bit0 = buffer[0] == 4;
+	errflags = check_time_sanity(s, minlen, &mb) ? 0 : 1;
 	if (errflags == 0) {
 		handle_special_bits(buffer);
-		if (++minute_count == 60) {
-			minute_count = 0;
+		if (++s->minute_count == 60) {
+			s->minute_count = 0;
 		}
 	}
 
-	increase = increase_old_time(init_min, minlen, acc_minlen, time);
+	increase = increase_old_time(s, init_min, minlen, acc_minlen, time);
 
-	errflags = calculate_date_time(init_min, errflags, increase, buffer,
+	errflags = calculate_date_time(s, init_min, errflags, increase, &mb,
 	    *time, &newtime);
+	if (s->soft.enabled) {
+		soft_accumulate(s, minlen, increase, &mb, conf, *time);
+		if (errflags != 0 && s->dt_res.minute_length == emin_ok) {
+			errflags = soft_recover(s, init_min, errflags,
+			    increase, *time, &newtime);
+		}
+	}
 
 	if (init_min < 2) {
-	//	errflags = handle_leap_second(errflags, minlen, buffer, *time);
+	//	errflags = handle_leap_second(s, errflags, minlen, buffer, *time);
 
-		errflags = handle_dst(errflags, olderr, buffer, *time, &newtime);
+		errflags = handle_dst(s, errflags, buffer, *time, &newtime);
 	}
 
-	stamp_date_time(errflags, newtime, time);
+	stamp_date_time(s, errflags, newtime, time);
 
-	if (olderr && (errflags == 0)) {
-		olderr = false;
+	if (s->olderr && (errflags == 0)) {
+		s->olderr = false;
 	}
 	if (errflags != 0) {
-		olderr = true;
+		s->olderr = true;
 	}
 
-	return dt_res;
+	return s->dt_res;
+}
+
+struct DT_result
+decode_time(unsigned init_min, int minlen, unsigned acc_minlen,
+    const int buffer[], struct tm * const time)
+{
+	return decode_time_r(&dt_default, init_min, minlen, acc_minlen, buffer,
+	    NULL, NULL, time);
 }
@@ -5,6 +5,7 @@
 #define NPLPI_DECODE_TIME_H
 
 #include <stdbool.h>
+#include <stdint.h>
 struct tm;
 
 /** Minute length state */
@@ -96,6 +97,60 @@ struct DT_result {
 	bool dst_announce;
 	/** minute marker 01111110 state */
 	enum eDT_marker marker_status;
+	/** the time was recovered from the evidence of several minutes */
+	bool soft_fix;
+};
+
+/**
+ * The evidence collected by the soft decoder over consecutive minutes. The
+ * scores of the candidate values grow with the confidence of each bit which
+ * matches the value expected for that candidate, and shrink for each bit
+ * which does not. A minute with errors is replaced by the best candidates
+ * once each of them leads the others by a margin and matches most of the
+ * evidence.
+ */
+struct DT_soft {
+	/** use the soft decoder */
+	bool enabled;
+	/** minutes since the start of the accumulation, modulo one day */
+	int elapsed;
+	/** the time offset of the previous minute, see tm_isdst */
+	int isdst;
+	/** score of each time of day at the start of the accumulation */
+	int tod[24 * 60];
+	/** score of each (month - 1) * 31 + (day of month - 1) */
+	int date[12 * 31];
+	/** score of each year of the century */
+	int year[100];
+	/** score of each day of the week */
+	int wday[7];
+	/** score of a time of day which matches every bit */
+	int tod_max;
+	/** score of a date which matches every bit */
+	int date_max;
+	/** score of a year which matches every bit */
+	int year_max;
+	/** score of a day of the week which matches every bit */
+	int wday_max;
+};
+
+/**
+ * The state of one time decoder, to be zero-initialized before the first
+ * call to {@link decode_time_r}.
+ */
+struct DT_state {
+	/** number of minutes with the DST announcement bit set this hour */
+	int dst_count;
+	/** number of correctly decoded minutes, modulo 60 */
+	int minute_count;
+	/** the results of the last decoded minute */
+	struct DT_result dt_res;
+	/** accumulated length of partial minutes in milliseconds */
+	unsigned acc_minlen_partial;
+	/** the previous minute had an error */
+	bool olderr;
+	/** the soft decoder */
+	struct DT_soft soft;
 };
 
 /**
@@ -121,4 +176,21 @@ struct DT_result {
 struct DT_result decode_time(unsigned init_min, int minlen, unsigned acc_minlen,
     const int buffer[], struct tm * const time);
 
+/**
+ * Reentrant version of {@link decode_time}, which uses the given state
+ * instead of a process-wide one.
+ *
+ * @param s The decoder state.
+ * @param bits The A bits (bits[0]) and B bits (bits[1]) of buffer, with
+ * second i in bit 63 - i (see {@link get_bits}), or NULL to derive them
+ * from buffer.
+ * @param conf The confidence of each bit in buffer (0..100, see
+ * {@link get_confidence}) for the soft decoder, or NULL for full
+ * confidence.
+ */
+struct DT_result decode_time_r(struct DT_state *s, unsigned init_min,
+    int minlen, unsigned acc_minlen, const int buffer[],
+    const uint64_t bits[2], const unsigned char conf[],
+    struct tm * const time);
+
 #endif
@@ -3,11 +3,19 @@
 
 #include "input.h"
 
+#include "binlog.h"
+#include "capture.h"
+#include "logwriter.h"
+#include "ring.h"
+#include "rtsched.h"
+
 #include "json_object.h"
 
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <math.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -15,6 +23,9 @@
 #include <time.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #if defined(__FreeBSD__)
 #  include <sys/param.h>
@@ -28,7 +39,9 @@
 #  warning NetBSD, GPIO support not yet implemented
 #  define NOLIVE 1
 #elif defined(__linux__)
-/* NOP */
+#  include <linux/gpio.h>
+#  include <poll.h>
+#  include <sys/ioctl.h>
 #elif defined(__APPLE__) && (defined(__OSX__) || defined(__MACH__))
 #  warning MacOS, GPIO support available but no port for Rapberry Pi
 #  define NOLIVE 1
@@ -44,565 +57,2805 @@
 
 /** maximum number of bits in a minute */
 #define BUFLEN 61
+/** number of edge events to read from the GPIO character device at once */
+#define EVBUFLEN 16
+/** maximum time in ns to wait for an edge before processing samples */
+#define EDGE_WAIT 100000000
+/** size of the memory-mapped GPIO register block */
+#define GPIO_MAPLEN 4096
+/** offset of the GPLEV0 (pins 0-31) register in 32-bit words */
+#define GPIO_GPLEV0 (0x34 / 4)
+/** maximum pin number available through the GPLEV registers */
+#define GPIO_MAXPIN 53
+/* sample value for an I/O error, other samples hold the level of pin i in bit i */
+#define SAMPLE_ERROR (1 << GB_MAXPINS)
+/** busy-wait instead of sleeping for waits shorter than this (in ns) */
+#define SPIN_WAIT 100000
+/** skip samples instead of catching up when more than this late (in ns) */
+#define MAX_LATE 100000000
+/** time in ns to sleep when no samples from the acquisition thread are ready */
+#define RING_WAIT 20000000
+/** edges less than this apart (in ns) are ignored by the edge classifier */
+#define GLITCH 30000000
+/** block size to read log files which cannot be memory-mapped */
+#define READ_BLOCK 1048576
+/** delay in ns of the low-pass filter in collect_pulses() to detect an edge */
+#define FILTER_DELAY 50000000
+/** clean bits before the adaptive sample rate is halved, one minute */
+#define RATE_CLEAN 60
+
+/*
+ * Characters accepted by skip_invalid(), "012345\nxr#*_a". NUL is included
+ * because the original strchr() check matched the terminating NUL.
+ */
+static const bool valid_char[256] = {
+	[0] = true, ['\n'] = true, ['0'] = true, ['1'] = true, ['2'] = true,
+	['3'] = true, ['4'] = true, ['5'] = true, ['x'] = true, ['r'] = true,
+	['#'] = true, ['*'] = true, ['_'] = true, ['a'] = true
+};
+
+/* all state of one decoder, see GB_new() */
+struct GB_state {
+	int bitpos;             /* second */
+	unsigned dec_bp;        /* bitpos decrease in file mode */
+	int buffer[BUFLEN];     /* wrap after BUFLEN positions */
+	uint64_t bits[2];       /* A and B bits of buffer, see get_bits() */
+	unsigned char conf[BUFLEN];     /* confidence of each bit, 0..100 */
+	bool logging;           /* a log file is open for appending */
+	int logfd;              /* the log file */
+	struct logwriter lw;    /* writes to logfd in the background */
+	enum eLW_policy log_policy;
+	unsigned log_interval;  /* seconds between fsync() calls */
+	bool binary_log;        /* the log file is written by blog */
+	struct binlog blog;
+	int fd;                 /* gpio file */
+	int pinfd[GB_MAXPINS - 1];      /* sysfs value files of the other pins */
+	volatile uint32_t *gpio_reg;    /* mapped GPIO registers, or NULL */
+	struct hardware hw;
+	struct bitinfo bit;
+	unsigned acc_minlen;
+	int cutoff;
+	struct GB_result gb_res;
+	unsigned filemode;      /* 0 = no file, 1 = input, 2 = output */
+	struct rtsched rt;      /* scheduling of the sampling loop */
+	struct capture cap;     /* raw samples or edges, see capture.h */
+	bool replay;            /* samples come from src instead of the pin */
+	bool replay_end;        /* all samples of src are replayed */
+	struct pulse_source src;        /* see set_mode_source() */
+	unsigned long long nsamples;    /* taken from src, the virtual clock */
+
+	/* adaptive sample rate, see adapt_rate() */
+	struct {
+		unsigned min;   /* lowest rate, max for a fixed rate */
+		unsigned max;   /* rate from config.json or src */
+		unsigned clean; /* consecutive clean bits at the current rate */
+	} rate;
+
+	/* duty-cycled reception, see sleep_live() */
+	struct {
+		long long wake_ns;      /* time to resume, -1 while sampling */
+		long long from_ns;      /* time of the first sample skipped */
+		bool resumed;   /* the current bit is the first one after it */
+	} sleep;
+
+	/* flight recorder of the last samples, see set_recorder() */
+	struct {
+		unsigned char *bits;    /* one bit per sample, or NULL */
+		unsigned long long size;        /* capacity in samples */
+		unsigned long long count;       /* samples since the start */
+		unsigned long long next;        /* count to allow a dump at */
+		unsigned dumps; /* number of dumps written */
+		char *dir;      /* directory of the dumps */
+		/* the dump being written by write_dump(), if writing */
+		unsigned char *snap;    /* copy of bits */
+		unsigned long long snap_count;  /* count at the copy */
+		unsigned snap_freq;     /* sample rate at the copy */
+		char name[PATH_MAX];    /* of the capture file */
+		pthread_t writer;
+		bool writing;   /* writer is to be joined */
+		int written;    /* -1 while writing, 0 or errno when done */
+	} rec;
+	int init_bit;           /* initialization state of get_bit_live() */
+	int oldinch;            /* previous character in get_bit_file() */
+	bool read_acc_minlen;   /* the log file contains acc_minlen values */
+	long long second_ns;    /* see get_second_start() */
+	long long minute_ns;    /* see get_minute_start() */
+
+	/* acquisition thread feeding collect_pulses() through a ring buffer */
+	struct {
+		bool enabled;   /* requested in config.json */
+		bool running;
+		int status;     /* -1 while starting, then set_realtime() */
+		int stop;       /* request to stop the thread */
+		int last;       /* most recent sample for get_pulse() */
+		long long ns;   /* time of the most recent sample in ns */
+		pthread_t thread;
+		struct ring samples;
+		/* position in samples of the first sample after lost ones */
+		unsigned gap;
+		int gap_set;    /* gap is valid, cleared by the consumer */
+	} acq;
+
+	/* sampling statistics, see get_sample_stats() */
+	struct {
+		bool enabled;   /* measure the latency and read times */
+		bool logging;   /* statslog is open */
+		int logfd;      /* statslog */
+		struct logwriter lw;    /* writes to logfd in the background */
+		/* updated with stat_add() and count_reset() */
+		struct sample_stats cur;
+	} stats;
+
+	/* time of the next sample in ns of CLOCK_MONOTONIC, without drift */
+	struct {
+		long long ns;
+		unsigned rem;
+	} sample_time;
+
+#if defined(__linux__)
+	/* edge events read from the GPIO character device */
+	struct {
+		struct gpio_v2_line_event ev[EVBUFLEN];
+		unsigned head, count;
+		unsigned seqno;
+		int level;      /* pin values up to known_ns or the next event */
+		long long known_ns;
+	} edges;
+#endif
+
+	/* contents of the log file in file mode, see file_getc() */
+	struct {
+		const unsigned char *map;       /* mapped or malloc()-ed */
+		size_t maplen;
+		bool mapped;    /* map is memory-mapped */
+		bool shared;    /* map and text belong to another state */
+		unsigned char *text;    /* decoded binary log file, or NULL */
+		const unsigned char *buf;       /* map or text */
+		size_t len;
+		size_t pos;
+		bool eof;       /* a read went past the end, like feof() */
+	} infile;
+
+	/* state of the edge classifier, see collect_edges() */
+	struct {
+		bool enabled;   /* requested in config.json */
+		long long start;        /* start of the current bit in ns */
+		long long end;  /* end of the current (part of the) bit in ns */
+		bool pending;   /* an edge is waiting for confirmation */
+		int pend_level;
+		long long pend_ts;
+	} eclass;
+
+	/* get_bit_live() between samples, see poll_bit_live() */
+	struct {
+		int stage;      /* 0 = idle, 1 = first part, 2 = rest of bit */
+		bool adj_freq;
+		unsigned long long len100ms;
+		char outch;
+		unsigned start; /* first sample of the (part of the) bit */
+		long long start_ns; /* time of the first sample of the bit */
+		long long a;    /* filter coefficient */
+		long long y[GB_MAXPINS];        /* filter state of each pin */
+		unsigned stv[GB_MAXPINS];       /* Schmitt trigger states */
+		int tlow[GB_MAXPINS];
+		unsigned ended; /* pins which saw the end of the bit */
+	} live;
+};
+
+/* the state used by the functions without a GB_state argument */
+static struct GB_state gb_default = {
+	.log_policy = elw_minute,
+	.log_interval = 60,
+	.init_bit = 2,
+	.second_ns = -1,
+	.minute_ns = -1,
+	.sleep.wake_ns = -1
+};
+
+static int start_acquisition(struct GB_state *s);
+static void stop_acquisition(struct GB_state *s);
+static void clear_recorder(struct GB_state *s);
+
+struct GB_state *
+GB_new(void)
+{
+	struct GB_state *s;
+
+	s = calloc(1, sizeof(*s));
+	if (s != NULL) {
+		s->log_policy = gb_default.log_policy;
+		s->log_interval = gb_default.log_interval;
+		s->init_bit = gb_default.init_bit;
+		s->second_ns = gb_default.second_ns;
+		s->minute_ns = gb_default.minute_ns;
+		s->sleep.wake_ns = gb_default.sleep.wake_ns;
+	}
+	return s;
+}
+
+struct GB_state *
+GB_dup(const struct GB_state *src)
+{
+	struct GB_state *s;
+
+	if (src->filemode != 2) {
+		errno = EINVAL;
+		return NULL;
+	}
+	s = malloc(sizeof(*s));
+	if (s != NULL) {
+		*s = *src;
+		s->infile.shared = true;
+	}
+	return s;
+}
+
+struct GB_state *
+GB_default(void)
+{
+	return &gb_default;
+}
 
-static int bitpos;              /* second */
-static unsigned dec_bp;         /* bitpos decrease in file mode */
-static int buffer[BUFLEN];      /* wrap after BUFLEN positions */
-static FILE *logfile;           /* auto-appended in live mode */
-static int fd;                  /* gpio file */
-static struct hardware hw;
-static struct bitinfo bit;
-static unsigned acc_minlen;
-static int cutoff;
-static struct GB_result gb_res;
-static unsigned filemode = 0;   /* 0 = no file, 1 = input, 2 = output */
+void
+GB_free(struct GB_state *s)
+{
+	if (s != NULL) {
+		cleanup_r(s);
+		free(s);
+	}
+}
+
+/* Read the whole log file into memory for non-mappable files. */
+static int
+read_file(struct GB_state *s, int infd)
+{
+	unsigned char *buf = NULL;
+	size_t size = 0;
+
+	s->infile.maplen = 0;
+	for (;;) {
+		ssize_t r;
+
+		if (s->infile.maplen == size) {
+			unsigned char *nbuf;
+
+			nbuf = realloc(buf, size + READ_BLOCK);
+			if (nbuf == NULL) {
+				perror("realloc(logfile)");
+				free(buf);
+				return errno;
+			}
+			buf = nbuf;
+			size += READ_BLOCK;
+		}
+		r = read(infd, buf + s->infile.maplen, size - s->infile.maplen);
+		if (r == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("read(logfile)");
+			free(buf);
+			return errno;
+		}
+		if (r == 0) {
+			break;
+		}
+		s->infile.maplen += (size_t)r;
+	}
+	s->infile.map = buf;
+	s->infile.mapped = false;
+	return 0;
+}
+
+/* Start reading the text form of the log file at the given minute. */
+static int
+start_minute(struct GB_state *s, unsigned minute)
+{
+	if (binlog_detect(s->infile.map, s->infile.maplen)) {
+		unsigned char *text;
+		size_t len;
+		int res;
+
+		res = binlog_decode(s->infile.map, s->infile.maplen, minute,
+		    &text, &len);
+		if (res != 0) {
+			return res;
+		}
+		free(s->infile.text);
+		s->infile.text = text;
+		s->infile.buf = text;
+		s->infile.len = len;
+	} else {
+		s->infile.buf = s->infile.map;
+		s->infile.len = s->infile.maplen;
+	}
+	s->infile.pos = 0;
+	s->infile.eof = false;
+	return 0;
+}
 
 int
-set_mode_file(const char * const infilename)
+set_mode_file_r(struct GB_state *s, const char * const infilename)
 {
-	if (filemode == 1) {
+	struct stat st;
+	int infd, res = 0;
+
+	if (s->filemode == 1) {
 		fprintf(stderr, "Already initialized to live mode.\n");
-		cleanup();
+		cleanup_r(s);
 		return -1;
 	}
 	if (infilename == NULL) {
 		fprintf(stderr, "infilename is NULL\n");
 		return -1;
 	}
-	logfile = fopen(infilename, "r");
-	if (logfile == NULL) {
-		perror("fopen(logfile)");
+	infd = open(infilename, O_RDONLY);
+	if (infd == -1) {
+		perror("open(logfile)");
 		return errno;
 	}
-	filemode = 2;
+	if (fstat(infd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		void *map;
+
+		map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE,
+		    infd, 0);
+		if (map != MAP_FAILED) {
+			(void)posix_madvise(map, (size_t)st.st_size,
+			    POSIX_MADV_SEQUENTIAL);
+			s->infile.map = map;
+			s->infile.maplen = (size_t)st.st_size;
+			s->infile.mapped = true;
+		}
+	}
+	if (s->infile.map == NULL) {
+		res = read_file(s, infd);
+	}
+	if (close(infd) == -1) {
+		perror("close(logfile)");
+	}
+	if (res == 0) {
+		res = start_minute(s, 0);
+		if (res != 0) {
+			fprintf(stderr, "Corrupt binary log file\n");
+		}
+	}
+	if (res != 0) {
+		return res;
+	}
+	s->filemode = 2;
 	return 0;
 }
 
 int
-set_mode_live(struct json_object *config)
+set_mode_file(const char * const infilename)
 {
-#if defined(NOLIVE)
-	fprintf(stderr,
-	    "No GPIO interface available, disabling live decoding\n");
-	cleanup();
-	return -1;
-#else
-#if defined(__FreeBSD__)
-	struct gpio_pin pin;
-#endif
-	char buf[64];
+	return set_mode_file_r(&gb_default, infilename);
+}
+
+#if defined(__linux__)
+/*
+ * Request the pin from the GPIO character device with edge detection on
+ * both edges. The kernel takes care of the active_high logic.
+ */
+static int
+open_cdev(struct GB_state *s, struct json_object *config)
+{
+	struct gpio_v2_line_request req;
+	struct gpio_v2_line_values values;
 	struct json_object *value;
-	int res;
+	struct timespec tp;
+	char buf[64];
+	unsigned i;
+	int chipfd, res;
 
-	if (filemode == 2) {
-		fprintf(stderr, "Already initialized to file mode.\n");
-		cleanup();
-		return -1;
+	s->hw.iodev = 0;
+	if (json_object_object_get_ex(config, "iodev", &value)) {
+		s->hw.iodev = (unsigned)json_object_get_int(value);
 	}
-	/* fill hardware structure and initialize hardware */
-	if (json_object_object_get_ex(config, "pin", &value)) {
-		hw.pin = (unsigned)json_object_get_int(value);
-	} else {
-		fprintf(stderr, "Key 'pin' not found\n");
-		cleanup();
+	res = snprintf(buf, sizeof(buf), "/dev/gpiochip%u", s->hw.iodev);
+	if (res < 0 || res >= sizeof(buf)) {
+		fprintf(stderr, "hw.iodev too high? (%i)\n", res);
 		return EX_DATAERR;
 	}
-	if (json_object_object_get_ex(config, "activehigh", &value)) {
-		hw.active_high = (bool)json_object_get_boolean(value);
-	} else {
-		fprintf(stderr, "Key 'activehigh' not found\n");
-		cleanup();
-		return EX_DATAERR;
+	chipfd = open(buf, O_RDONLY);
+	if (chipfd < 0) {
+		fprintf(stderr, "open %s: ", buf);
+		perror(NULL);
+		return errno;
 	}
-	if (json_object_object_get_ex(config, "freq", &value)) {
-		hw.freq = (unsigned)json_object_get_int(value);
-	} else {
-		fprintf(stderr, "Key 'freq' not found\n");
-		cleanup();
-		return EX_DATAERR;
+
+	memset(&req, 0, sizeof(req));
+	for (i = 0; i < s->hw.npins; i++) {
+		req.offsets[i] = s->hw.pins[i];
 	}
-	if (hw.freq < 10 || hw.freq > 120000 || (hw.freq & 1) == 1) {
-		fprintf(stderr, "hw.freq must be an even number between 10 and"
-		    "120000 inclusive\n");
-		cleanup();
-		return EX_DATAERR;
+	req.num_lines = s->hw.npins;
+	req.event_buffer_size = 16 * EVBUFLEN;
+	(void)strncpy(req.consumer, "nplpi", sizeof(req.consumer) - 1);
+	req.config.flags = GPIO_V2_LINE_FLAG_INPUT |
+	    GPIO_V2_LINE_FLAG_EDGE_RISING | GPIO_V2_LINE_FLAG_EDGE_FALLING;
+	if (!s->hw.active_high) {
+		req.config.flags |= GPIO_V2_LINE_FLAG_ACTIVE_LOW;
+	}
+	if (ioctl(chipfd, GPIO_V2_GET_LINE_IOCTL, &req) < 0) {
+		perror("ioctl(GPIO_V2_GET_LINE_IOCTL)");
+		(void)close(chipfd);
+		return errno;
+	}
+	if (close(chipfd) == -1) {
+		perror("close(/dev/gpiochip*)");
+		(void)close(req.fd);
+		return errno;
+	}
+	s->fd = req.fd;
+
+	values.mask = (1U << s->hw.npins) - 1;
+	if (ioctl(s->fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) < 0) {
+		perror("ioctl(GPIO_V2_LINE_GET_VALUES_IOCTL)");
+		return errno;
 	}
-	bit.signal = malloc(hw.freq / 2);
+	(void)clock_gettime(CLOCK_MONOTONIC, &tp);
+	s->edges.level = (int)(values.bits & values.mask);
+	s->edges.known_ns = tp.tv_sec * 1000000000LL + tp.tv_nsec;
+	s->edges.head = s->edges.count = 0;
+	s->edges.seqno = 0;
+	s->eclass.end = s->edges.known_ns;
+	s->eclass.pending = false;
+	s->sample_time.ns = s->edges.known_ns;
+	s->sample_time.rem = 0;
+	return 0;
+}
+#endif
+
+#if !defined(NOLIVE)
+/*
+ * Map the GPIO registers of the SoC into memory. The pin itself is still
+ * configured as input using the regular method.
+ */
+static int
+map_gpio(struct GB_state *s, struct json_object *config)
+{
+	void *map;
+	off_t base;
+	unsigned i;
+	int memfd;
 #if defined(__FreeBSD__)
-	if (json_object_object_get_ex(config, "iodev", &value)) {
-		hw.iodev = (unsigned)json_object_get_int(value);
-	} else {
-		fprintf(stderr, "Key 'iodev' not found\n");
-		cleanup();
-		return EX_DATAERR;
+	struct json_object *value;
+	const char *dev = "/dev/mem";
+
+	if (!json_object_object_get_ex(config, "gpiobase", &value)) {
+		fprintf(stderr, "Key 'gpiobase' not found\n");
+		return -1;
 	}
-	res = snprintf(buf, sizeof(buf), "/dev/gpioc%u", hw.iodev);
-	if (res < 0 || res >= sizeof(buf)) {
-		fprintf(stderr, "hw.iodev too high? (%i)\n", res);
-		cleanup();
-		return EX_DATAERR;
+	base = (off_t)json_object_get_int64(value);
+#else
+	const char *dev = "/dev/gpiomem";
+
+	base = 0;
+#endif
+	for (i = 0; i < s->hw.npins; i++) {
+		if (s->hw.pins[i] > GPIO_MAXPIN) {
+			fprintf(stderr,
+			    "hw.pin too high for memory-mapped access\n");
+			return -1;
+		}
 	}
-	fd = open(buf, O_RDWR);
-	if (fd < 0) {
-		fprintf(stderr, "open %s: ", buf);
+	memfd = open(dev, O_RDONLY);
+	if (memfd < 0) {
+		fprintf(stderr, "open %s: ", dev);
 		perror(NULL);
-		cleanup();
 		return errno;
 	}
-
-	pin.gp_pin = hw.pin;
-	pin.gp_flags = GPIO_PIN_INPUT;
-	if (ioctl(fd, GPIOSETCONFIG, &pin) < 0) {
-		perror("ioctl(GPIOSETCONFIG)");
-		cleanup();
+	map = mmap(NULL, GPIO_MAPLEN, PROT_READ, MAP_SHARED, memfd, base);
+	if (map == MAP_FAILED) {
+		perror("mmap(gpio)");
+		(void)close(memfd);
 		return errno;
 	}
-#elif defined(__linux__)
-	fd = open("/sys/class/gpio/export", O_WRONLY);
-	if (fd < 0) {
+	(void)close(memfd); /* the mapping stays valid */
+	s->gpio_reg = map;
+	return 0;
+}
+#endif
+
+#if defined(__linux__)
+/* Export the pin using sysfs and open its value file. */
+static int
+open_sysfs(unsigned pin, int *fd)
+{
+	char buf[64];
+	int res;
+
+	*fd = open("/sys/class/gpio/export", O_WRONLY);
+	if (*fd < 0) {
 		perror("open(/sys/class/gpio/export)");
-		cleanup();
 		return errno;
 	}
-	res = snprintf(buf, sizeof(buf), "%u", hw.pin);
+	res = snprintf(buf, sizeof(buf), "%u", pin);
 	if (res < 0 || res >= sizeof(buf)) {
 		fprintf(stderr, "hw.pin too high? (%i)\n", res);
-		cleanup();
 		return EX_DATAERR;
 	}
-	if (write(fd, buf, res) < 0) {
+	if (write(*fd, buf, res) < 0) {
 		if (errno != EBUSY) {
 			perror("write(export)");
-			cleanup();
 			return errno; /* EBUSY -> pin already exported ? */
 		}
 	}
-	if (close(fd) == -1) {
+	if (close(*fd) == -1) {
 		perror("close(export)");
-		cleanup();
 		return errno;
 	}
 	res = snprintf(buf, sizeof(buf), "/sys/class/gpio/gpio%u/direction",
-	    hw.pin);
+	    pin);
 	if (res < 0 || res >= sizeof(buf)) {
 		fprintf(stderr, "hw.pin too high? (%i)\n", res);
-		cleanup();
 		return EX_DATAERR;
 	}
-	fd = open(buf, O_RDWR);
-	if (fd < 0) {
+	*fd = open(buf, O_RDWR);
+	if (*fd < 0) {
 		perror("open(direction)");
-		cleanup();
 		return errno;
 	}
-	if (write(fd, "in", 3) < 0) {
+	if (write(*fd, "in", 3) < 0) {
 		perror("write(in)");
-		cleanup();
 		return errno;
 	}
-	if (close(fd) == -1) {
+	if (close(*fd) == -1) {
 		perror("close(direction)");
-		cleanup();
 		return errno;
 	}
 	res = snprintf(buf, sizeof(buf), "/sys/class/gpio/gpio%u/value",
-	    hw.pin);
+	    pin);
 	if (res < 0 || res >= sizeof(buf)) {
 		fprintf(stderr, "hw.pin too high? (%i)\n", res);
-		cleanup();
 		return EX_DATAERR;
 	}
-	fd = open(buf, O_RDONLY | O_NONBLOCK);
-	if (fd < 0) {
+	*fd = open(buf, O_RDONLY | O_NONBLOCK);
+	if (*fd < 0) {
 		perror("open(value)");
-		cleanup();
 		return errno;
 	}
-#endif
-	filemode = 1;
 	return 0;
-#endif
 }
+#endif
 
-void
-cleanup(void)
+#if !defined(NOLIVE)
+/* Read the pin number, or an array of pin numbers for antenna diversity. */
+static int
+get_pins(struct GB_state *s, struct json_object *value)
 {
-	if (fd > 0 && close(fd) == -1) {
-#if defined(__FreeBSD__)
-		perror("close(/dev/gpioc*)");
-#elif defined(__linux__)
-		perror("close(/sys/class/gpio/*)");
-#endif
-	}
-	fd = 0;
-	if (logfile != NULL) {
-		if (fclose(logfile) == EOF) {
-			perror("fclose(logfile)");
-		} else {
-			logfile = NULL;
+	unsigned i;
+
+	if (!json_object_is_type(value, json_type_array)) {
+		s->hw.pins[0] = (unsigned)json_object_get_int(value);
+		s->hw.npins = 1;
+	} else {
+		s->hw.npins = (unsigned)json_object_array_length(value);
+		if (s->hw.npins == 0 || s->hw.npins > GB_MAXPINS) {
+			fprintf(stderr, "Key 'pin' must have 1 to %u pins\n",
+			    GB_MAXPINS);
+			return EX_DATAERR;
+		}
+		for (i = 0; i < s->hw.npins; i++) {
+			s->hw.pins[i] = (unsigned)json_object_get_int(
+			    json_object_array_get_idx(value, (int)i));
 		}
 	}
-	free(bit.signal);
+	s->hw.pin = s->hw.pins[0];
+	return 0;
 }
+#endif
 
 int
-get_pulse(void)
+set_mode_live_r(struct GB_state *s, struct json_object *config)
 {
-	int tmpch;
 #if defined(NOLIVE)
-	tmpch = 2;
+	fprintf(stderr,
+	    "No GPIO interface available, disabling live decoding\n");
+	cleanup_r(s);
+	return -1;
 #else
-	int count = 0;
 #if defined(__FreeBSD__)
-	struct gpio_req req;
-
-	req.gp_pin = hw.pin;
-	count = ioctl(fd, GPIOGET, &req);
-	tmpch = (req.gp_value == GPIO_PIN_HIGH) ? 1 : 0;
-	if (count < 0) {
-#elif defined(__linux__)
-	count = read(fd, &tmpch, 1);
-	tmpch -= '0';
-	if (lseek(fd, 0, SEEK_SET) == (off_t)-1)
-		return 2; /* rewind to prevent EBUSY/no read failed */
-	if (count != 1) {
+	struct gpio_pin pin;
+	char buf[64];
 #endif
-		return 2; /* hardware failure? */
-	}
+	struct json_object *value;
+	struct timespec tp;
+	unsigned i;
+	int res;
 
-	if (!hw.active_high) {
-		tmpch = 1 - tmpch;
+	if (s->filemode == 2) {
+		fprintf(stderr, "Already initialized to file mode.\n");
+		cleanup_r(s);
+		return -1;
 	}
-#endif
-	return tmpch;
-}
-
-/*
- * Clear the cutoff value and the state values, except emark_toolong and
- * emark_late to be able to determine if this flag can be cleared again.
- */
-static void
-set_new_state(void)
-{
-	if (!gb_res.skip) {
-		cutoff = -1;
+	/* fill hardware structure and initialize hardware */
+	if (json_object_object_get_ex(config, "pin", &value)) {
+		res = get_pins(s, value);
+		if (res != 0) {
+			cleanup_r(s);
+			return res;
+		}
+	} else {
+		fprintf(stderr, "Key 'pin' not found\n");
+		cleanup_r(s);
+		return EX_DATAERR;
 	}
-	gb_res.bad_io = false;
-	gb_res.bitval = ebv_none;
-	if (gb_res.marker != emark_toolong && gb_res.marker != emark_late) {
-		gb_res.marker = emark_none; // XXX never true for NPL ?
+	if (json_object_object_get_ex(config, "activehigh", &value)) {
+		s->hw.active_high = (bool)json_object_get_boolean(value);
+	} else {
+		fprintf(stderr, "Key 'activehigh' not found\n");
+		cleanup_r(s);
+		return EX_DATAERR;
 	}
-	gb_res.hwstat = ehw_ok;
-	gb_res.done = false;
-	gb_res.skip = false;
-}
-
-static void
-reset_frequency(void)
-{
-	if (logfile != NULL) {
-		fprintf(logfile, "%s",
-		    bit.realfreq <= hw.freq * 500000 ? "<" :
-		    bit.realfreq > hw.freq * 1000000 ? ">" : "");
+	if (json_object_object_get_ex(config, "freq", &value)) {
+		s->hw.freq = (unsigned)json_object_get_int(value);
+	} else {
+		fprintf(stderr, "Key 'freq' not found\n");
+		cleanup_r(s);
+		return EX_DATAERR;
 	}
-	bit.realfreq = hw.freq * 1000000;
-	bit.freq_reset = true;
-}
-
-static void
-reset_bitlen(void)
-{
-	if (logfile != NULL) {
-		fprintf(logfile, "!");
+	if (s->hw.freq < 10 || s->hw.freq > 120000 || (s->hw.freq & 1) == 1) {
+		fprintf(stderr, "hw.freq must be an even number between 10 and"
+		    "120000 inclusive\n");
+		cleanup_r(s);
+		return EX_DATAERR;
 	}
-	bit.bit0 = bit.realfreq / 2;
-	bit.bit5x = bit.realfreq / 10;
-	bit.bitlen_reset = true;
-}
-
-unsigned
-collect_pulses(unsigned start, int *init_bit, bool *adj_freq)
-{
-	char outch;
-	long long a, y = 1000000000;
-	unsigned stv = 1;
-#if !defined(MACOS)
-	struct timespec tp0, tp1;
-#endif
-	struct timespec slp;
-	unsigned sec2 = 1000000000 / (hw.freq * hw.freq);
-
-	/* Set up filter, reach 50% after hw.freq/20 samples (i.e. 50 ms) */
-	a = 1000000000 - (long long)(1000000000 * exp2(-20.0 / hw.freq));
+	s->bit.signal = malloc(s->hw.freq / 2);
+	s->rate.max = s->rate.min = s->hw.freq;
+	s->rate.clean = 0;
+	s->sleep.wake_ns = -1;
+	if (json_object_object_get_ex(config, "minfreq", &value)) {
+		s->rate.min = (unsigned)json_object_get_int(value);
+		if (s->rate.min < 10 || s->rate.min > s->hw.freq ||
+		    (s->rate.min & 1) == 1) {
+			fprintf(stderr, "minfreq must be an even number "
+			    "between 10 and freq inclusive\n");
+			cleanup_r(s);
+			return EX_DATAERR;
+		}
+	}
+	s->hw.iomode = eio_poll;
+	if (json_object_object_get_ex(config, "iomode", &value)) {
+		const char *iomode = json_object_get_string(value);
 
-	for (bit.t = start; bit.t < hw.freq; bit.t++) {
-#if !defined(MACOS)
-		(void)clock_gettime(CLOCK_MONOTONIC, &tp0);
-#endif
-		int p = get_pulse();
-		if (p == 2) {
-			gb_res.bad_io = true;
-			outch = '*';
-			break;
+		if (strcmp(iomode, "cdev") == 0) {
+			s->hw.iomode = eio_cdev;
+		} else if (strcmp(iomode, "mmap") == 0) {
+			s->hw.iomode = eio_mmap;
+		} else if (strcmp(iomode, "sysfs") != 0 &&
+		    strcmp(iomode, "gpioc") != 0) {
+			fprintf(stderr, "Unknown iomode '%s'\n", iomode);
+			cleanup_r(s);
+			return EX_DATAERR;
 		}
-		if (bit.signal != NULL) {
-			if ((bit.t & 7) == 0) {
-				bit.signal[bit.t / 8] = 0;
-			}
-			/* clear data from previous second */
-			bit.signal[bit.t / 8] |=
-			    p << (unsigned char)(bit.t & 7);
+	}
+	s->rt.priority = 0;
+	if (json_object_object_get_ex(config, "rtpriority", &value)) {
+		s->rt.priority = json_object_get_int(value);
+	}
+	s->rt.cpu = -1;
+	if (json_object_object_get_ex(config, "cpu", &value)) {
+		s->rt.cpu = json_object_get_int(value);
+	}
+	s->rt.mlock = false;
+	if (json_object_object_get_ex(config, "mlockall", &value)) {
+		s->rt.mlock = (bool)json_object_get_boolean(value);
+	}
+	memset(&s->stats, 0, sizeof(s->stats));
+	if (json_object_object_get_ex(config, "samplestats", &value)) {
+		s->stats.enabled = (bool)json_object_get_boolean(value);
+	}
+	if (json_object_object_get_ex(config, "statslog", &value)) {
+		s->stats.logfd = open(json_object_get_string(value),
+		    O_WRONLY | O_APPEND | O_CREAT, 0666);
+		if (s->stats.logfd == -1) {
+			perror("open(statslog)");
+			cleanup_r(s);
+			return EX_CANTCREAT;
 		}
-
-		if (y >= 0 && y < a / 2) {
-			bit.tlast0 = (int)bit.t;
+		res = logwriter_start(&s->stats.lw, s->stats.logfd,
+		    elw_minute, 0);
+		if (res != 0) {
+			fprintf(stderr, "logwriter_start(statslog): %s\n",
+			    strerror(res));
+			(void)close(s->stats.logfd);
+			cleanup_r(s);
+			return EX_OSERR;
 		}
-		y += a * (p * 1000000000 - y) / 1000000000;
+		s->stats.logging = true;
+		s->stats.enabled = true;
+	}
+	s->acq.enabled = false;
+	if (json_object_object_get_ex(config, "thread", &value)) {
+		s->acq.enabled = (bool)json_object_get_boolean(value);
+	}
+	s->eclass.enabled = false;
+	if (json_object_object_get_ex(config, "classifier", &value)) {
+		const char *classifier = json_object_get_string(value);
 
-		/*
-		 * Prevent algorithm collapse during thunderstorms or
+		if (strcmp(classifier, "edges") == 0) {
+			s->eclass.enabled = true;
+		} else if (strcmp(classifier, "samples") != 0) {
+			fprintf(stderr, "Unknown classifier '%s'\n", classifier);
+			cleanup_r(s);
+			return EX_DATAERR;
+		}
+	}
+	if (s->eclass.enabled && (s->hw.iomode != eio_cdev || s->acq.enabled ||
+	    s->hw.npins > 1)) {
+		fprintf(stderr, "classifier 'edges' requires iomode 'cdev' "
+		    "without a thread and a single pin\n");
+		cleanup_r(s);
+		return EX_DATAERR;
+	}
+	if (s->rate.min < s->rate.max && (s->eclass.enabled ||
+	    s->acq.enabled || json_object_object_get_ex(config, "capture",
+	    &value))) {
+		fprintf(stderr, "Key 'minfreq' requires classifier 'samples' "
+		    "without a thread and without 'capture'\n");
+		cleanup_r(s);
+		return EX_DATAERR;
+	}
+	if (s->eclass.enabled &&
+	    json_object_object_get_ex(config, "recordminutes", &value)) {
+		fprintf(stderr, "Key 'recordminutes' requires classifier "
+		    "'samples'\n");
+		cleanup_r(s);
+		return EX_DATAERR;
+	}
+	if (s->hw.npins > 1 &&
+	    json_object_object_get_ex(config, "capture", &value)) {
+		fprintf(stderr, "Key 'capture' requires a single pin\n");
+		cleanup_r(s);
+		return EX_DATAERR;
+	}
+#if defined(__FreeBSD__)
+	if (s->hw.iomode == eio_cdev) {
+		fprintf(stderr, "iomode 'cdev' is only available on Linux\n");
+		cleanup_r(s);
+		return EX_DATAERR;
+	}
+	if (json_object_object_get_ex(config, "iodev", &value)) {
+		s->hw.iodev = (unsigned)json_object_get_int(value);
+	} else {
+		fprintf(stderr, "Key 'iodev' not found\n");
+		cleanup_r(s);
+		return EX_DATAERR;
+	}
+	res = snprintf(buf, sizeof(buf), "/dev/gpioc%u", s->hw.iodev);
+	if (res < 0 || res >= sizeof(buf)) {
+		fprintf(stderr, "hw.iodev too high? (%i)\n", res);
+		cleanup_r(s);
+		return EX_DATAERR;
+	}
+	s->fd = open(buf, O_RDWR);
+	if (s->fd < 0) {
+		fprintf(stderr, "open %s: ", buf);
+		perror(NULL);
+		cleanup_r(s);
+		return errno;
+	}
+
+	for (i = 0; i < s->hw.npins; i++) {
+		pin.gp_pin = s->hw.pins[i];
+		pin.gp_flags = GPIO_PIN_INPUT;
+		if (ioctl(s->fd, GPIOSETCONFIG, &pin) < 0) {
+			perror("ioctl(GPIOSETCONFIG)");
+			cleanup_r(s);
+			return errno;
+		}
+	}
+#elif defined(__linux__)
+	if (s->hw.iomode == eio_cdev) {
+		res = open_cdev(s, config);
+	} else {
+		res = open_sysfs(s->hw.pins[0], &s->fd);
+		for (i = 1; res == 0 && i < s->hw.npins; i++) {
+			res = open_sysfs(s->hw.pins[i], &s->pinfd[i - 1]);
+		}
+	}
+	if (res != 0) {
+		cleanup_r(s);
+		return res;
+	}
+#endif
+	if (s->hw.iomode == eio_mmap && map_gpio(s, config) != 0) {
+		fprintf(stderr, "Falling back to regular GPIO access\n");
+		s->hw.iomode = eio_poll;
+	}
+	(void)clock_gettime(CLOCK_MONOTONIC, &tp);
+	s->sample_time.ns = tp.tv_sec * 1000000000LL + tp.tv_nsec;
+	s->sample_time.rem = 0;
+	s->second_ns = -1;
+	s->minute_ns = -1;
+	if (json_object_object_get_ex(config, "capture", &value)) {
+		res = capture_create(&s->cap, json_object_get_string(value),
+		    s->hw.freq, s->eclass.enabled, s->sample_time.ns);
+		if (res != 0) {
+			perror("capture_create");
+			cleanup_r(s);
+			return res;
+		}
+	}
+	if (json_object_object_get_ex(config, "recordminutes", &value)) {
+		struct json_object *dir;
+
+		res = set_recorder_r(s, (unsigned)json_object_get_int(value),
+		    json_object_object_get_ex(config, "recorddir", &dir) ?
+		    json_object_get_string(dir) : "/var/tmp");
+		if (res != 0) {
+			perror("set_recorder");
+			cleanup_r(s);
+			return res;
+		}
+	}
+	res = s->acq.enabled ? start_acquisition(s) : set_realtime(s->rt);
+	if (res != 0) {
+		cleanup_r(s);
+		return res;
+	}
+	s->filemode = 1;
+	return 0;
+#endif
+}
+
+int
+set_mode_live(struct json_object *config)
+{
+	return set_mode_live_r(&gb_default, config);
+}
+
+/* Set up live mode for the samples of s->src. */
+static int
+start_source(struct GB_state *s)
+{
+	s->hw.freq = s->src.freq;
+	if (s->hw.freq < 10 || s->hw.freq > 120000 || (s->hw.freq & 1) == 1) {
+		fprintf(stderr, "Invalid sample rate %u\n", s->hw.freq);
+		cleanup_r(s);
+		return EX_DATAERR;
+	}
+	s->bit.signal = malloc(s->hw.freq / 2);
+	s->rate.max = s->rate.min = s->hw.freq;
+	s->rate.clean = 0;
+	s->sleep.wake_ns = -1;
+	if (s->src.min_freq != 0) {
+		s->rate.min = s->src.min_freq;
+	}
+	s->hw.iomode = eio_poll;
+	s->hw.npins = 1;
+	s->acq.enabled = false;
+	s->eclass.enabled = false;
+	s->replay = true;
+	s->replay_end = false;
+	s->nsamples = 0;
+	s->filemode = 1;
+	return 0;
+}
+
+static int
+replay_next(void *arg)
+{
+	return capture_next(arg);
+}
+
+int
+set_mode_replay_r(struct GB_state *s, const char * const capfilename)
+{
+	int res;
+
+	if (s->filemode != 0) {
+		fprintf(stderr, "Already initialized to %s mode.\n",
+		    s->filemode == 1 ? "live" : "file");
+		cleanup_r(s);
+		return -1;
+	}
+	if (capfilename == NULL) {
+		fprintf(stderr, "capfilename is NULL\n");
+		return -1;
+	}
+	res = capture_open(&s->cap, capfilename);
+	if (res != 0) {
+		fprintf(stderr, "capture_open(%s): %s\n", capfilename,
+		    strerror(res));
+		return res;
+	}
+	s->src.next = replay_next;
+	s->src.arg = &s->cap;
+	s->src.freq = s->cap.freq;
+	s->src.start_ns = 0;
+	s->src.min_freq = 0;
+	return start_source(s);
+}
+
+int
+set_mode_replay(const char * const capfilename)
+{
+	return set_mode_replay_r(&gb_default, capfilename);
+}
+
+int
+set_mode_source_r(struct GB_state *s, const struct pulse_source *src)
+{
+	if (s->filemode != 0) {
+		fprintf(stderr, "Already initialized to %s mode.\n",
+		    s->filemode == 1 ? "live" : "file");
+		cleanup_r(s);
+		return -1;
+	}
+	if (src == NULL || src->next == NULL) {
+		fprintf(stderr, "pulse source is NULL\n");
+		return -1;
+	}
+	if (src->min_freq != 0 && (src->min_freq < 10 ||
+	    src->min_freq > src->freq || (src->min_freq & 1) == 1)) {
+		fprintf(stderr, "Invalid minimum sample rate %u\n",
+		    src->min_freq);
+		return EX_DATAERR;
+	}
+	s->src = *src;
+	return start_source(s);
+}
+
+int
+set_mode_source(const struct pulse_source *src)
+{
+	return set_mode_source_r(&gb_default, src);
+}
+
+/* Wait for the dump being written, if any. */
+static void
+join_writer(struct GB_state *s)
+{
+	if (s->rec.writing) {
+		(void)pthread_join(s->rec.writer, NULL);
+		s->rec.writing = false;
+	}
+}
+
+int
+set_recorder_r(struct GB_state *s, unsigned minutes, const char *dir)
+{
+	join_writer(s);
+	free(s->rec.bits);
+	free(s->rec.snap);
+	free(s->rec.dir);
+	s->rec.bits = NULL;
+	s->rec.snap = NULL;
+	s->rec.dir = NULL;
+	if (minutes == 0) {
+		return 0;
+	}
+	if (s->eclass.enabled || s->hw.freq == 0) {
+		return EINVAL;
+	}
+	/* a multiple of 8 as the sample rate is even */
+	s->rec.size = 60ULL * minutes * s->hw.freq;
+	s->rec.bits = calloc(s->rec.size / 8, 1);
+	s->rec.snap = malloc(s->rec.size / 8);
+	s->rec.dir = strdup(dir);
+	if (s->rec.bits == NULL || s->rec.snap == NULL ||
+	    s->rec.dir == NULL) {
+		free(s->rec.bits);
+		free(s->rec.snap);
+		free(s->rec.dir);
+		s->rec.bits = NULL;
+		s->rec.snap = NULL;
+		s->rec.dir = NULL;
+		return ENOMEM;
+	}
+	clear_recorder(s);
+	return 0;
+}
+
+int
+set_recorder(unsigned minutes, const char *dir)
+{
+	return set_recorder_r(&gb_default, minutes, dir);
+}
+
+/* The sample number i of the copy of the flight recorder. */
+static int
+recorded(const struct GB_state *s, unsigned long long i)
+{
+	i %= s->rec.size;
+	return (s->rec.snap[i / 8] >> (i & 7)) & 1;
+}
+
+/*
+ * Write the copy of the flight recorder in its own thread, so that the file
+ * I/O does not delay sampling when that happens in the calling thread.
+ */
+static void *
+write_dump(void *arg)
+{
+	struct GB_state *s = arg;
+	struct capture c;
+	unsigned long long i, n, count = s->rec.snap_count;
+	int res;
+
+	res = capture_create(&c, s->rec.name, s->rec.snap_freq, false, 0);
+	if (res == 0) {
+		/*
+		 * Start at the first active signal after the oldest sample,
+		 * which is the start of a second, as the live decoder does
+		 * not lock on quickly when started in the idle part of a
+		 * second.
+		 */
+		n = count < s->rec.size ? count : s->rec.size;
+		for (i = count - n + 1; i < count &&
+		    (recorded(s, i - 1) != 0 || recorded(s, i) == 0); i++)
+			; /* empty loop */
+		for (; i < count; i++) {
+			capture_sample(&c, recorded(s, i));
+		}
+		res = capture_close(&c);
+	}
+	if (res != 0) {
+		fprintf(stderr, "dump_recorder(%s): %s\n", s->rec.name,
+		    strerror(res));
+	}
+	__atomic_store_n(&s->rec.written, res, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+int
+dump_recorder_r(struct GB_state *s)
+{
+	pthread_attr_t attr;
+	struct sched_param sp;
+	struct tm tm;
+	time_t now;
+	int res;
+
+	if (s->rec.bits == NULL) {
+		return EINVAL;
+	}
+	if (s->rec.count < s->rec.next) {
+		return EAGAIN;
+	}
+	if (s->rec.writing) {
+		if (__atomic_load_n(&s->rec.written, __ATOMIC_ACQUIRE) == -1) {
+			return EBUSY;
+		}
+		join_writer(s);
+	}
+	now = time(NULL);
+	(void)gmtime_r(&now, &tm);
+	res = snprintf(s->rec.name, sizeof(s->rec.name),
+	    "%s/nplpi-%04d%02d%02dT%02d%02d%02d-%u.npc", s->rec.dir,
+	    tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour,
+	    tm.tm_min, tm.tm_sec, s->rec.dumps + 1);
+	if (res < 0 || (size_t)res >= sizeof(s->rec.name)) {
+		return ENAMETOOLONG;
+	}
+	memcpy(s->rec.snap, s->rec.bits, s->rec.size / 8);
+	s->rec.snap_count = s->rec.count;
+	s->rec.snap_freq = s->hw.freq;
+	s->rec.written = -1;
+
+	/* never compete with real-time sampling in the calling thread */
+	memset(&sp, 0, sizeof(sp));
+	res = pthread_attr_init(&attr);
+	if (res != 0) {
+		return res;
+	}
+	(void)pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	(void)pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+	(void)pthread_attr_setschedparam(&attr, &sp);
+	res = pthread_create(&s->rec.writer, &attr, write_dump, s);
+	(void)pthread_attr_destroy(&attr);
+	if (res != 0) {
+		return res;
+	}
+	s->rec.writing = true;
+	s->rec.next = s->rec.count + s->rec.size;
+	s->rec.dumps++;
+	return 0;
+}
+
+int
+dump_recorder(void)
+{
+	return dump_recorder_r(&gb_default);
+}
+
+void
+cleanup_r(struct GB_state *s)
+{
+	unsigned i;
+
+	stop_acquisition(s);
+	if (s->fd > 0 && close(s->fd) == -1) {
+#if defined(__FreeBSD__)
+		perror("close(/dev/gpioc*)");
+#elif defined(__linux__)
+		perror("close(/sys/class/gpio/*)");
+#endif
+	}
+	s->fd = 0;
+	for (i = 0; i < GB_MAXPINS - 1; i++) {
+		if (s->pinfd[i] > 0) {
+			(void)close(s->pinfd[i]);
+		}
+		s->pinfd[i] = 0;
+	}
+	if (s->gpio_reg != NULL) {
+		(void)munmap((void *)s->gpio_reg, GPIO_MAPLEN);
+		s->gpio_reg = NULL;
+	}
+	if (s->cap.f != NULL && capture_close(&s->cap) != 0) {
+		perror("capture_close");
+	}
+	if (s->stats.logging) {
+		s->stats.logging = false;
+		if (logwriter_stop(&s->stats.lw) != 0) {
+			fprintf(stderr, "Could not write the statslog\n");
+		}
+		(void)close(s->stats.logfd);
+	}
+	s->replay = false;
+	if (s->logging && close_logfile_r(s) != 0) {
+		perror("close_logfile");
+	}
+	if (s->infile.map != NULL && !s->infile.shared) {
+		if (s->infile.mapped) {
+			(void)munmap((void *)s->infile.map, s->infile.maplen);
+		} else {
+			free((void *)s->infile.map);
+		}
+	}
+	if (!s->infile.shared) {
+		free(s->infile.text);
+	}
+	s->infile.map = NULL;
+	s->infile.text = NULL;
+	s->infile.buf = NULL;
+	free(s->bit.signal);
+	s->bit.signal = NULL;
+	(void)set_recorder_r(s, 0, NULL);
+}
+
+void
+cleanup(void)
+{
+	cleanup_r(&gb_default);
+}
+
+#if !defined(NOLIVE)
+/* Read one pin through sysfs or gpioc. */
+static int
+read_pin(struct GB_state *s, unsigned i)
+{
+	int tmpch, count = 0;
+#if defined(__FreeBSD__)
+	struct gpio_req req;
+
+	req.gp_pin = s->hw.pins[i];
+	count = ioctl(s->fd, GPIOGET, &req);
+	tmpch = (req.gp_value == GPIO_PIN_HIGH) ? 1 : 0;
+	if (count < 0) {
+#elif defined(__linux__)
+	int fd = i == 0 ? s->fd : s->pinfd[i - 1];
+
+	count = read(fd, &tmpch, 1);
+	tmpch -= '0';
+	if (lseek(fd, 0, SEEK_SET) == (off_t)-1)
+		return 2; /* rewind to prevent EBUSY/no read failed */
+	if (count != 1) {
+#endif
+		return 2; /* hardware failure? */
+	}
+
+	if (!s->hw.active_high) {
+		tmpch = 1 - tmpch;
+	}
+	return tmpch;
+}
+#endif
+
+/*
+ * Read the pins directly from the hardware, the level of pin i goes into
+ * bit i of the sample.
+ */
+static int
+read_pins(struct GB_state *s)
+{
+#if defined(NOLIVE)
+	return SAMPLE_ERROR;
+#else
+	unsigned i;
+	int p = 0;
+
+	if (s->gpio_reg != NULL) {
+		uint32_t lev[2];
+		unsigned banks = 0;
+
+		/* read each register at most once for all pins */
+		for (i = 0; i < s->hw.npins; i++) {
+			unsigned bank = s->hw.pins[i] / 32;
+
+			if ((banks & (1U << bank)) == 0) {
+				lev[bank] = s->gpio_reg[GPIO_GPLEV0 + bank];
+				banks |= 1U << bank;
+			}
+			p |= (int)((lev[bank] >> (s->hw.pins[i] % 32)) & 1) << i;
+		}
+		return s->hw.active_high ? p : p ^ ((1 << s->hw.npins) - 1);
+	}
+#if defined(__linux__)
+	if (s->hw.iomode == eio_cdev) {
+		struct gpio_v2_line_values values;
+
+		values.mask = (1U << s->hw.npins) - 1;
+		if (ioctl(s->fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) < 0) {
+			return SAMPLE_ERROR;
+		}
+		/* the kernel already applied the active_high logic */
+		return (int)(values.bits & values.mask);
+	}
+#endif
+	for (i = 0; i < s->hw.npins; i++) {
+		int tmpch = read_pin(s, i);
+
+		if (tmpch == 2) {
+			return SAMPLE_ERROR;
+		}
+		p |= tmpch << i;
+	}
+	return p;
+#endif
+}
+
+/*
+ * The value of the majority of the pins in the sample, or of the first pin
+ * in case of a tie.
+ */
+static int
+vote(struct GB_state *s, int p)
+{
+	unsigned i, ones = 0;
+
+	for (i = 0; i < s->hw.npins; i++) {
+		ones += (p >> i) & 1;
+	}
+	if (2 * ones == s->hw.npins) {
+		return p & 1;
+	}
+	return 2 * ones > s->hw.npins ? 1 : 0;
+}
+
+int
+get_pulse_r(struct GB_state *s)
+{
+	int p;
+
+	if (s->acq.running) {
+		p = __atomic_load_n(&s->acq.last, __ATOMIC_ACQUIRE);
+	} else {
+		p = read_pins(s);
+	}
+	return p == SAMPLE_ERROR ? 2 : vote(s, p);
+}
+
+int
+get_pulse(void)
+{
+	return get_pulse_r(&gb_default);
+}
+
+/*
+ * Add to a sampling statistic, which is only written by the sampling thread
+ * but can be read from another thread.
+ */
+static void
+stat_add(unsigned long long *v, unsigned long long n)
+{
+	__atomic_store_n(v, __atomic_load_n(v, __ATOMIC_RELAXED) + n,
+	    __ATOMIC_RELAXED);
+}
+
+/*
+ * Count a reset of the decoder, which is only written by the decoding
+ * thread but can be read from another thread.
+ */
+static void
+count_reset(unsigned *v)
+{
+	__atomic_store_n(v, __atomic_load_n(v, __ATOMIC_RELAXED) + 1,
+	    __ATOMIC_RELAXED);
+}
+
+static long long
+now_ns(void)
+{
+	struct timespec tp;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &tp);
+	return tp.tv_sec * 1000000000LL + tp.tv_nsec;
+}
+
+/* Account a sample taken late ns after it was due, which took read ns. */
+static void
+stat_sample(struct GB_state *s, long long late, long long read)
+{
+	unsigned b;
+
+	for (b = 0; b < SS_BUCKETS - 1 && late >= 1000LL << b; b++)
+		; /* empty loop */
+	stat_add(&s->stats.cur.latency[b], 1);
+	stat_add(&s->stats.cur.reads, 1);
+	stat_add(&s->stats.cur.read_ns, (unsigned long long)read);
+	if ((unsigned long long)read > s->stats.cur.read_max_ns) {
+		__atomic_store_n(&s->stats.cur.read_max_ns,
+		    (unsigned long long)read, __ATOMIC_RELAXED);
+	}
+}
+
+static void
+next_sample_time(struct GB_state *s)
+{
+	s->sample_time.ns += 1000000000 / s->hw.freq;
+	s->sample_time.rem += 1000000000 % s->hw.freq;
+	if (s->sample_time.rem >= s->hw.freq) {
+		s->sample_time.ns++;
+		s->sample_time.rem -= s->hw.freq;
+	}
+}
+
+/*
+ * Wait until the time of the next sample. The sample times are absolute and
+ * derived from a single reference time, so any time spent elsewhere or an
+ * overrun is not accumulated as drift. When too late, skip the missed
+ * samples instead of reading the pin repeatedly to catch up. Returns the
+ * time at which the sample was due.
+ */
+static long long
+wait_sample_time(struct GB_state *s)
+{
+	long long due;
+#if !defined(MACOS)
+	struct timespec tp;
+	long long now;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &tp);
+	now = tp.tv_sec * 1000000000LL + tp.tv_nsec;
+	if (now > s->sample_time.ns) {
+		stat_add(&s->stats.cur.overruns, 1);
+	}
+	if (now - s->sample_time.ns > MAX_LATE) {
+		stat_add(&s->stats.cur.skipped, (unsigned long long)
+		    ((now - s->sample_time.ns) * s->hw.freq / 1000000000));
+		s->sample_time.ns = now;
+		s->sample_time.rem = 0;
+	} else if (s->gpio_reg != NULL && s->sample_time.ns - now < SPIN_WAIT) {
+		/* a system call would take longer */
+		while (now < s->sample_time.ns) {
+			(void)clock_gettime(CLOCK_MONOTONIC, &tp);
+			now = tp.tv_sec * 1000000000LL + tp.tv_nsec;
+		}
+	} else if (now < s->sample_time.ns) {
+		tp.tv_sec = s->sample_time.ns / 1000000000;
+		tp.tv_nsec = s->sample_time.ns % 1000000000;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tp,
+		    NULL) == EINTR)
+			; /* empty loop */
+	}
+#else
+	struct timespec slp;
+
+	slp.tv_sec = 0;
+	slp.tv_nsec = 1000000000 / s->hw.freq;
+	while (nanosleep(&slp, &slp) > 0)
+		; /* empty loop */
+#endif
+	due = s->sample_time.ns;
+	next_sample_time(s);
+	return due;
+}
+
+#if defined(__linux__)
+/*
+ * Read the pending edge events from the GPIO character device into the edge
+ * buffer, now is the time just before reading them.
+ */
+static bool
+read_edges(struct GB_state *s, long long now)
+{
+	ssize_t count;
+	bool lost;
+
+	count = read(s->fd, s->edges.ev, sizeof(s->edges.ev));
+	if (count < (ssize_t)sizeof(s->edges.ev[0])) {
+		return false;
+	}
+	s->edges.head = 0;
+	s->edges.count = (unsigned)count / sizeof(s->edges.ev[0]);
+	/* the sequence number counts the events of all pins */
+	lost = s->edges.seqno != 0 &&
+	    s->edges.ev[0].seqno != s->edges.seqno + 1;
+	s->edges.seqno = s->edges.ev[s->edges.count - 1].seqno;
+	if (lost) {
+		/* kernel buffer overflowed, edges got lost */
+		return false;
+	}
+	/* any events not read yet happened after the last one read */
+	s->edges.known_ns = s->edges.count == EVBUFLEN ?
+	    (long long)s->edges.ev[s->edges.count - 1].timestamp_ns : now;
+	return true;
+}
+
+/* Update the pin values with an edge event. */
+static void
+apply_edge(struct GB_state *s, const struct gpio_v2_line_event *ev)
+{
+	unsigned i;
+
+	for (i = 0; i < s->hw.npins && s->hw.pins[i] != ev->offset; i++)
+		; /* empty loop */
+	if (i == s->hw.npins) {
+		return;
+	}
+	if (ev->id == GPIO_V2_LINE_EVENT_RISING_EDGE) {
+		s->edges.level |= 1 << i;
+	} else {
+		s->edges.level &= ~(1 << i);
+	}
+}
+#endif
+
+/*
+ * Determine the pin values at the time of the next sample from the edge
+ * events of the GPIO character device. Instead of waking up for every
+ * sample, wait until either an edge arrives or EDGE_WAIT ns have passed and
+ * then return every sample up to that point at once, the pin value is known
+ * to be constant in between. Without blocking, return -1 instead of waiting.
+ */
+static int
+get_pulse_cdev(struct GB_state *s, bool block)
+{
+#if defined(__linux__)
+	long long t = s->sample_time.ns;
+
+	for (;;) {
+		struct pollfd pfd;
+		struct timespec tp;
+		long long now;
+		int timeout;
+
+		while (s->edges.head < s->edges.count &&
+		    (long long)s->edges.ev[s->edges.head].timestamp_ns <= t) {
+			apply_edge(s, &s->edges.ev[s->edges.head++]);
+		}
+		if (s->edges.head < s->edges.count || t <= s->edges.known_ns) {
+			next_sample_time(s);
+			return s->edges.level;
+		}
+
+		(void)clock_gettime(CLOCK_MONOTONIC, &tp);
+		now = tp.tv_sec * 1000000000LL + tp.tv_nsec;
+		timeout = block && now < t ?
+		    (int)((t - now + EDGE_WAIT) / 1000000) : 0;
+		pfd.fd = s->fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		if (poll(&pfd, 1, timeout) < 0 && errno != EINTR) {
+			next_sample_time(s);
+			return SAMPLE_ERROR;
+		}
+		(void)clock_gettime(CLOCK_MONOTONIC, &tp);
+		now = tp.tv_sec * 1000000000LL + tp.tv_nsec;
+		if ((pfd.revents & POLLIN) == 0) {
+			/* no edges up to now */
+			s->edges.known_ns = now;
+			if (!block && t > now) {
+				return -1;
+			}
+			continue;
+		}
+		if (!read_edges(s, now)) {
+			next_sample_time(s);
+			return SAMPLE_ERROR;
+		}
+	}
+#else
+	(void)block;
+	return SAMPLE_ERROR;
+#endif
+}
+
+/* Nanoseconds until the next sample is due, 0 or less if it is due. */
+static long long
+sample_wait(const struct GB_state *s)
+{
+	struct timespec tp;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &tp);
+	return s->sample_time.ns - (tp.tv_sec * 1000000000LL + tp.tv_nsec);
+}
+
+/*
+ * Take the next sample at its scheduled time. Without blocking, return -1
+ * if that time has not come yet.
+ */
+static int
+sample_pulse(struct GB_state *s, bool block)
+{
+	long long due, t0;
+	int p;
+
+	if (s->hw.iomode == eio_cdev) {
+		return get_pulse_cdev(s, block);
+	}
+	if (!block && sample_wait(s) > 0) {
+		return -1;
+	}
+	due = wait_sample_time(s);
+	if (!s->stats.enabled) {
+		return read_pins(s);
+	}
+	t0 = now_ns();
+	p = read_pins(s);
+	stat_sample(s, t0 - due, now_ns() - t0);
+	return p;
+}
+
+/*
+ * Acquisition thread: take the samples and hand them over to the decoder
+ * through the ring buffer, so that the decoder, the log file and the user
+ * interface cannot delay the sampling.
+ */
+static void *
+acquire(void *arg)
+{
+	struct GB_state *s = arg;
+	int res;
+
+	res = set_realtime(s->rt);
+	__atomic_store_n(&s->acq.status, res, __ATOMIC_RELEASE);
+	if (res != 0) {
+		return NULL;
+	}
+	while (__atomic_load_n(&s->acq.stop, __ATOMIC_ACQUIRE) == 0) {
+		int p = sample_pulse(s, true);
+
+		__atomic_store_n(&s->acq.last, p, __ATOMIC_RELEASE);
+		if (!ring_put(&s->acq.samples, (unsigned char)p)) {
+			/* decoder too slow, this sample is lost */
+			stat_add(&s->stats.cur.lost, 1);
+			if (__atomic_load_n(&s->acq.gap_set,
+			    __ATOMIC_ACQUIRE) == 0) {
+				s->acq.gap = s->acq.samples.head;
+				__atomic_store_n(&s->acq.gap_set, 1,
+				    __ATOMIC_RELEASE);
+			}
+		}
+		__atomic_store_n(&s->acq.ns,
+		    s->sample_time.ns - 1000000000 / s->hw.freq,
+		    __ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+static int
+start_acquisition(struct GB_state *s)
+{
+	struct timespec slp;
+	int res;
+
+	/* hold two seconds worth of samples */
+	res = ring_init(&s->acq.samples, 2 * s->hw.freq);
+	if (res != 0) {
+		return res;
+	}
+	s->acq.status = -1;
+	s->acq.stop = 0;
+	s->acq.gap_set = 0;
+	res = pthread_create(&s->acq.thread, NULL, acquire, s);
+	if (res != 0) {
+		ring_free(&s->acq.samples);
+		return res;
+	}
+	slp.tv_sec = 0;
+	slp.tv_nsec = 1000000;
+	while ((res = __atomic_load_n(&s->acq.status, __ATOMIC_ACQUIRE)) ==
+	    -1) {
+		(void)nanosleep(&slp, NULL);
+	}
+	if (res != 0) {
+		(void)pthread_join(s->acq.thread, NULL);
+		ring_free(&s->acq.samples);
+		return res;
+	}
+	s->acq.running = true;
+	return 0;
+}
+
+static void
+stop_acquisition(struct GB_state *s)
+{
+	if (s->acq.running) {
+		__atomic_store_n(&s->acq.stop, 1, __ATOMIC_RELEASE);
+		(void)pthread_join(s->acq.thread, NULL);
+		ring_free(&s->acq.samples);
+		s->acq.running = false;
+	}
+}
+
+/*
+ * Obtain the next sample, either directly or from the acquisition thread.
+ * Without blocking, return -1 if the sample is not available yet.
+ */
+static int
+next_pulse(struct GB_state *s, bool block)
+{
+	int p;
+
+	if (s->replay) {
+		unsigned skip = s->src.freq / s->hw.freq;
+
+		/* at a lower adaptive rate, take the last one of each group */
+		do {
+			p = s->src.next(s->src.arg);
+			if (p == -1) {
+				/* the end is like an I/O error */
+				s->replay_end = true;
+				return SAMPLE_ERROR;
+			}
+			s->nsamples++;
+		} while (--skip > 0);
+		return p == 2 ? SAMPLE_ERROR : p;
+	}
+	if (!s->acq.running) {
+		p = sample_pulse(s, block);
+		if (p == -1) {
+			return -1;
+		}
+	} else {
+		while ((p = ring_get(&s->acq.samples)) == -1) {
+			struct timespec slp;
+
+			if (!block) {
+				return -1;
+			}
+			slp.tv_sec = 0;
+			slp.tv_nsec = RING_WAIT;
+			(void)nanosleep(&slp, NULL);
+		}
+		/* the bit misses the samples lost before this one */
+		if (__atomic_load_n(&s->acq.gap_set, __ATOMIC_ACQUIRE) != 0 &&
+		    s->acq.samples.tail - 1 == s->acq.gap) {
+			s->gb_res.bad_io = true;
+			__atomic_store_n(&s->acq.gap_set, 0, __ATOMIC_RELEASE);
+		}
+	}
+	if (s->cap.f != NULL) {
+		/* only with a single pin */
+		capture_sample(&s->cap, p == SAMPLE_ERROR ? 2 : p);
+	}
+	return p;
+}
+
+/*
+ * Time in ns of CLOCK_MONOTONIC of the sample just returned by next_pulse(),
+ * or of the virtual clock for a pulse source. With the acquisition thread,
+ * the time follows from the most recent sample and the number of samples
+ * still in the ring buffer, which can be off by one sample.
+ */
+static long long
+pulse_time(struct GB_state *s)
+{
+	long long period = 1000000000 / s->hw.freq;
+
+	if (s->replay) {
+		return s->src.start_ns + (long long)((s->nsamples - 1) *
+		    1000000000ULL / s->src.freq);
+	}
+	if (s->acq.running) {
+		return __atomic_load_n(&s->acq.ns, __ATOMIC_ACQUIRE) -
+		    (long long)ring_count(&s->acq.samples) * period;
+	}
+	return s->sample_time.ns - period;
+}
+
+/* Store the value of the current bit in both forms of the bit buffer. */
+static void
+set_buffer(struct GB_state *s, int value, unsigned confidence)
+{
+	uint64_t mask = 1ULL << (63 - s->bitpos);
+
+	s->gb_res.confidence = confidence;
+	s->conf[s->bitpos] = (unsigned char)confidence;
+	s->buffer[s->bitpos] = value;
+	s->bits[0] = (value & 1) != 0 ? s->bits[0] | mask : s->bits[0] & ~mask;
+	s->bits[1] = (value & 2) != 0 ? s->bits[1] | mask : s->bits[1] & ~mask;
+}
+
+/*
+ * Clear the cutoff value and the state values, except emark_toolong and
+ * emark_late to be able to determine if this flag can be cleared again.
+ */
+static void
+set_new_state(struct GB_state *s)
+{
+	if (!s->gb_res.skip) {
+		s->cutoff = -1;
+	}
+	s->gb_res.bad_io = false;
+	s->gb_res.bitval = ebv_none;
+	if (s->gb_res.marker != emark_toolong &&
+	    s->gb_res.marker != emark_late) {
+		s->gb_res.marker = emark_none; // XXX never true for NPL ?
+	}
+	s->gb_res.hwstat = ehw_ok;
+	s->gb_res.done = false;
+	s->gb_res.skip = false;
+	s->gb_res.newline = false;
+	s->gb_res.confidence = 0;
+}
+
+/*
+ * Append a symbol to the log file, see binlog_put(). This only copies it
+ * into the buffer of the log writer, which does the actual I/O.
+ */
+static void
+write_log(struct GB_state *s, int ch)
+{
+	char buf[16];
+	int len;
+
+	if (!s->logging) {
+		return;
+	}
+	if (s->binary_log) {
+		binlog_put(&s->blog, ch, s->acc_minlen);
+	} else {
+		if (ch == 'a') {
+			len = snprintf(buf, sizeof(buf), "a%u", s->acc_minlen);
+		} else if (ch == BINLOG_NEWLOG) {
+			len = snprintf(buf, sizeof(buf), "\n--new log--\n\n");
+		} else {
+			buf[0] = (char)ch;
+			len = 1;
+		}
+		logwriter_append(&s->lw, buf, (size_t)len);
+	}
+	if (ch == '\n') {
+		logwriter_minute(&s->lw);
+	}
+}
+
+static void
+reset_frequency(struct GB_state *s)
+{
+	if (s->bit.realfreq <= s->hw.freq * 500000ULL) {
+		write_log(s, '<');
+	} else if (s->bit.realfreq > s->hw.freq * 1500000ULL) {
+		write_log(s, '>');
+	}
+	s->bit.realfreq = s->hw.freq * 1000000ULL;
+	s->bit.freq_reset = true;
+	count_reset(&s->stats.cur.freq_resets);
+}
+
+static void
+reset_bitlen(struct GB_state *s)
+{
+	write_log(s, '!');
+	s->bit.bit0 = s->bit.realfreq / 2;
+	s->bit.bit5x = s->bit.realfreq / 10;
+	s->bit.bitlen_reset = true;
+	count_reset(&s->stats.cur.bitlen_resets);
+}
+
+/*
+ * The time at which the active signal of more than half of the pins had
+ * ended, which is the median for an odd number of pins and the later one of
+ * the middle two for an even number, or -1 if not that many ended yet.
+ */
+static int
+median_tlow(const int tlow[], unsigned n)
+{
+	int sorted[GB_MAXPINS];
+	unsigned i, j, count = 0;
+
+	for (i = 0; i < n; i++) {
+		if (tlow[i] == -1) {
+			continue;
+		}
+		/* insertion sort, n is small */
+		for (j = count; j > 0 && sorted[j - 1] > tlow[i]; j--) {
+			sorted[j] = sorted[j - 1];
+		}
+		sorted[j] = tlow[i];
+		count++;
+	}
+	return 2 * count <= n ? -1 : sorted[n / 2];
+}
+
+/* Start the flight recorder over, a minute of samples allows a dump. */
+static void
+clear_recorder(struct GB_state *s)
+{
+	s->rec.count = 0;
+	s->rec.next = 60ULL * s->hw.freq;
+}
+
+static void
+record_sample(struct GB_state *s, int v)
+{
+	unsigned long long i = s->rec.count++ % s->rec.size;
+
+	if (v != 0) {
+		s->rec.bits[i / 8] |= (unsigned char)(1 << (i & 7));
+	} else {
+		s->rec.bits[i / 8] &= (unsigned char)~(1 << (i & 7));
+	}
+}
+
+/* Start measuring (the rest of) the current bit at sample start. */
+static void
+start_pulses(struct GB_state *s, unsigned start)
+{
+	unsigned i;
+
+	/* Set up filter, reach 50% after hw.freq/20 samples (i.e. 50 ms) */
+	s->live.a = 1000000000 -
+	    (long long)(1000000000 * exp2(-20.0 / s->hw.freq));
+	for (i = 0; i < s->hw.npins; i++) {
+		s->live.y[i] = 1000000000;
+		s->live.stv[i] = 1;
+		s->live.tlow[i] = -1;
+	}
+	s->live.ended = 0;
+	s->bit.t = start;
+}
+
+/*
+ * Process the samples of the current bit started by start_pulses(). Without
+ * blocking, return false as soon as the next sample is not available yet,
+ * the next call continues with that sample.
+ */
+static bool
+collect_pulses(struct GB_state *s, bool block, int *init_bit, bool *adj_freq)
+{
+	/* filter and Schmitt trigger state of each pin */
+	long long *y = s->live.y;
+	unsigned *stv = s->live.stv;
+	int *tlow = s->live.tlow;
+	long long a = s->live.a;
+	unsigned i, n = s->hw.npins;
+
+	for (;; s->bit.t++) {
+		int p = next_pulse(s, block);
+		unsigned low = 0;
+
+		if (p == -1) {
+			return false;
+		}
+		if (s->bit.t == 0) {
+			s->live.start_ns = pulse_time(s);
+		}
+		if (s->rec.bits != NULL) {
+			record_sample(s, p == SAMPLE_ERROR ? 0 : vote(s, p));
+		}
+		if (p == SAMPLE_ERROR) {
+			s->gb_res.bad_io = true;
+			break;
+		}
+		if (s->bit.signal != NULL) {
+			if ((s->bit.t & 7) == 0) {
+				s->bit.signal[s->bit.t / 8] = 0;
+			}
+			/* clear data from previous second */
+			s->bit.signal[s->bit.t / 8] |=
+			    vote(s, p) << (unsigned char)(s->bit.t & 7);
+		}
+
+		for (i = 0; i < n; i++) {
+			if (y[i] >= 0 && y[i] < a / 2) {
+				low++;
+			}
+			y[i] += a * (((p >> i) & 1) * 1000000000 - y[i]) /
+			    1000000000;
+		}
+		if (2 * low > n) {
+			s->bit.tlast0 = (int)s->bit.t;
+		}
+
+		/*
+		 * Prevent algorithm collapse during thunderstorms or
 		 * scheduler abuse
 		 */
-		if (bit.realfreq <= hw.freq * 500000 ||
-		    bit.realfreq > hw.freq * 1000000) {
-			reset_frequency();
+		if (s->bit.realfreq <= s->hw.freq * 500000ULL ||
+		    s->bit.realfreq > s->hw.freq * 1500000ULL) {
+			reset_frequency(s);
 			*adj_freq = false;
 		}
 
-		if (bit.t > bit.realfreq * 1500000) {
-			if (bit.tlow <= hw.freq / 20) {
-				gb_res.hwstat = ehw_receive;
-				outch = 'r';
-			} else if (bit.tlow * 100 / bit.t >= 99) {
-				gb_res.hwstat = ehw_transmit;
-				outch = 'x';
+		/*
+		 * Time out after 1.5 bits, and at the latest before the next
+		 * sample would not fit in bit.signal, which holds four
+		 * seconds at the highest sample rate.
+		 */
+		if ((unsigned long long)s->bit.t * 1000000 >
+		    s->bit.realfreq * 3 / 2 ||
+		    s->bit.t + 1 >= s->rate.max / 2 * 8) {
+			if (s->bit.tlow <= s->hw.freq / 20) {
+				s->gb_res.hwstat = ehw_receive;
+			} else if (s->bit.tlow * 100 / s->bit.t >= 99) {
+				s->gb_res.hwstat = ehw_transmit;
 			} else {
-				gb_res.hwstat = ehw_random;
-				outch = '#';
+				s->gb_res.hwstat = ehw_random;
 			}
+			reset_frequency(s);
 			*adj_freq = false;
 			break; /* timeout */
 		}
 
 		/*
 		 * Schmitt trigger, maximize value to introduce hysteresis and
-		 * to avoid infinite memory.
+		 * to avoid infinite memory. Pins which already saw the end of
+		 * the second (stv 2) wait for the others, a second only ends
+		 * once more than half of the pins saw it end, so that a
+		 * single noisy pin cannot end it early.
 		 */
-		if (y < 500000000 && stv == 1) {
-			/* end of high part of second */
-			y = 0;
-			stv = 0;
-			bit.tlow = (int)bit.t;
+		for (i = 0; i < n; i++) {
+			if (y[i] < 500000000 && stv[i] == 1) {
+				/* end of high part of second */
+				y[i] = 0;
+				stv[i] = 0;
+				tlow[i] = (int)s->bit.t;
+				s->bit.tlow = median_tlow(tlow, n);
+			}
+			if (y[i] > 500000000 && stv[i] == 0) {
+				/* end of low part of second */
+				stv[i] = 2;
+				s->live.ended++;
+			}
+		}
+		if (2 * s->live.ended > n) {
+			if (*init_bit == 2) {
+				*init_bit = 1;
+			}
+			break; /* start of new second */
+		}
+	}
+	return true;
+}
+
+#if defined(__linux__)
+/*
+ * Wait until the deadline (in ns) for the next edge event. An event at or
+ * after the deadline is left for the next call, which happens when it was
+ * read in the same batch as earlier events.
+ *
+ * Returns 1 for a rising edge, 0 for a falling edge, -1 if the deadline
+ * passed, or 2 on a hardware error.
+ */
+static int
+read_edge(struct GB_state *s, long long deadline, long long *ts)
+{
+	for (;;) {
+		struct pollfd pfd;
+		struct timespec tp;
+		long long now;
+
+		if (s->edges.head < s->edges.count) {
+			*ts = (long long)
+			    s->edges.ev[s->edges.head].timestamp_ns;
+			if (*ts >= deadline) {
+				return -1;
+			}
+			apply_edge(s, &s->edges.ev[s->edges.head++]);
+			if (s->cap.f != NULL) {
+				capture_edge(&s->cap, s->edges.level, *ts);
+			}
+			return s->edges.level;
+		}
+		(void)clock_gettime(CLOCK_MONOTONIC, &tp);
+		now = tp.tv_sec * 1000000000LL + tp.tv_nsec;
+		if (now >= deadline) {
+			return -1;
+		}
+		pfd.fd = s->fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		if (poll(&pfd, 1, (int)((deadline - now) / 1000000) + 1) < 0 &&
+		    errno != EINTR) {
+			return 2;
+		}
+		if ((pfd.revents & POLLIN) != 0) {
+			(void)clock_gettime(CLOCK_MONOTONIC, &tp);
+			if (!read_edges(s,
+			    tp.tv_sec * 1000000000LL + tp.tv_nsec)) {
+				return 2;
+			}
+		}
+	}
+}
+
+/*
+ * Like read_edge(), but ignore pairs of edges less than GLITCH ns apart,
+ * which the low-pass filter would remove in collect_pulses().
+ */
+static int
+next_edge(struct GB_state *s, long long deadline, long long *ts)
+{
+	for (;;) {
+		long long t;
+		int e;
+
+		if (!s->eclass.pending) {
+			e = read_edge(s, deadline, &t);
+			if (e != 0 && e != 1) {
+				return e;
+			}
+			s->eclass.pending = true;
+			s->eclass.pend_level = e;
+			s->eclass.pend_ts = t;
+		}
+		if (s->eclass.pend_ts >= deadline) {
+			return -1;
+		}
+		e = read_edge(s, s->eclass.pend_ts + GLITCH, &t);
+		if (e == 2) {
+			return 2;
+		}
+		s->eclass.pending = false;
+		if (e == -1) {
+			*ts = s->eclass.pend_ts;
+			return s->eclass.pend_level;
+		}
+		/* glitch, drop both edges */
+	}
+}
+
+/*
+ * Edge based counterpart of collect_pulses(): measure the current bit from
+ * the kernel timestamps of the edges instead of from samples. The result is
+ * expressed in samples of hw.freq, so that the classification and adaption
+ * in get_bit_live() remain the same.
+ */
+static unsigned
+collect_edges(struct GB_state *s, unsigned start, int *init_bit, bool *adj_freq)
+{
+	long long limit, ts;
+	bool high = true;
+
+	if (start == 0) {
+		s->eclass.start = s->eclass.end;
+		s->live.start_ns = s->eclass.start;
+	}
+	s->bit.t = start;
+
+	/*
+	 * Prevent algorithm collapse during thunderstorms or scheduler abuse
+	 */
+	if (s->bit.realfreq <= s->hw.freq * 500000ULL ||
+	    s->bit.realfreq > s->hw.freq * 1500000ULL) {
+		reset_frequency(s);
+		*adj_freq = false;
+	}
+	/* time out after 1.5 seconds, like collect_pulses() */
+	limit = s->eclass.start +
+	    (long long)(s->bit.realfreq * 1500 / s->hw.freq);
+
+	for (;;) {
+		int e = next_edge(s, limit, &ts);
+
+		if (e == 2) {
+			struct timespec tp;
+
+			s->gb_res.bad_io = true;
+			(void)clock_gettime(CLOCK_MONOTONIC, &tp);
+			s->eclass.end = tp.tv_sec * 1000000000LL + tp.tv_nsec;
+			return s->bit.t;
+		}
+		if (e == -1) {
+			s->bit.t = (unsigned)(s->bit.realfreq * 3 / 2000000);
+			s->eclass.end = limit;
+			if (s->gb_res.hwstat == ehw_ok) {
+				s->gb_res.hwstat = ehw_random;
+			}
+			reset_frequency(s);
+			*adj_freq = false;
+			break; /* timeout */
 		}
-		if (y > 500000000 && stv == 0) {
+		s->bit.t = (unsigned)((ts - s->eclass.start) * s->hw.freq /
+		    1000000000);
+		if (e == 0 && high) {
+			/* end of high part of second */
+			high = false;
+			s->bit.tlow = (int)s->bit.t;
+		} else if (e == 1 && !high) {
 			/* end of low part of second */
+			s->bit.tlast0 = (int)s->bit.t - 1;
+			s->eclass.end = ts;
 			if (*init_bit == 2) {
 				*init_bit = 1;
 			}
 			break; /* start of new second */
 		}
-		long long twait = (long long)(sec2 * bit.realfreq / 1000000);
+	}
+	return s->bit.t;
+}
+#endif
+
+/* Start measuring (the rest of) the current bit at sample start. */
+static void
+start_collect(struct GB_state *s, unsigned start)
+{
+	s->live.start = start;
+	if (!s->eclass.enabled) {
+		start_pulses(s, start);
+	}
+}
+
+/*
+ * Continue measuring the current bit using the configured method, returns
+ * false if more samples are needed, see collect_pulses().
+ */
+static bool
+collect(struct GB_state *s, bool block)
+{
+#if defined(__linux__)
+	if (s->eclass.enabled) {
+		/* the edge classifier always blocks */
+		s->bit.t = collect_edges(s, s->live.start, &s->init_bit,
+		    &s->live.adj_freq);
+		return true;
+	}
+#endif
+	return collect_pulses(s, block, &s->init_bit, &s->live.adj_freq);
+}
+
+/*
+ * Confidence (0..100) in a bit with an active length of q, classified
+ * between the thresholds lo * u and hi * u (lo 0 for none). The confidence
+ * is full at a distance of u, i.e. 50 ms, from the nearest threshold.
+ */
+static unsigned
+confidence(unsigned long long q, unsigned long long u, unsigned lo,
+    unsigned hi)
+{
+	unsigned long long d;
+
+	if (u == 0) {
+		return 0;
+	}
+	d = hi * u - q;
+	if (lo > 0 && q - lo * u < d) {
+		d = q - lo * u;
+	}
+	return d >= u ? 100 : (unsigned)(100 * d / u);
+}
+
+/* Set up the state of get_bit_live() for a new bit. */
+static void
+begin_bit(struct GB_state *s)
+{
+	s->live.outch = '?';
+	s->live.adj_freq = true;
+	s->bit.freq_reset = false;
+	s->bit.bitlen_reset = false;
+
+	set_new_state(s);
+
+	/*
+	 * One period is 1000 ms long. The active part is can be 100 ms ('00'),
+	 * 200 ms ('10'), 300 ms ('11') or 100+100 ms ('01') long. Bit 0 is
+	 * special and 500 ms long to indicate the start of a new minute.
+	 *
+	 * A reception timeout occurs after 2000 ms.
+	 */
+
+	if (s->init_bit == 2) {
+		s->bit.realfreq = s->hw.freq * 1000000ULL;
+		s->bit.bit0 = s->bit.realfreq / 2;
+		s->bit.bit5x = s->bit.realfreq / 10;
+	}
+	s->live.len100ms = s->bit.bit0 / 10 + s->bit.bit5x / 2;
+
+	s->bit.tlow = -1;
+	s->bit.tlast0 = -1;
+
+	start_collect(s, 0);
+	s->live.stage = 1;
+}
+
+/*
+ * Classify the first part of the bit, returns true if the signal is split
+ * and the rest of the second still has to be measured.
+ */
+static bool
+classify_bit(struct GB_state *s)
+{
+	unsigned long long len100ms = s->live.len100ms;
+	unsigned long long q, u;
+	bool split = false;
+
+	/* the value of the bit is unknown unless classified below */
+	s->conf[s->bitpos] = 0;
+	/* active length relative to thresholds of 50 ms */
+	q = 2 * s->bit.tlow * s->bit.realfreq;
+	u = len100ms * s->bit.t;
+	if (!s->gb_res.bad_io && s->gb_res.hwstat == ehw_ok) {
+		 if (2 * s->bit.tlow * s->bit.realfreq <
+		    3 * len100ms * s->bit.t) {
+			/* two zero bits, ~100 ms active signal */
+			s->gb_res.bitval = ebv_00;
+			s->live.outch = '0';
+			set_buffer(s, 0, confidence(q, u, 0, 3));
+		} else if (2 * s->bit.tlow * s->bit.realfreq <
+		    5 * len100ms * s->bit.t) {
+			/* one bit and zero bit, ~200 ms active signal */
+			s->gb_res.bitval = ebv_10;
+			s->live.outch = '1';
+			set_buffer(s, 1, confidence(q, u, 3, 5));
+		} else if (2 * s->bit.tlow * s->bit.realfreq <
+		    7 * len100ms * s->bit.t) {
+			/* mitigate against 2 bits becoming a 30 combination if the radio signal is noisy */
+			if (s->bit.t >= s->bit.realfreq / 2500000) {
+				/* two one bits, ~300 ms active signal */
+				s->gb_res.bitval = ebv_11;
+				s->live.outch = '3';
+				set_buffer(s, 3, confidence(q, u, 5, 7));
+			} else {
+				/* zero bit and one bit, split signal */
+				s->gb_res.bitval = ebv_01;
+				s->live.outch = '2';
+				set_buffer(s, 2, confidence(q, u, 5, 7));
+				split = true;
+			}
+		} else if (s->bit.tlow * s->bit.realfreq <
+		    6 * len100ms * s->bit.t) {
+			if (s->bit.t >= s->bit.realfreq / 2500000) {
+				/* begin-of-minute, ~500 ms active signal */
+				s->gb_res.marker = emark_minute;
+				s->gb_res.bitval = ebv_bom;
+				s->live.outch = '4';
+				s->bitpos = 0;
+				set_buffer(s, 4, confidence(q, u, 7, 12));
+			} else {
+				/* zero bit and one bit, split signal */
+				s->gb_res.bitval = ebv_01;
+				s->live.outch = '2';
+				set_buffer(s, 2, confidence(q, u, 7, 12));
+				split = true;
+			}
+		} else {
+			/* bad radio signal, retain old value */
+			s->gb_res.bitval = ebv_none;
+			s->live.outch = '_';
+			s->live.adj_freq = false;
+		}
+	}
+	/* the edge precedes the first sample */
+	if (s->live.start_ns == -1 || s->gb_res.bad_io ||
+	    s->gb_res.hwstat != ehw_ok || s->gb_res.bitval == ebv_none) {
+		s->second_ns = -1;
+	} else if (s->eclass.enabled) {
+		s->second_ns = s->live.start_ns;
+	} else {
+		s->second_ns = s->live.start_ns - FILTER_DELAY -
+		    1000000000 / s->hw.freq;
+	}
+	if (s->gb_res.marker == emark_minute) {
+		s->minute_ns = s->second_ns;
+	}
+
+	return split;
+}
+
+/* Start counting the resets of a new minute, and log the statistics. */
+static void
+next_stats_minute(struct GB_state *s)
+{
+	struct sample_stats st;
+	char buf[1024];
+	int len;
+	unsigned i;
+
+	__atomic_store_n(&s->stats.cur.prev_freq_resets,
+	    s->stats.cur.freq_resets, __ATOMIC_RELAXED);
+	__atomic_store_n(&s->stats.cur.prev_bitlen_resets,
+	    s->stats.cur.bitlen_resets, __ATOMIC_RELAXED);
+	__atomic_store_n(&s->stats.cur.freq_resets, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&s->stats.cur.bitlen_resets, 0, __ATOMIC_RELAXED);
+	if (!s->stats.logging) {
+		return;
+	}
+	/* the writer thread of the statslog does the I/O */
+	st = get_sample_stats_r(s);
+	len = snprintf(buf, sizeof(buf), "%lld latency", (long long)time(NULL));
+	for (i = 0; i < SS_BUCKETS; i++) {
+		len += snprintf(buf + len, sizeof(buf) - (size_t)len, "%c%llu",
+		    i == 0 ? '=' : ',', st.latency[i]);
+	}
+	len += snprintf(buf + len, sizeof(buf) - (size_t)len,
+	    " overruns=%llu skipped=%llu lost=%llu read_avg=%llu read_max=%llu "
+	    "freq_resets=%u bitlen_resets=%u\n",
+	    st.overruns, st.skipped, st.lost,
+	    st.reads > 0 ? st.read_ns / st.reads : 0, st.read_max_ns,
+	    st.prev_freq_resets, st.prev_bitlen_resets);
+	logwriter_append(&s->stats.lw, buf, (size_t)len);
+	logwriter_minute(&s->stats.lw);
+}
+
+/*
+ * Switch to another sample rate between two bits. Everything measured in
+ * samples is rescaled, the filter constant follows from hw.freq at the
+ * start of the next bit.
+ */
+static void
+set_rate(struct GB_state *s, unsigned freq)
+{
+	unsigned old = s->hw.freq;
+
+	s->bit.realfreq = s->bit.realfreq * freq / old;
+	s->bit.bit0 = s->bit.bit0 * freq / old;
+	s->bit.bit5x = s->bit.bit5x * freq / old;
+	s->hw.freq = freq;
+	s->sample_time.rem = 0;
+	s->rate.clean = 0;
+	clear_recorder(s);
+}
+
+/*
+ * Halve the sample rate after RATE_CLEAN clean bits with a stable sample
+ * rate, i.e. the length of each was within 2% of realfreq, and double it
+ * after any bad bit or reset. The rates stay an exact fraction of the
+ * maximum rate, so that a pulse source can be decimated.
+ */
+static void
+adapt_rate(struct GB_state *s)
+{
+	long long dev = (long long)s->bit.t * 1000000 -
+	    (long long)s->bit.realfreq;
+	bool bad;
+
+	bad = s->gb_res.bad_io || s->gb_res.hwstat != ehw_ok ||
+	    s->gb_res.bitval == ebv_none || s->bit.freq_reset ||
+	    s->bit.bitlen_reset || s->gb_res.marker == emark_toolong ||
+	    s->gb_res.marker == emark_late;
+	if (bad) {
+		if (s->hw.freq < s->rate.max) {
+			set_rate(s, 2 * s->hw.freq);
+		}
+		s->rate.clean = 0;
+		return;
+	}
+	if (50 * (dev < 0 ? -dev : dev) > (long long)s->bit.realfreq) {
+		s->rate.clean = 0;
+	} else if (++s->rate.clean >= RATE_CLEAN && s->hw.freq % 4 == 0 &&
+	    s->hw.freq / 2 >= s->rate.min) {
+		set_rate(s, s->hw.freq / 2);
+	}
+}
+
+/* Adapt to the length of the bit and write it to the log file. */
+static void
+finish_bit(struct GB_state *s)
+{
+	char outch = s->live.outch;
+
+	if (!s->gb_res.bad_io) {
+		if (s->init_bit == 1) {
+			s->init_bit--;
+		} else if (s->gb_res.hwstat == ehw_ok &&
+		    (s->gb_res.marker == emark_none ||
+		     s->gb_res.marker == emark_minute)) {
+			long long avg;
+
+			if (/*bitpos == 0 && */s->gb_res.bitval == ebv_bom) {
+				s->bit.bit0 +=
+				    (((long long)s->bit.tlow * 1000000 -
+				    (long long)s->bit.bit0) / 2);
+			}
+			if ((s->bitpos == 52 || s->bitpos == 59) &&
+			    s->gb_res.bitval == ebv_00) {
+				s->bit.bit5x +=
+				    (((long long)s->bit.tlow * 1000000 -
+				    (long long)s->bit.bit5x) / 2);
+			}
+			/* Force sane values during e.g. a thunderstorm */
+			avg = (s->bit.bit0 - s->bit.bit5x) / 2;
+			if (4 * s->bit.bit0 < s->bit.bit5x * 15 ||
+			    2 * s->bit.bit0 > s->bit.bit5x * 15) {
+				reset_bitlen(s);
+				s->live.adj_freq = false;
+			}
+			if (s->bit.bit0 + avg < s->bit.realfreq / 2 ||
+			    s->bit.bit0 - avg > s->bit.realfreq / 2) {
+				reset_bitlen(s);
+				s->live.adj_freq = false;
+			}
+			if (s->bit.bit5x + avg < s->bit.realfreq / 10) {
+				reset_bitlen(s);
+				s->live.adj_freq = false;
+			}
+		}
+	}
+	if (s->sleep.resumed) {
+		/* the bit started at an arbitrary sample */
+		s->live.adj_freq = false;
+		s->sleep.resumed = false;
+	}
+	if (s->live.adj_freq) {
+		s->bit.realfreq +=
+		    (((long long)s->bit.t * 1000000 -
+		    (long long)s->bit.realfreq) / 20);
+	}
+	s->acc_minlen += (unsigned)(1000000ULL * s->bit.t /
+	    (s->bit.realfreq / 1000));
+	if (s->gb_res.bad_io) {
+		outch = '*';
+	} else if (s->gb_res.hwstat == ehw_receive) {
+		outch = 'r';
+	} else if (s->gb_res.hwstat == ehw_transmit) {
+		outch = 'x';
+	} else if (s->gb_res.hwstat == ehw_random) {
+		outch = '#';
+	}
+	write_log(s, outch);
+	if (s->gb_res.marker == emark_minute ||
+	    s->gb_res.marker == emark_late) {
+		write_log(s, 'a');
+		write_log(s, '\n');
+		next_stats_minute(s);
+	}
+	if (s->gb_res.marker == emark_minute ||
+	    s->gb_res.marker == emark_late) {
+		s->cutoff = (int)((unsigned long long)s->bit.t * 1000000 /
+		    (s->bit.realfreq / 10000));
+	}
+	if (s->rate.min < s->rate.max) {
+		adapt_rate(s);
+	}
+	if (s->replay_end) {
+		s->gb_res.done = true;
+	}
+}
+
+#if defined(__linux__)
+/*
+ * Apply the edge events queued by the GPIO character device while asleep.
+ * Edges lost when the kernel buffer overflowed are not reported, the level
+ * of a pin is right again after its next edge.
+ */
+static void
+flush_edges(struct GB_state *s)
+{
+	struct pollfd pfd;
+	ssize_t count;
+	unsigned i;
+
+	pfd.fd = s->fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	while (poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN) != 0) {
+		count = read(s->fd, s->edges.ev, sizeof(s->edges.ev));
+		if (count < (ssize_t)sizeof(s->edges.ev[0])) {
+			break;
+		}
+		s->edges.count = (unsigned)count / sizeof(s->edges.ev[0]);
+		for (i = 0; i < s->edges.count; i++) {
+			apply_edge(s, &s->edges.ev[i]);
+		}
+		s->edges.seqno = s->edges.ev[s->edges.count - 1].seqno;
+	}
+	s->edges.head = s->edges.count = 0;
+	s->edges.known_ns = s->sample_time.ns;
+}
+#endif
+
+/*
+ * Resume sampling after sleep_live(). Without blocking, return false if
+ * the time to wake up has not come yet. Sampling restarts from the current
+ * time, the samples of a pulse source up to then are skipped.
+ */
+static bool
+wake_up(struct GB_state *s, bool block)
+{
+	long long now;
+
+	if (s->replay) {
+		while ((now = s->src.start_ns + (long long)(s->nsamples *
+		    1000000000ULL / s->src.freq)) < s->sleep.wake_ns) {
+			if (s->src.next(s->src.arg) == -1) {
+				s->replay_end = true;
+				break;
+			}
+			s->nsamples++;
+		}
+	} else {
+		now = now_ns();
+		if (now < s->sleep.wake_ns) {
 #if !defined(MACOS)
-		(void)clock_gettime(CLOCK_MONOTONIC, &tp1);
-		twait = twait - (tp1.tv_sec - tp0.tv_sec) *
-		    1000000000 - (tp1.tv_nsec - tp0.tv_nsec);
+			struct timespec tp;
+
+			if (!block) {
+				return false;
+			}
+			tp.tv_sec = s->sleep.wake_ns / 1000000000;
+			tp.tv_nsec = s->sleep.wake_ns % 1000000000;
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+			    &tp, NULL) == EINTR)
+				; /* empty loop */
+#else
+			struct timespec slp;
+
+			if (!block) {
+				return false;
+			}
+			slp.tv_sec = (s->sleep.wake_ns - now) / 1000000000;
+			slp.tv_nsec = (s->sleep.wake_ns - now) % 1000000000;
+			while (nanosleep(&slp, &slp) > 0)
+				; /* empty loop */
 #endif
-		slp.tv_sec = twait / 1000000000;
-		slp.tv_nsec = twait % 1000000000;
-		while (twait > 0 && nanosleep(&slp, &slp) > 0)
-			; /* empty loop */
+			now = now_ns();
+		}
+		s->sample_time.ns = now;
+		s->sample_time.rem = 0;
+#if defined(__linux__)
+		if (s->hw.iomode == eio_cdev) {
+			flush_edges(s);
+		}
+#endif
+		if (s->acq.enabled && start_acquisition(s) != 0) {
+			fprintf(stderr, "Cannot restart the acquisition "
+			    "thread, sampling directly\n");
+		}
+	}
+	s->acc_minlen += (unsigned)((now - s->sleep.from_ns) / 1000000);
+	s->sleep.wake_ns = -1;
+	s->sleep.resumed = true;
+	s->init_bit = 1;
+	clear_recorder(s);
+	return true;
+}
+
+/*
+ * The bits are decoded from the signal using an exponential low-pass filter
+ * in conjunction with a Schmitt trigger. The idea and the initial
+ * implementation for this come from Udo Klein, with permission.
+ * http://blog.blinkenlight.net/experiments/dcf77/binary-clock/#comment-5916
+ *
+ * The samples of a bit are processed as they become available, so that
+ * poll_bit_live() can return in between and continue with the next call.
+ */
+static bool
+live_bit(struct GB_state *s, bool block)
+{
+	if (s->live.stage == 0) {
+		if (s->sleep.wake_ns != -1 && !wake_up(s, block)) {
+			return false;
+		}
+		begin_bit(s);
 	}
-	if (bit.t >= hw.freq) {
-		/* this can actually happen */
-		if (gb_res.hwstat == ehw_ok) {
-			gb_res.hwstat = ehw_random;
-			outch = '#';
+	if (!collect(s, block)) {
+		return false;
+	}
+	if (s->live.stage == 1 && classify_bit(s)) {
+		/* read the rest of the second */
+		s->live.stage = 2;
+		start_collect(s, s->bit.t);
+		if (!collect(s, block)) {
+			return false;
 		}
-		reset_frequency();
-		*adj_freq = false;
 	}
-	return bit.t;
+	finish_bit(s);
+	s->live.stage = 0;
+	return true;
+}
+
+struct GB_result
+get_bit_live_r(struct GB_state *s)
+{
+	(void)live_bit(s, true);
+	return s->gb_res;
 }
 
-/*
- * The bits are decoded from the signal using an exponential low-pass filter
- * in conjunction with a Schmitt trigger. The idea and the initial
- * implementation for this come from Udo Klein, with permission.
- * http://blog.blinkenlight.net/experiments/dcf77/binary-clock/#comment-5916
- */
 struct GB_result
 get_bit_live(void)
 {
-	char outch = '?';
-	bool adj_freq = true;
-	static int init_bit = 2;
-	unsigned long long len100ms;
-
-	bit.freq_reset = false;
-	bit.bitlen_reset = false;
+	return get_bit_live_r(&gb_default);
+}
 
-	set_new_state();
+bool
+poll_bit_live_r(struct GB_state *s, struct GB_result *bit)
+{
+	if (!live_bit(s, false)) {
+		return false;
+	}
+	*bit = s->gb_res;
+	return true;
+}
 
-	/*
-	 * One period is 1000 ms long. The active part is can be 100 ms ('00'),
-	 * 200 ms ('10'), 300 ms ('11') or 100+100 ms ('01') long. Bit 0 is
-	 * special and 500 ms long to indicate the start of a new minute.
-	 *
-	 * A reception timeout occurs after 2000 ms.
-	 */
+bool
+poll_bit_live(struct GB_result *bit)
+{
+	return poll_bit_live_r(&gb_default, bit);
+}
 
-	if (init_bit == 2) {
-		bit.realfreq = hw.freq * 1000000;
-		bit.bit0 = bit.realfreq / 2;
-		bit.bit5x = bit.realfreq / 10;
+int
+get_live_fd_r(struct GB_state *s)
+{
+	if (s->hw.iomode != eio_cdev || s->replay || s->acq.running ||
+	    s->eclass.enabled || s->sleep.wake_ns != -1) {
+		return -1;
 	}
-	len100ms = bit.bit0 / 10 + bit.bit5x / 2;
+	return s->fd;
+}
 
-	bit.tlow = -1;
-	bit.tlast0 = -1;
+int
+get_live_fd(void)
+{
+	return get_live_fd_r(&gb_default);
+}
 
-	bit.t = collect_pulses(0, &init_bit, &adj_freq);
-	if (!gb_res.bad_io && gb_res.hwstat == ehw_ok) {
-		 if (2 * bit.tlow * bit.realfreq < 3 * len100ms * bit.t) {
-			/* two zero bits, ~100 ms active signal */
-			gb_res.bitval = ebv_00;
-			outch = '0';
-			buffer[bitpos] = 0;
-		} else if (2 * bit.tlow * bit.realfreq < 5 * len100ms * bit.t) {
-			/* one bit and zero bit, ~200 ms active signal */
-			gb_res.bitval = ebv_10;
-			outch = '1';
-			buffer[bitpos] = 1;
-		} else if (2 * bit.tlow * bit.realfreq < 7 * len100ms * bit.t) {
-			/* mitigate against 2 bits becoming a 30 combination if the radio signal is noisy */
-			if (bit.t >= bit.realfreq / 2500000) {
-				/* two one bits, ~300 ms active signal */
-				gb_res.bitval = ebv_11;
-				outch = '3';
-				buffer[bitpos] = 3;
-			} else {
-				/* zero bit and one bit, split signal */
-				gb_res.bitval = ebv_01;
-				outch = '2';
-				buffer[bitpos] = 2;
-				/* read the rest of the second */
-				bit.t = collect_pulses(bit.t, &init_bit, &adj_freq);
-			}
-		} else if (bit.tlow * bit.realfreq < 6 * len100ms * bit.t) {
-			if (bit.t >= bit.realfreq / 2500000) {
-				/* begin-of-minute, ~500 ms active signal */
-				gb_res.marker = emark_minute;
-				gb_res.bitval = ebv_bom;
-				outch = '4';
-				bitpos = 0;
-				buffer[bitpos] = 4;
-			} else {
-				/* zero bit and one bit, split signal */
-				gb_res.bitval = ebv_01;
-				outch = '2';
-				buffer[bitpos] = 2;
-				/* read the rest of the second */
-				bit.t = collect_pulses(bit.t, &init_bit, &adj_freq);
-			}
-		} else {
-			/* bad radio signal, retain old value */
-			gb_res.bitval = ebv_none;
-			outch = '_';
-			adj_freq = false;
-		}
+int
+get_live_timeout_r(struct GB_state *s)
+{
+	long long wait;
+
+	if (s->replay || s->eclass.enabled) {
+		return 0;
 	}
+	if (s->sleep.wake_ns != -1) {
+		wait = s->sleep.wake_ns - now_ns();
+		return wait <= 0 ? 0 : (int)((wait + 999999) / 1000000);
+	}
+	if (s->acq.running) {
+		/* poll_bit_live() emptied the ring */
+		return RING_WAIT / 1000000;
+	}
+	wait = sample_wait(s);
+	if (wait <= 0) {
+		return 0;
+	}
+	if (s->hw.iomode == eio_cdev) {
+		/* edges are reported through the file descriptor */
+		wait += EDGE_WAIT;
+	}
+	return (int)((wait + 999999) / 1000000);
+}
 
-	if (!gb_res.bad_io) {
-		if (init_bit == 1) {
-			init_bit--;
-		} else if (gb_res.hwstat == ehw_ok &&
-		    (gb_res.marker == emark_none ||
-		     gb_res.marker == emark_minute)) {
-			long long avg;
+int
+get_live_timeout(void)
+{
+	return get_live_timeout_r(&gb_default);
+}
 
-			if (/*bitpos == 0 && */gb_res.bitval == ebv_bom) {
-				bit.bit0 +=
-				    ((long long)(bit.tlow * 1000000 -
-				    bit.bit0) / 2);
-			}
-			if ((bitpos == 52 || bitpos == 59) &&
-			    gb_res.bitval == ebv_00) {
-				bit.bit5x +=
-				    ((long long)(bit.tlow * 1000000 -
-				    bit.bit5x) / 2);
-			}
-			/* Force sane values during e.g. a thunderstorm */
-			avg = (bit.bit0 - bit.bit5x) / 2;
-			if (4 * bit.bit0 < bit.bit5x * 15 ||
-			    2 * bit.bit0 > bit.bit5x * 15) {
-				reset_bitlen();
-				adj_freq = false;
-			}
-			if (bit.bit0 + avg < bit.realfreq / 2 ||
-			    bit.bit0 - avg > bit.realfreq / 2) {
-				reset_bitlen();
-				adj_freq = false;
-			}
-			if (bit.bit5x + avg < bit.realfreq / 10) {
-				reset_bitlen();
-				adj_freq = false;
-			}
-		}
-	}
-	if (adj_freq) {
-		bit.realfreq +=
-		    ((long long)(bit.t * 1000000 - bit.realfreq) / 20);
+int
+sleep_live_r(struct GB_state *s, long long wake_ns)
+{
+	if (s->filemode != 1 || s->eclass.enabled ||
+	    (s->cap.f != NULL && !s->replay)) {
+		return EINVAL;
 	}
-	acc_minlen += 1000000 * bit.t / (bit.realfreq / 1000);
-	if (logfile != NULL) {
-		fprintf(logfile, "%c", outch);
-		if (gb_res.marker == emark_minute ||
-		    gb_res.marker == emark_late) {
-			fprintf(logfile, "a%u\n", acc_minlen);
-		}
+	s->sleep.from_ns = pulse_time(s) + 1000000000 / s->hw.freq;
+	stop_acquisition(s);
+	s->sleep.wake_ns = wake_ns;
+	s->live.stage = 0;
+	return 0;
+}
+
+int
+sleep_live(long long wake_ns)
+{
+	return sleep_live_r(&gb_default, wake_ns);
+}
+
+long long
+get_wake_time_r(struct GB_state *s)
+{
+	return s->sleep.wake_ns;
+}
+
+long long
+get_wake_time(void)
+{
+	return get_wake_time_r(&gb_default);
+}
+
+/* Read the next character of the log file, EOF at the end */
+static int
+file_getc(struct GB_state *s)
+{
+	if (s->infile.pos >= s->infile.len) {
+		s->infile.eof = true;
+		return EOF;
 	}
-	if (gb_res.marker == emark_minute || gb_res.marker == emark_late) {
-		cutoff = bit.t * 1000000 / (bit.realfreq / 10000);
+	return s->infile.buf[s->infile.pos++];
+}
+
+/* Push back the character just read by file_getc() */
+static void
+file_ungetc(struct GB_state *s, int inch)
+{
+	if (inch != EOF && s->infile.pos > 0) {
+		s->infile.pos--;
+		s->infile.eof = false;
 	}
-	return gb_res;
 }
 
 /* Skip over invalid characters */
 static int
-skip_invalid(void)
+skip_invalid(struct GB_state *s)
 {
 	int inch = EOF;
 
 	do {
-		int oldinch = inch;
-		if (feof(logfile)) {
+		if (s->infile.eof) {
 			break;
 		}
-		inch = getc(logfile);
+		inch = file_getc(s);
 		/*
 		 * \r\n is implicitly converted because \r is invalid character
 		 * \n\r is implicitly converted because \n is found first
 		 * \n is OK
-		 * convert \r to \n
+		 * convert \r to \n, without consuming the next character so
+		 * that rereading the \r after file_ungetc(s) gives \n again
 		 */
-		if (oldinch == '\r' && inch != '\n') {
-			ungetc(inch, logfile);
-			inch = '\n';
+		if (inch == '\r') {
+			if (s->infile.pos >= s->infile.len) {
+				s->infile.eof = true;
+				inch = '\n';
+			} else if (s->infile.buf[s->infile.pos] != '\n') {
+				inch = '\n';
+			}
 		}
-	} while (strchr("012345\nxr#*_a", inch) == NULL);
+	} while (inch == EOF || !valid_char[inch]);
 	return inch;
 }
 
+/*
+ * Parse an unsigned number like fscanf("%10u") does: skip white space, then
+ * read an optional sign and up to 10 characters in total.
+ */
+static bool
+read_acc(struct GB_state *s, unsigned *val)
+{
+	unsigned long long v = 0;
+	bool neg = false;
+	int inch, width = 10, digits = 0;
+
+	do {
+		inch = file_getc(s);
+	} while (inch == ' ' || (inch >= '\t' && inch <= '\r'));
+	if (inch == '+' || inch == '-') {
+		neg = inch == '-';
+		width--;
+		inch = file_getc(s);
+	}
+	while (width > 0 && inch >= '0' && inch <= '9') {
+		v = v * 10 + (unsigned)(inch - '0');
+		digits++;
+		if (--width > 0) {
+			inch = file_getc(s);
+		} else {
+			inch = EOF;
+		}
+	}
+	file_ungetc(s, inch);
+	if (digits == 0) {
+		return false;
+	}
+	*val = (unsigned)(neg ? -v : v);
+	return true;
+}
+
 struct GB_result
-get_bit_file(void)
+get_bit_file_r(struct GB_state *s)
 {
-	static int oldinch;
-	static bool read_acc_minlen;
 	int inch;
 
-	set_new_state();
+	set_new_state(s);
 
-	inch = skip_invalid();
+	inch = skip_invalid(s);
 	/*
 	 * bit.t is set to fake value for compatibility with old log files not
 	 * storing acc_minlen values or to increase time when mainloop() splits
@@ -611,83 +2864,175 @@ get_bit_file(void)
 
 	switch (inch) {
 	case EOF:
-		gb_res.done = true;
-		return gb_res;
+		s->gb_res.done = true;
+		return s->gb_res;
 	case '0':
 	case '1':
 	case '2':
 	case '3':
 	case '4':
-		buffer[bitpos] = inch - (int)'0';
-		gb_res.bitval = (inch == (int)'0') ? ebv_00 : 
+		if (inch == '4') {
+			/* the minute marker is bit 0, as in get_bit_live() */
+			s->bitpos = 0;
+		}
+		set_buffer(s, inch - (int)'0', 100);
+		s->gb_res.bitval = (inch == (int)'0') ? ebv_00 : 
 				(inch == (int)'1') ? ebv_10 :
 				(inch == (int)'2') ? ebv_01 :
 				(inch == (int)'3') ? ebv_11 :
 				(inch == (int)'4') ? ebv_bom : ebv_none;
-		bit.t = 1000;
+		s->bit.t = 1000;
 		if (inch == '4') {
-			if (gb_res.marker == emark_none) {
-				gb_res.marker = emark_minute;
-			} else if (gb_res.marker == emark_toolong) {
-				gb_res.marker = emark_late;
+			if (s->gb_res.marker == emark_none) {
+				s->gb_res.marker = emark_minute;
+			} else if (s->gb_res.marker == emark_toolong) {
+				s->gb_res.marker = emark_late;
 			}
 		}
 		break;
 	case 'x':
-		gb_res.hwstat = ehw_transmit;
-		bit.t = 1500;
+		s->gb_res.hwstat = ehw_transmit;
+		s->conf[s->bitpos] = 0;
+		s->bit.t = 1500;
 		break;
 	case 'r':
-		gb_res.hwstat = ehw_receive;
-		bit.t = 1500;
+		s->gb_res.hwstat = ehw_receive;
+		s->conf[s->bitpos] = 0;
+		s->bit.t = 1500;
 		break;
 	case '#':
-		gb_res.hwstat = ehw_random;
-		bit.t = 1500;
+		s->gb_res.hwstat = ehw_random;
+		s->conf[s->bitpos] = 0;
+		s->bit.t = 1500;
 		break;
 	case '*':
-		gb_res.bad_io = true;
-		bit.t = 0;
+		s->gb_res.bad_io = true;
+		s->conf[s->bitpos] = 0;
+		s->bit.t = 0;
 		break;
 	case '_':
-		/* retain old value in buffer[bitpos] */
-		gb_res.bitval = ebv_none;
-		bit.t = 1000;
+		/* retain old value in buffer[bitpos], but without confidence */
+		s->gb_res.bitval = ebv_none;
+		s->conf[s->bitpos] = 0;
+		s->bit.t = 1000;
 		break;
 	case 'a':
 		/* acc_minlen, up to 2^32-1 ms */
-		gb_res.skip = true;
-		bit.t = 0;
-		if (fscanf(logfile, "%10u", &acc_minlen) != 1) {
-			gb_res.done = true;
+		s->gb_res.skip = true;
+		s->bit.t = 0;
+		if (!read_acc(s, &s->acc_minlen)) {
+			s->gb_res.done = true;
 		}
-		read_acc_minlen = !gb_res.done;
+		s->read_acc_minlen = !s->gb_res.done;
+		break;
+	case '\n':
+		s->gb_res.newline = true;
 		break;
 	default:
 		break;
 	}
 
-	if (!read_acc_minlen) {
-		acc_minlen += bit.t;
+	if (!s->read_acc_minlen) {
+		s->acc_minlen += s->bit.t;
 	}
 
 	/*
 	 * Read-ahead 1 character to check if a minute marker is coming. This
 	 * prevents emark_toolong or emark_late being set 1 bit early.
 	 */
-	oldinch = inch;
-	inch = skip_invalid();
-	if (!feof(logfile)) {
-		if (dec_bp == 0 && bitpos > 0 && oldinch != '\n' &&
+	s->oldinch = inch;
+	inch = skip_invalid(s);
+	if (!s->infile.eof) {
+		if (s->dec_bp == 0 && s->bitpos > 0 && s->oldinch != '\n' &&
 		    (inch == '\n' || inch == 'a')) {
-			dec_bp = 1;
+			s->dec_bp = 1;
 		}
 	} else {
-		gb_res.done = true;
+		s->gb_res.done = true;
+	}
+	file_ungetc(s, inch);
+
+	return s->gb_res;
+}
+
+struct GB_result
+get_bit_file(void)
+{
+	return get_bit_file_r(&gb_default);
+}
+
+int
+get_log_symbol_r(struct GB_state *s, unsigned *acc)
+{
+	static const char newlog[] = "--new log--\n\n";
+	int inch;
+
+	inch = skip_invalid(s);
+	if (inch == '\n' && s->infile.buf[s->infile.pos - 1] == '\n' &&
+	    s->infile.len - s->infile.pos >= sizeof(newlog) - 1 &&
+	    memcmp(s->infile.buf + s->infile.pos, newlog,
+	    sizeof(newlog) - 1) == 0) {
+		s->infile.pos += sizeof(newlog) - 1;
+		return BINLOG_NEWLOG;
+	}
+	if (inch == 'a') {
+		return read_acc(s, acc) ? 'a' : BINLOG_END;
+	}
+	return inch;
+}
+
+int
+get_log_symbol(unsigned *acc)
+{
+	return get_log_symbol_r(&gb_default, acc);
+}
+
+int
+seek_minute_r(struct GB_state *s, unsigned minute)
+{
+	unsigned val;
+	int res;
+
+	if (s->filemode != 2) {
+		return EINVAL;
+	}
+	if (binlog_detect(s->infile.map, s->infile.maplen)) {
+		return start_minute(s, minute);
+	}
+	res = start_minute(s, 0);
+	while (res == 0 && minute > 0) {
+		switch (get_log_symbol_r(s, &val)) {
+		case '\n':
+		case BINLOG_NEWLOG:
+			minute--;
+			break;
+		case EOF:
+		case BINLOG_END:
+			res = EINVAL;
+			break;
+		default:
+			break;
+		}
 	}
-	ungetc(inch, logfile);
+	return res;
+}
+
+int
+seek_minute(unsigned minute)
+{
+	return seek_minute_r(&gb_default, minute);
+}
+
+size_t
+get_file_pos_r(struct GB_state *s)
+{
+	return s->infile.pos;
+}
 
-	return gb_res;
+size_t
+get_file_pos(void)
+{
+	return get_file_pos_r(&gb_default);
 }
 
 bool
@@ -699,106 +3044,336 @@ is_space_bit(int bitpos)
 }
 
 struct GB_result
-next_bit(void)
+next_bit_r(struct GB_state *s)
 {
-	if (dec_bp == 1) {
-		bitpos--;
-		dec_bp = 2;
+	if (s->dec_bp == 1) {
+		s->bitpos--;
+		s->dec_bp = 2;
 	}
-	if (gb_res.marker == emark_minute || gb_res.marker == emark_late) {
-		bitpos = 1;
-		dec_bp = 0;
-	} else if (!gb_res.skip) {
-		bitpos++;
+	if (s->gb_res.marker == emark_minute ||
+	    s->gb_res.marker == emark_late) {
+		s->bitpos = 1;
+		s->dec_bp = 0;
+	} else if (!s->gb_res.skip) {
+		s->bitpos++;
 	}
-	if (bitpos == BUFLEN) {
-		gb_res.marker = emark_toolong;
-		bitpos = 0;
-		return gb_res;
+	if (s->bitpos == BUFLEN) {
+		s->gb_res.marker = emark_toolong;
+		s->bitpos = 0;
+		return s->gb_res;
 	}
-	if (gb_res.marker == emark_toolong) {
-		gb_res.marker = emark_none; /* fits again */
+	if (s->gb_res.marker == emark_toolong) {
+		s->gb_res.marker = emark_none; /* fits again */
 	}
-	else if (gb_res.marker == emark_late) {
-		gb_res.marker = emark_minute; /* cannot happen? */
+	else if (s->gb_res.marker == emark_late) {
+		s->gb_res.marker = emark_minute; /* cannot happen? */
 	}
-	return gb_res;
+	return s->gb_res;
+}
+
+struct GB_result
+next_bit(void)
+{
+	return next_bit_r(&gb_default);
+}
+
+int
+get_bitpos_r(struct GB_state *s)
+{
+	return s->bitpos;
 }
 
 int
 get_bitpos(void)
 {
-	return bitpos;
+	return get_bitpos_r(&gb_default);
+}
+
+const int * const
+get_buffer_r(struct GB_state *s)
+{
+	return s->buffer;
 }
 
 const int * const
 get_buffer(void)
 {
-	return buffer;
+	return get_buffer_r(&gb_default);
+}
+
+const uint64_t *
+get_bits_r(struct GB_state *s)
+{
+	return s->bits;
+}
+
+const uint64_t *
+get_bits(void)
+{
+	return get_bits_r(&gb_default);
+}
+
+const unsigned char *
+get_confidence_r(struct GB_state *s)
+{
+	return s->conf;
+}
+
+const unsigned char *
+get_confidence(void)
+{
+	return get_confidence_r(&gb_default);
+}
+
+long long
+get_second_start_r(struct GB_state *s)
+{
+	return s->second_ns;
+}
+
+long long
+get_second_start(void)
+{
+	return get_second_start_r(&gb_default);
+}
+
+long long
+get_minute_start_r(struct GB_state *s)
+{
+	return s->minute_ns;
+}
+
+long long
+get_minute_start(void)
+{
+	return get_minute_start_r(&gb_default);
+}
+
+struct hardware
+get_hardware_parameters_r(struct GB_state *s)
+{
+	return s->hw;
 }
 
 struct hardware
 get_hardware_parameters(void)
 {
-	return hw;
+	return get_hardware_parameters_r(&gb_default);
 }
 
-void
-*flush_logfile(/*@unused@*/ void *arg)
+/* Pass the bytes of a binary log symbol to the log writer. */
+static void
+log_sink(void *arg, const unsigned char *buf, size_t len)
+{
+	logwriter_append(arg, buf, len);
+}
+
+int
+set_log_policy_r(struct GB_state *s, struct json_object *config)
 {
-	for (;;)
-	{
-		fflush(logfile);
-		sleep(60);
+	struct json_object *value;
+
+	if (json_object_object_get_ex(config, "logflush", &value)) {
+		const char *policy = json_object_get_string(value);
+
+		if (strcmp(policy, "none") == 0) {
+			s->log_policy = elw_none;
+		} else if (strcmp(policy, "minute") == 0) {
+			s->log_policy = elw_minute;
+		} else if (strcmp(policy, "fsync") == 0) {
+			s->log_policy = elw_fsync;
+		} else {
+			fprintf(stderr, "Unknown logflush '%s'\n", policy);
+			return EX_DATAERR;
+		}
 	}
+	if (json_object_object_get_ex(config, "logsync", &value)) {
+		s->log_interval = (unsigned)json_object_get_int(value);
+	}
+	return 0;
 }
 
 int
-append_logfile(const char * const logfilename)
+set_log_policy(struct json_object *config)
+{
+	return set_log_policy_r(&gb_default, config);
+}
+
+/* Check if the log file should be written in the binary format. */
+static bool
+is_binary_log(const char * const logfilename)
+{
+	unsigned char hdr[8];
+	size_t len, namelen;
+	FILE *f;
+
+	f = fopen(logfilename, "rb");
+	if (f != NULL) {
+		len = fread(hdr, 1, sizeof(hdr), f);
+		(void)fclose(f);
+		if (len > 0) {
+			return binlog_detect(hdr, len);
+		}
+	}
+	namelen = strlen(logfilename);
+	return namelen >= 5 &&
+	    strcmp(logfilename + namelen - 5, ".nplb") == 0;
+}
+
+int
+append_logfile_r(struct GB_state *s, const char * const logfilename)
 {
-	pthread_t flush_thread;
+	int res;
 
 	if (logfilename == NULL) {
 		fprintf(stderr, "logfilename is NULL\n");
 		return -1;
 	}
-	logfile = fopen(logfilename, "a");
-	if (logfile == NULL) {
-		return errno;
+	s->binary_log = is_binary_log(logfilename);
+	if (s->binary_log) {
+		res = binlog_open(&s->blog, logfilename);
+		if (res != 0) {
+			return res;
+		}
+		s->logfd = fileno(s->blog.f);
+		s->blog.sink = log_sink;
+		s->blog.arg = &s->lw;
+	} else {
+		s->logfd = open(logfilename, O_WRONLY | O_APPEND | O_CREAT,
+		    0666);
+		if (s->logfd == -1) {
+			return errno;
+		}
+	}
+	res = logwriter_start(&s->lw, s->logfd, s->log_policy, s->log_interval);
+	if (res != 0) {
+		if (s->binary_log) {
+			s->blog.sink = NULL;
+			(void)binlog_close(&s->blog);
+		} else {
+			(void)close(s->logfd);
+		}
+		return res;
+	}
+	s->logging = true;
+	write_log(s, BINLOG_NEWLOG);
+	return 0;
+}
+
+int
+append_logfile(const char * const logfilename)
+{
+	return append_logfile_r(&gb_default, logfilename);
+}
+
+int
+close_logfile_r(struct GB_state *s)
+{
+	int res, res2;
+
+	if (!s->logging) {
+		return 0;
+	}
+	/* no more writes after this, so the writer can finish cleanly */
+	s->logging = false;
+	res = logwriter_stop(&s->lw);
+	if (s->binary_log) {
+		s->blog.sink = NULL;
+		res2 = binlog_close(&s->blog);
+	} else {
+		res2 = (close(s->logfd) == -1) ? errno : 0;
 	}
-	fprintf(logfile, "\n--new log--\n\n");
-	return pthread_create(&flush_thread, NULL, flush_logfile, NULL);
+	return (res != 0) ? res : res2;
 }
 
 int
 close_logfile(void)
 {
-	int f;
+	return close_logfile_r(&gb_default);
+}
 
-	f = fclose(logfile);
-	return (f == EOF) ? errno : 0;
+struct bitinfo
+get_bitinfo_r(struct GB_state *s)
+{
+	return s->bit;
 }
 
 struct bitinfo
 get_bitinfo(void)
 {
-	return bit;
+	return get_bitinfo_r(&gb_default);
+}
+
+struct sample_stats
+get_sample_stats_r(struct GB_state *s)
+{
+	struct sample_stats st;
+	unsigned i;
+
+	memset(&st, 0, sizeof(st));
+	/* the resets are written by the decoding thread */
+	st.freq_resets = __atomic_load_n(&s->stats.cur.freq_resets,
+	    __ATOMIC_RELAXED);
+	st.bitlen_resets = __atomic_load_n(&s->stats.cur.bitlen_resets,
+	    __ATOMIC_RELAXED);
+	st.prev_freq_resets = __atomic_load_n(&s->stats.cur.prev_freq_resets,
+	    __ATOMIC_RELAXED);
+	st.prev_bitlen_resets = __atomic_load_n(
+	    &s->stats.cur.prev_bitlen_resets, __ATOMIC_RELAXED);
+	/* the fields below are written by the acquisition thread */
+	for (i = 0; i < SS_BUCKETS; i++) {
+		st.latency[i] = __atomic_load_n(&s->stats.cur.latency[i],
+		    __ATOMIC_RELAXED);
+	}
+	st.overruns = __atomic_load_n(&s->stats.cur.overruns,
+	    __ATOMIC_RELAXED);
+	st.skipped = __atomic_load_n(&s->stats.cur.skipped, __ATOMIC_RELAXED);
+	st.lost = __atomic_load_n(&s->stats.cur.lost, __ATOMIC_RELAXED);
+	st.reads = __atomic_load_n(&s->stats.cur.reads, __ATOMIC_RELAXED);
+	st.read_ns = __atomic_load_n(&s->stats.cur.read_ns, __ATOMIC_RELAXED);
+	st.read_max_ns = __atomic_load_n(&s->stats.cur.read_max_ns,
+	    __ATOMIC_RELAXED);
+	return st;
+}
+
+struct sample_stats
+get_sample_stats(void)
+{
+	return get_sample_stats_r(&gb_default);
+}
+
+unsigned
+get_acc_minlen_r(struct GB_state *s)
+{
+	return s->acc_minlen;
 }
 
 unsigned
 get_acc_minlen(void)
 {
-	return acc_minlen;
+	return get_acc_minlen_r(&gb_default);
+}
+
+void
+reset_acc_minlen_r(struct GB_state *s)
+{
+	s->acc_minlen = 0;
 }
 
 void
 reset_acc_minlen(void)
 {
-	acc_minlen = 0;
+	reset_acc_minlen_r(&gb_default);
+}
+
+int
+get_cutoff_r(struct GB_state *s)
+{
+	return s->cutoff;
 }
 
 int
 get_cutoff(void)
 {
-	return cutoff;
+	return get_cutoff_r(&gb_default);
 }
@@ -5,6 +5,8 @@
 #define NPLPI_INPUT_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 struct json_object;
 
@@ -63,18 +65,60 @@ struct GB_result {
 	enum eGB_HW hwstat;
 	/** skip state for reading log files */
 	bool skip;
+	/** the end of a line in a log file, which is not a bit */
+	bool newline;
+	/**
+	 * confidence in bitval from 0 to 100, derived from the distance of
+	 * the active length of the signal to the thresholds between the
+	 * values (100 for bits from a log file)
+	 */
+	unsigned confidence;
+};
+
+/** Method used to read the pin in live mode */
+enum eHW_iomode {
+	/**
+	 * poll the pin value for every sample using sysfs (Linux) or the
+	 * GPIOGET ioctl (FreeBSD)
+	 */
+	eio_poll,
+	/**
+	 * wait for edge events with kernel timestamps from the GPIO character
+	 * device (Linux only)
+	 */
+	eio_cdev,
+	/**
+	 * read the pin directly from the memory-mapped GPIO level register,
+	 * without any system calls (BCM2835 .. BCM2711 only)
+	 */
+	eio_mmap
 };
 
+/** Maximum number of pins which can be read simultaneously */
+#define GB_MAXPINS 7
+
 /**
  * Hardware parameters:
  */
 struct hardware {
 	/** sample frequency in Hz */
 	unsigned freq;
-	/** GPIO device number (FreeBSD only) */
+	/**
+	 * GPIO device number (FreeBSD, or Linux when using the GPIO character
+	 * device)
+	 */
 	unsigned iodev;
-	/** pin number to read from */
+	/** method used to read the pin */
+	enum eHW_iomode iomode;
+	/** pin number to read from, the first one of pins */
 	unsigned pin;
+	/**
+	 * pin numbers to read from, each with its own receiver, sampled
+	 * together and combined per bit
+	 */
+	unsigned pins[GB_MAXPINS];
+	/** number of pins in use */
+	unsigned npins;
 	/** pin value is high (1) or low (0) for active signal */
 	bool active_high;
 };
@@ -103,7 +147,7 @@ struct bitinfo {
 	unsigned t;
 	/**
 	 * the raw received radio signal, {@link hardware.freq} / 2 items,
-	 * with each item holding 8 bits
+	 * with each item holding 8 bits, not filled by the edge classifier
 	 */
 	unsigned char *signal;
 	/** the average length of a bit in samples */
@@ -119,13 +163,98 @@ struct bitinfo {
 	unsigned long long bit5x;
 };
 
+/** Number of buckets of {@link sample_stats.latency} */
+#define SS_BUCKETS 16
+
+/**
+ * Statistics of the sampling, to tell reception problems apart from
+ * scheduling problems. The latency and read times are only measured when
+ * enabled in config.json and when the pins are sampled, i.e. not with the
+ * "cdev" iomode.
+ */
+struct sample_stats {
+	/**
+	 * number of samples by the time they were taken after they were due:
+	 * bucket 0 for less than 1 us, bucket i for less than 2^i us, the last
+	 * bucket for everything later
+	 */
+	unsigned long long latency[SS_BUCKETS];
+	/** number of samples which were already due before waiting for them */
+	unsigned long long overruns;
+	/** number of samples skipped because the sampling was too late */
+	unsigned long long skipped;
+	/** number of samples lost because the decoder was too slow */
+	unsigned long long lost;
+	/** number of timed reads of the pins */
+	unsigned long long reads;
+	/** total time of the timed reads of the pins in ns */
+	unsigned long long read_ns;
+	/** longest time of a read of the pins in ns */
+	unsigned long long read_max_ns;
+	/** number of times {@link bitinfo.freq_reset} was set this minute */
+	unsigned freq_resets;
+	/** number of times {@link bitinfo.bitlen_reset} was set this minute */
+	unsigned bitlen_resets;
+	/** freq_resets of the previous minute */
+	unsigned prev_freq_resets;
+	/** bitlen_resets of the previous minute */
+	unsigned prev_bitlen_resets;
+};
+
+/**
+ * The state of one decoder. Each function below without a GB_state argument
+ * has a reentrant counterpart with an "_r" suffix which takes the state to
+ * use as its first argument. The functions without it use a process-wide
+ * state.
+ */
+struct GB_state;
+
+/**
+ * Allocate the state for a new decoder.
+ *
+ * @return The new state, or NULL if out of memory.
+ */
+struct GB_state *GB_new(void);
+
+/**
+ * Copy the state of a decoder in file mode, for example to continue
+ * decoding from the current position in another thread. The contents of
+ * the log file are shared with the original state, which must not be
+ * cleaned up before the copy.
+ *
+ * @param src The state to copy.
+ * @return The new state, or NULL if out of memory or src is not in file
+ * mode (EINVAL).
+ */
+struct GB_state *GB_dup(const struct GB_state *src);
+
+/**
+ * Retrieve the process-wide state used by the functions without a GB_state
+ * argument.
+ *
+ * @return The process-wide state.
+ */
+struct GB_state *GB_default(void);
+
+/**
+ * Clean up and free the state of a decoder.
+ *
+ * @param s The state, allocated by {@link GB_new}.
+ */
+void GB_free(struct GB_state *s);
+
 /**
  * Prepare for input from a log file.
  *
+ * Regular files are memory-mapped, other files (like pipes) are read into
+ * memory at once. Binary log files (see binlog.h) are recognized by their
+ * header and converted to the text form.
+ *
  * @param infilename The name of the log file to use.
  * @return Preparation was succesful (0), -1 or errno otherwise.
  */
 int set_mode_file(const char * const infilename);
+int set_mode_file_r(struct GB_state *s, const char * const infilename);
 
 /**
  * Prepare for live input.
@@ -133,11 +262,146 @@ int set_mode_file(const char * const infilename);
  * The sample rate is set to {@link hardware.freq} Hz, reading from pin
  * {@link hardware.pin} using {@link hardware.active_high} logic.
  *
+ * On Linux, the optional "iomode" key selects between "sysfs" (the default)
+ * and "cdev". The latter uses the GPIO character device /dev/gpiochipN with
+ * N taken from the "iodev" key (default 0) and only wakes up for edges of
+ * the signal instead of for every sample.
+ *
+ * Setting "iomode" to "mmap" maps the GPIO registers using /dev/gpiomem
+ * (Linux) or /dev/mem at the physical address in the "gpiobase" key
+ * (FreeBSD) and reads the pin with a plain memory load. The regular sysfs or
+ * ioctl() method is used if the registers cannot be mapped.
+ *
+ * The samples are taken at absolute deadlines. The optional keys
+ * "rtpriority" (SCHED_FIFO priority, 0 for none), "cpu" (CPU to run on) and
+ * "mlockall" (lock the process into memory) enable real-time scheduling of
+ * the calling thread. Setting "thread" to true moves the sampling into a
+ * separate thread instead, which then gets the real-time scheduling, and
+ * which feeds {@link get_bit_live} through a lock-free ring buffer.
+ *
+ * With iomode "cdev" and without a thread, setting "classifier" to "edges"
+ * measures the bits directly from the timestamps of the edges instead of
+ * from samples, which makes the CPU usage independent of
+ * {@link hardware.freq}.
+ *
+ * The optional "capture" key names a file to record the raw samples (or the
+ * raw edges with classifier "edges") to, see {@link set_mode_replay}.
+ *
+ * Setting the optional "minfreq" key below "freq" enables an adaptive sample
+ * rate: after a minute of cleanly classified bits with a stable
+ * {@link bitinfo.realfreq}, the rate is halved down to "minfreq", and every
+ * bad bit or reset doubles it again up to "freq". {@link hardware.freq} is
+ * the current rate, the rates are "freq" divided by powers of 2. This
+ * requires classifier "samples" without a thread and without "capture".
+ *
+ * Setting the optional "recordminutes" key enables a flight recorder of
+ * that many minutes of samples, dumped to the "recorddir" directory (default
+ * /var/tmp), see {@link set_recorder}.
+ *
+ * The "pin" key can also be an array of up to {@link GB_MAXPINS} pins, each
+ * connected to its own receiver. All of them are sampled at once, and each
+ * pin has its own filter. A second ends when more than half of the pins
+ * saw it end, and the bit is classified from the time at which the active
+ * signal of more than half of them had ended. Two pins therefore have to
+ * agree, at least three are needed to outvote a dead or noisy one.
+ * Multiple pins cannot be combined with classifier "edges" or with
+ * "capture".
+ *
  * @param config The JSON object containing the parsed configuration from
  * config.json
  * @return Preparation was succesful (0), -1 or errno otherwise.
  */
 int set_mode_live(struct json_object *config);
+int set_mode_live_r(struct GB_state *s, struct json_object *config);
+
+/**
+ * Prepare for replaying a capture file made in live mode.
+ *
+ * {@link get_bit_live} then decodes the captured samples (edges are
+ * converted to samples) without waiting, using the sample rate from the
+ * capture file. The end of the capture is reported as an I/O error with
+ * {@link GB_result.done} set. Times are of a virtual clock, see
+ * {@link set_mode_source}.
+ *
+ * @param capfilename The name of the capture file to use.
+ * @return Preparation was succesful (0), -1 or errno otherwise.
+ */
+int set_mode_replay(const char * const capfilename);
+int set_mode_replay_r(struct GB_state *s, const char * const capfilename);
+
+/** A source of samples replacing the pins, see {@link set_mode_source}. */
+struct pulse_source {
+	/**
+	 * Return the next sample: 0, 1, 2 for an I/O error, or -1 at the end
+	 * of the samples.
+	 */
+	int (*next)(void *arg);
+	/** The argument of next */
+	void *arg;
+	/** The sample rate in Hz */
+	unsigned freq;
+	/** The time of the first sample on the virtual clock in ns */
+	long long start_ns;
+	/**
+	 * The lowest sample rate of the adaptive mode of
+	 * {@link set_mode_live}, which decimates the samples, or 0 to decode
+	 * all of them
+	 */
+	unsigned min_freq;
+};
+
+/**
+ * Prepare for decoding the samples of a pulse source in live mode, for
+ * example a simulated receiver.
+ *
+ * {@link get_bit_live} then decodes the samples without waiting, as fast
+ * as the source returns them. Instead of CLOCK_MONOTONIC, the times of
+ * {@link get_second_start} and {@link get_minute_start} are of a virtual
+ * clock which advances by one sample period for each sample, starting at
+ * src->start_ns. The end of the samples is reported as an I/O error with
+ * {@link GB_result.done} set.
+ *
+ * @param src The pulse source, copied.
+ * @return Preparation was succesful (0), -1 or EX_DATAERR for an invalid
+ * sample rate otherwise.
+ */
+int set_mode_source(const struct pulse_source *src);
+int set_mode_source_r(struct GB_state *s, const struct pulse_source *src);
+
+/**
+ * Keep the last samples in a ring of one bit per sample, to be dumped as a
+ * capture file of samples with {@link dump_recorder} when a minute fails to
+ * decode. This must be called after {@link set_mode_live},
+ * {@link set_mode_replay} or {@link set_mode_source}. An I/O error is
+ * recorded as a 0 sample. The ring starts over when sampling resumes after
+ * {@link sleep_live} or when the adaptive sample rate changes, so a dump
+ * always has a single sample rate.
+ *
+ * @param minutes The number of minutes to keep at the current sample rate,
+ * or 0 to disable the recorder.
+ * @param dir The directory to write the capture files to.
+ * @return The recorder was set up (0), or EINVAL with the edge classifier,
+ * or errno otherwise.
+ */
+int set_recorder(unsigned minutes, const char *dir);
+int set_recorder_r(struct GB_state *s, unsigned minutes, const char *dir);
+
+/**
+ * Write the contents of the flight recorder to a capture file named
+ * nplpi-YYYYMMDDTHHMMSS-N.npc after the UTC time of the host and the number
+ * of the dump, starting at the first second in the ring. Each sample is
+ * dumped at most once, and at least a minute of samples is needed.
+ *
+ * The ring is copied and the file is written by a separate thread with the
+ * normal scheduler, so that sampling in the calling thread does not stall.
+ * That thread reports its errors on stderr.
+ *
+ * @return The copy is being written (0), EAGAIN if too few samples were
+ * recorded since the last dump, EBUSY if the previous dump is still being
+ * written, EINVAL without a recorder, or errno otherwise.
+ */
+int dump_recorder(void);
+int dump_recorder_r(struct GB_state *s);
 
 /**
  * Return the hardware parameters parsed from {@link set_mode_live}.
@@ -145,20 +409,25 @@ int set_mode_live(struct json_object *config);
  * @return The hardware parameters.
  */
 struct hardware get_hardware_parameters(void);
+struct hardware get_hardware_parameters_r(struct GB_state *s);
 
 /**
  * Clean up when closing the device or input logfile, and closing the output
  *log file if applicable.
  */
 void cleanup(void);
+void cleanup_r(struct GB_state *s);
 
 /**
- * Retrieve one pulse from the hardware.
+ * Retrieve one pulse from the hardware, or the most recent one taken by the
+ * acquisition thread if that is running.
  *
  * @return 0 or 1 depending on the pin value and {@link hardware.active_high},
- * or 2 if obtaining the pulse failed.
+ * or 2 if obtaining the pulse failed. With multiple pins, this is the value
+ * of the majority of them, or of the first pin in case of a tie.
  */
 int get_pulse(void);
+int get_pulse_r(struct GB_state *s);
 
 /**
  * Retrieve one bit from the log file.
@@ -166,6 +435,30 @@ int get_pulse(void);
  * @return The current bit from the log file and its associated state.
  */
 struct GB_result get_bit_file(void);
+struct GB_result get_bit_file_r(struct GB_state *s);
+
+/**
+ * Continue reading the log file at the start of the given minute, i.e.
+ * after the given number of newlines and new log marks. This uses the
+ * minute index for binary log files.
+ *
+ * @param minute The minute to start at, 0 for the start of the file.
+ * @return Seeking was successful (0), or errno otherwise (EINVAL if the
+ * file has fewer minutes).
+ */
+int seek_minute(unsigned minute);
+int seek_minute_r(struct GB_state *s, unsigned minute);
+
+/**
+ * Retrieve the next symbol from the log file as seen by get_bit_file(),
+ * used to convert text log files to binary ones.
+ *
+ * @param acc_minlen Set to the value following an 'a'.
+ * @return One of "012345\nxr#*_a", NUL, {@link BINLOG_NEWLOG},
+ * {@link BINLOG_END} for an 'a' without a valid value, or EOF.
+ */
+int get_log_symbol(unsigned *acc_minlen);
+int get_log_symbol_r(struct GB_state *s, unsigned *acc_minlen);
 
 /**
  * Retrieve one live bit from the hardware. This function determines several
@@ -174,6 +467,63 @@ struct GB_result get_bit_file(void);
  * @return The currently received bit and its full status.
  */
 struct GB_result get_bit_live(void);
+struct GB_result get_bit_live_r(struct GB_state *s);
+
+/**
+ * Non-blocking version of {@link get_bit_live}: process the samples which
+ * are available now and return without waiting for the others. The next
+ * call continues with the same bit. The edge classifier ("edges" in
+ * config.json) still blocks for a complete bit.
+ *
+ * @param bit Set to the received bit and its full status when complete.
+ * @return The bit is complete, or false if more samples are needed, see
+ * {@link get_live_fd} and {@link get_live_timeout} on when to call again.
+ */
+bool poll_bit_live(struct GB_result *bit);
+bool poll_bit_live_r(struct GB_state *s, struct GB_result *bit);
+
+/**
+ * Retrieve the file descriptor which becomes readable when
+ * {@link poll_bit_live} can make progress, only when the GPIO character
+ * device is read directly.
+ *
+ * @return The file descriptor, or -1 if there is none.
+ */
+int get_live_fd(void);
+int get_live_fd_r(struct GB_state *s);
+
+/**
+ * Retrieve the time after which {@link poll_bit_live} can make progress
+ * without activity on {@link get_live_fd}, suitable for poll().
+ *
+ * @return The time in milliseconds, 0 if samples are available now.
+ */
+int get_live_timeout(void);
+int get_live_timeout_r(struct GB_state *s);
+
+/**
+ * Suspend sampling the pins until the given time, for duty-cycled
+ * reception. This must be called between two bits, the next call of
+ * {@link get_bit_live} or {@link poll_bit_live} waits until wake_ns and
+ * then continues with a partial bit. The acquisition thread is stopped
+ * meanwhile. The time asleep is added to the accumulated minute length, so
+ * that {@link decode_time} advances the time over the gap.
+ *
+ * @param wake_ns The time to resume in ns of CLOCK_MONOTONIC, or of the
+ * virtual clock of {@link set_mode_source}.
+ * @return Sampling is suspended (0), or EINVAL if not in live or replay
+ * mode, with the edge classifier, or while capturing.
+ */
+int sleep_live(long long wake_ns);
+int sleep_live_r(struct GB_state *s, long long wake_ns);
+
+/**
+ * Retrieve the time at which sampling resumes, see {@link sleep_live}.
+ *
+ * @return The time in ns, or -1 if sampling is not suspended.
+ */
+long long get_wake_time(void);
+long long get_wake_time_r(struct GB_state *s);
 
 /**
  * Prepare for the next bit: update the bit position or wrap it around.
@@ -182,6 +532,7 @@ struct GB_result get_bit_live(void);
  * indicate state of the bit buffer and the minute end.
  */
 struct GB_result next_bit(void);
+struct GB_result next_bit_r(struct GB_state *s);
 
 /**
  * Retrieve the current bit position.
@@ -189,6 +540,7 @@ struct GB_result next_bit(void);
  * @return The current bit position (0..60).
  */
 int get_bitpos(void);
+int get_bitpos_r(struct GB_state *s);
 
 /**
  * Retrieve the current bit buffer.
@@ -196,6 +548,57 @@ int get_bitpos(void);
  * @return The bit buffer, an array of values 0..3
  */
 const int * const get_buffer(void);
+const int * const get_buffer_r(struct GB_state *s);
+
+/**
+ * Retrieve the current bit buffer in packed form, as used by
+ * {@link decode_time_r}.
+ *
+ * @return The A bits (element 0) and the B bits (element 1) of the bit
+ * buffer, second i is bit 63 - i of each.
+ */
+const uint64_t *get_bits(void);
+const uint64_t *get_bits_r(struct GB_state *s);
+
+/**
+ * Retrieve the confidence of each bit in the bit buffer, see
+ * {@link GB_result.confidence}. Bits which were not received have a
+ * confidence of 0.
+ *
+ * @return The confidence values, 0..100 for each position
+ */
+const unsigned char *get_confidence(void);
+const unsigned char *get_confidence_r(struct GB_state *s);
+
+/**
+ * Retrieve the time at which the active signal of the last bit started,
+ * i.e. the on-time edge of its second, as measured by the live decoder. The
+ * delay of the low-pass filter is already subtracted.
+ *
+ * @return The time in ns of CLOCK_MONOTONIC, or -1 if unknown (e.g. in
+ * file or replay mode, or if the bit was not received correctly)
+ */
+long long get_second_start(void);
+long long get_second_start_r(struct GB_state *s);
+
+/**
+ * Retrieve the time at which the active signal of the last minute marker
+ * started, i.e. the start of second 0, as measured by the live decoder. The
+ * delay of the low-pass filter is already subtracted.
+ *
+ * @return The time in ns of CLOCK_MONOTONIC, or -1 if unknown (e.g. in
+ * file or replay mode)
+ */
+long long get_minute_start(void);
+long long get_minute_start_r(struct GB_state *s);
+
+/**
+ * Retrieve the current position in the (text form of the) log file.
+ *
+ * @return The offset of the next character to read.
+ */
+size_t get_file_pos(void);
+size_t get_file_pos_r(struct GB_state *s);
 
 /**
  * Determine if there should be a space between the last bit and the current
@@ -205,20 +608,45 @@ const int * const get_buffer(void);
  */
 bool is_space_bit(int bitpos);
 
+/**
+ * Set the durability policy for log files opened by {@link append_logfile}
+ * afterwards.
+ *
+ * The optional "logflush" key is "none" (write when the buffer fills up),
+ * "minute" (also write at the end of every minute, the default) or "fsync"
+ * (like "minute", with fsync() every "logsync" seconds, default 60). Log
+ * files are synced when they are closed unless "logflush" is "none".
+ *
+ * @param config The JSON object containing the parsed configuration from
+ * config.json
+ * @return The policy was set (0), or EX_DATAERR for an unknown policy.
+ */
+int set_log_policy(struct json_object *config);
+int set_log_policy_r(struct GB_state *s, struct json_object *config);
+
 /**
  * Open the log file and append a "new log" marker to it.
  *
+ * The binary format (see binlog.h) is used for files which already are
+ * binary log files, and for new or empty files ending in ".nplb".
+ *
+ * Writes only copy the data into a buffer, a separate thread writes it to
+ * disk according to the policy set by {@link set_log_policy}.
+ *
  * @param logfilename The name of the log file to use.
  * @return The log file was opened succesfully (0), or errno on error.
  */
 int append_logfile(const char * const logfilename);
+int append_logfile_r(struct GB_state *s, const char * const logfilename);
 
 /**
- * Close the currently opened log file.
+ * Close the currently opened log file, after the writer thread has
+ * written all data.
  *
  * @return The log file was closed successfully (0), or errno otherwise.
  */
 int close_logfile(void);
+int close_logfile_r(struct GB_state *s);
 
 /**
  * Retrieve "internal" information about the currently received bit.
@@ -226,6 +654,25 @@ int close_logfile(void);
  * @return The bit information as described for {@link bitinfo}.
  */
 struct bitinfo get_bitinfo(void);
+struct bitinfo get_bitinfo_r(struct GB_state *s);
+
+/**
+ * Retrieve the statistics of the sampling since the start of live mode.
+ *
+ * With the optional "samplestats" key set to true in config.json, the
+ * latency and the duration of each read of the pins is measured, at the
+ * cost of two extra clock_gettime() calls per sample. The optional
+ * "statslog" key names a file to append the statistics to at the end of
+ * every minute, which also enables the measurements. A separate thread
+ * writes this file, like the log file, see {@link set_log_policy}.
+ *
+ * This can be called from another thread than the one sampling and
+ * decoding, each field is read atomically.
+ *
+ * @return The statistics.
+ */
+struct sample_stats get_sample_stats(void);
+struct sample_stats get_sample_stats_r(struct GB_state *s);
 
 /**
  * Retrieve the accumulated minute length in milliseconds.
@@ -233,11 +680,13 @@ struct bitinfo get_bitinfo(void);
  * @return The accumulated minute length in milliseconds.
  */
 unsigned get_acc_minlen(void);
+unsigned get_acc_minlen_r(struct GB_state *s);
 
 /**
  * Reset the accumulated minute length.
  */
 void reset_acc_minlen(void);
+void reset_acc_minlen_r(struct GB_state *s);
 
 /**
  * Retrieve the cutoff value written to the log file.
@@ -245,12 +694,6 @@ void reset_acc_minlen(void);
  * @return The cutoff value (multiplied by 10,000)
  */
 int get_cutoff(void);
-
-/**
- * Flush the current log file to its storage location.
- *
- * @param arg Unused argument because of pthread_create()
- */
-void *flush_logfile(/*@unused*/ void *arg);
+int get_cutoff_r(struct GB_state *s);
 
 #endif
@@ -0,0 +1,200 @@
+// Copyright 2019 René Ladan
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include "logwriter.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/** initial size of each buffer, the thread is woken up at half of it */
+#define LW_BUFLEN 65536
+
+/*
+ * The appending thread only touches buf[active] and the writer thread only
+ * touches the other buffer, so the mutex is only held to append and to swap
+ * the buffers, never during I/O.
+ */
+
+static int
+write_all(int fd, const char *buf, size_t len)
+{
+	while (len > 0) {
+		ssize_t w = write(fd, buf, len);
+
+		if (w == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return errno;
+		}
+		buf += w;
+		len -= (size_t)w;
+	}
+	return 0;
+}
+
+static void *
+writer(void *arg)
+{
+	struct logwriter *lw = arg;
+	struct timespec last_sync;
+
+	(void)clock_gettime(CLOCK_REALTIME, &last_sync);
+	(void)pthread_mutex_lock(&lw->mutex);
+	for (;;) {
+		struct timespec now;
+		bool stopping, sync;
+		int w, res;
+
+		while (!lw->stop && !lw->minute &&
+		    lw->len[lw->active] < LW_BUFLEN / 2) {
+			if (lw->policy == elw_fsync) {
+				struct timespec deadline = last_sync;
+
+				deadline.tv_sec += lw->interval;
+				if (pthread_cond_timedwait(&lw->cond,
+				    &lw->mutex, &deadline) == ETIMEDOUT) {
+					break;
+				}
+			} else {
+				(void)pthread_cond_wait(&lw->cond, &lw->mutex);
+			}
+		}
+		w = lw->active;
+		lw->active = 1 - w;
+		lw->minute = false;
+		stopping = lw->stop;
+		(void)pthread_mutex_unlock(&lw->mutex);
+
+		res = write_all(lw->fd, lw->buf[w], lw->len[w]);
+		lw->len[w] = 0;
+		(void)clock_gettime(CLOCK_REALTIME, &now);
+		sync = (lw->policy == elw_fsync &&
+		    now.tv_sec - last_sync.tv_sec >= (time_t)lw->interval) ||
+		    (stopping && lw->policy != elw_none);
+		if (sync) {
+			if (fsync(lw->fd) == -1 && res == 0) {
+				res = errno;
+			}
+			last_sync = now;
+		}
+
+		(void)pthread_mutex_lock(&lw->mutex);
+		if (res != 0 && lw->error == 0) {
+			lw->error = res;
+		}
+		if (stopping) {
+			break;
+		}
+	}
+	(void)pthread_mutex_unlock(&lw->mutex);
+	return NULL;
+}
+
+int
+logwriter_start(struct logwriter *lw, int fd, enum eLW_policy policy,
+    unsigned interval)
+{
+	int i, res;
+
+	lw->fd = fd;
+	lw->policy = policy;
+	lw->interval = interval > 0 ? interval : 1;
+	lw->active = 0;
+	lw->minute = false;
+	lw->stop = false;
+	lw->error = 0;
+	for (i = 0; i < 2; i++) {
+		lw->buf[i] = malloc(LW_BUFLEN);
+		lw->len[i] = 0;
+		lw->size[i] = LW_BUFLEN;
+		if (lw->buf[i] == NULL) {
+			res = errno;
+			free(lw->buf[0]);
+			return res;
+		}
+	}
+	res = pthread_mutex_init(&lw->mutex, NULL);
+	if (res == 0) {
+		res = pthread_cond_init(&lw->cond, NULL);
+		if (res == 0) {
+			res = pthread_create(&lw->thread, NULL, writer, lw);
+			if (res != 0) {
+				(void)pthread_cond_destroy(&lw->cond);
+			}
+		}
+		if (res != 0) {
+			(void)pthread_mutex_destroy(&lw->mutex);
+		}
+	}
+	if (res != 0) {
+		free(lw->buf[0]);
+		free(lw->buf[1]);
+	}
+	return res;
+}
+
+void
+logwriter_append(struct logwriter *lw, const void *data, size_t len)
+{
+	int a;
+
+	(void)pthread_mutex_lock(&lw->mutex);
+	a = lw->active;
+	if (lw->len[a] + len > lw->size[a]) {
+		/* the writer is behind, grow instead of waiting for it */
+		size_t nsize = lw->size[a] * 2;
+		char *nbuf;
+
+		while (lw->len[a] + len > nsize) {
+			nsize *= 2;
+		}
+		nbuf = realloc(lw->buf[a], nsize);
+		if (nbuf == NULL) {
+			if (lw->error == 0) {
+				lw->error = errno;
+			}
+			(void)pthread_mutex_unlock(&lw->mutex);
+			return;
+		}
+		lw->buf[a] = nbuf;
+		lw->size[a] = nsize;
+	}
+	memcpy(lw->buf[a] + lw->len[a], data, len);
+	lw->len[a] += len;
+	if (lw->len[a] >= LW_BUFLEN / 2) {
+		(void)pthread_cond_signal(&lw->cond);
+	}
+	(void)pthread_mutex_unlock(&lw->mutex);
+}
+
+void
+logwriter_minute(struct logwriter *lw)
+{
+	if (lw->policy == elw_none) {
+		return;
+	}
+	(void)pthread_mutex_lock(&lw->mutex);
+	lw->minute = true;
+	(void)pthread_cond_signal(&lw->cond);
+	(void)pthread_mutex_unlock(&lw->mutex);
+}
+
+int
+logwriter_stop(struct logwriter *lw)
+{
+	(void)pthread_mutex_lock(&lw->mutex);
+	lw->stop = true;
+	(void)pthread_cond_signal(&lw->cond);
+	(void)pthread_mutex_unlock(&lw->mutex);
+	(void)pthread_join(lw->thread, NULL);
+	(void)pthread_cond_destroy(&lw->cond);
+	(void)pthread_mutex_destroy(&lw->mutex);
+	free(lw->buf[0]);
+	free(lw->buf[1]);
+	lw->buf[0] = lw->buf[1] = NULL;
+	return lw->error;
+}
@@ -0,0 +1,93 @@
+// Copyright 2019 René Ladan
+// SPDX-License-Identifier: BSD-2-Clause
+
+#ifndef NPLPI_LOGWRITER_H
+#define NPLPI_LOGWRITER_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/** When the log writer writes its data to disk */
+enum eLW_policy {
+	/** when the buffer fills up and on close */
+	elw_none,
+	/** also at the end of every minute */
+	elw_minute,
+	/** also at the end of every minute, with fsync() every interval */
+	elw_fsync
+};
+
+/**
+ * Double-buffered log writer: the caller appends to one buffer while a
+ * separate thread writes the other one to disk.
+ */
+struct logwriter {
+	/** file descriptor to write to */
+	int fd;
+	/** durability policy */
+	enum eLW_policy policy;
+	/** seconds between calls to fsync() for {@link elw_fsync} */
+	unsigned interval;
+	/** the two buffers */
+	char *buf[2];
+	/** number of bytes in each buffer */
+	size_t len[2];
+	/** allocated size of each buffer */
+	size_t size[2];
+	/** the buffer being appended to */
+	int active;
+	/** the end of a minute was marked */
+	bool minute;
+	/** request to stop the thread */
+	bool stop;
+	/** first error from write() or fsync(), or 0 */
+	int error;
+	/** protects all fields above except fd */
+	pthread_mutex_t mutex;
+	/** signals the thread that there is work */
+	pthread_cond_t cond;
+	/** the writer thread */
+	pthread_t thread;
+};
+
+/**
+ * Start the writer thread.
+ *
+ * @param lw The log writer.
+ * @param fd The file descriptor to write to, owned by the caller.
+ * @param policy The durability policy.
+ * @param interval The number of seconds between calls to fsync() for
+ * {@link elw_fsync}.
+ * @return Starting was successful (0), or errno otherwise.
+ */
+int logwriter_start(struct logwriter *lw, int fd, enum eLW_policy policy,
+    unsigned interval);
+
+/**
+ * Append data to the log, without doing any I/O.
+ *
+ * @param lw The log writer.
+ * @param data The data to append.
+ * @param len The length of data.
+ */
+void logwriter_append(struct logwriter *lw, const void *data, size_t len);
+
+/**
+ * Mark the end of a minute, which writes the data to disk for the
+ * {@link elw_minute} and {@link elw_fsync} policies.
+ *
+ * @param lw The log writer.
+ */
+void logwriter_minute(struct logwriter *lw);
+
+/**
+ * Write all remaining data, fsync() it unless the policy is
+ * {@link elw_none}, and stop the writer thread.
+ *
+ * @param lw The log writer.
+ * @return All data was written successfully (0), or the first errno.
+ */
+int logwriter_stop(struct logwriter *lw);
+
+#endif
@@ -5,52 +5,260 @@
 
 #include "decode_time.h"
 #include "input.h"
+#include "refclock.h"
 #include "setclock.h"
 
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
 #include <string.h>
 #include <time.h>
 
+/* wake up in ns before the predicted minute marker, to settle the filter */
+#define WAKE_EARLY 5000000000LL
+
+/* The callback to obtain a bit for mainloop(). */
+static struct GB_result (*ml_get_bit)(void);
+
+/* The positions of mainloop_step() in the loop. */
+enum eML_stage {
+	mls_bit,        /* obtain the next bit */
+	mls_next,       /* advance to the next bit position */
+	mls_check,      /* check for a new minute */
+	mls_time,       /* decode the new minute */
+	mls_clock,      /* set the system clock */
+	mls_checked,    /* after the check for a new minute */
+	mls_marker,     /* handle the minute marker */
+	mls_second,     /* the bit is done */
+	mls_end         /* check for the end of the input */
+};
+
+void
+mainloop_init(struct ML_state *ml, struct GB_state *gb, char *logfilename)
+{
+	(void)memset(ml, 0, sizeof(*ml));
+	ml->gb = gb;
+	ml->init_min = 2;
+	ml->mlr.logfilename = logfilename;
+	ml->stage = mls_bit;
+}
+
+/*
+ * Suspend sampling after mlr.sleep_after consecutive verified minutes, or
+ * after a single one once woken up, until shortly before the minute marker
+ * mlr.sleep_minutes later. The time decoder keeps running over the gap, so
+ * the first complete minute after waking up is checked against the
+ * predicted time instead of starting from scratch. If that minute fails,
+ * reception is not trusted any more and mlr.sleep_after applies again.
+ * setclock_ok() never accepts a time recovered by the soft decoder.
+ */
 static void
-check_handle_new_minute(struct GB_result bit, struct ML_result *mlr,
-    int bitpos, struct tm *curtime, int minlen, bool was_toolong,
-    unsigned *init_min, void (*display_minute)(int),
-    void (*display_time)(struct DT_result, struct tm),
-    struct ML_result (*process_setclock_result)(struct ML_result, int))
+duty_cycle(struct ML_state *ml)
 {
-	bool have_result = false;
+	long long edge = get_minute_start_r(ml->gb);
 
-	if ((bit.marker == emark_minute || bit.marker == emark_late) &&
-	    !was_toolong) {
-		struct DT_result dt;
+	if (!setclock_ok(ml->init_min, ml->dt_res, ml->bit) || edge == -1) {
+		ml->ok_minutes = 0;
+		/* the partial minute after waking up always fails */
+		if (!ml->woken) {
+			ml->slept = false;
+		}
+		ml->woken = false;
+		return;
+	}
+	ml->woken = false;
+	if (++ml->ok_minutes < ml->mlr.sleep_after && !ml->slept) {
+		return;
+	}
+	if (sleep_live_r(ml->gb, edge + ml->mlr.sleep_minutes *
+	    60000000000LL - WAKE_EARLY) == 0) {
+		ml->ok_minutes = 0;
+		ml->slept = true;
+		ml->woken = true;
+	}
+}
 
-		display_minute(minlen);
-		dt = decode_time(*init_min, minlen, get_acc_minlen(),
-		    get_buffer(), curtime);
+/* The minute failed the sanity checks of decode_time() or jumped. */
+static bool
+minute_failed(struct DT_result dt)
+{
+	return dt.minute_length != emin_ok || !dt.bit0_ok || !dt.bit52_ok ||
+	    !dt.bit59_ok || dt.marker_status == emk_error ||
+	    dt.minute_status != eval_ok || dt.hour_status != eval_ok ||
+	    dt.mday_status != eval_ok || dt.wday_status != eval_ok ||
+	    dt.month_status != eval_ok || dt.year_status != eval_ok ||
+	    dt.dst_status == eDST_jump;
+}
 
-		display_time(dt, *curtime);
+enum eML_event
+mainloop_step(struct ML_state *ml, struct ML_event *ev)
+{
+	bool have_result, ok;
+	long long edge;
 
-		if (mlr->settime) {
-			have_result = true;
-			if (setclock_ok(*init_min, dt, bit)) {
-				mlr->settime_result = setclock(*curtime);
+	for (;;) {
+		switch (ml->stage) {
+		case mls_bit:
+			if (ml->end > 0 && ml->minute_done &&
+			    get_file_pos_r(ml->gb) >= ml->end) {
+				return ev->type = eml_end;
+			}
+			if (ml->poll_bit != NULL) {
+				if (!ml->poll_bit(ml->gb, &ml->bit)) {
+					return ev->type = eml_none;
+				}
 			} else {
-				mlr->settime_result = esc_unsafe;
+				ml->bit = ml->get_bit(ml->gb);
 			}
-		}
-		if (bit.marker == emark_minute || bit.marker == emark_late) {
-			reset_acc_minlen();
-		}
-		if (*init_min > 0) {
-			(*init_min)--;
+			ml->minute_done = false;
+			ml->minute_ok = false;
+			ml->bitpos = get_bitpos_r(ml->gb);
+			ml->stage = mls_next;
+			ev->bit = ml->bit;
+			ev->bitpos = ml->bitpos;
+			return ev->type = eml_bit;
+		case mls_next:
+			ml->bit = next_bit_r(ml->gb);
+			if (ml->minlen == -1) {
+				ml->pass = 0;
+				ml->stage = mls_check;
+			} else {
+				ml->stage = mls_marker;
+			}
+			break;
+		case mls_check:
+			ml->stage = mls_checked;
+			if ((ml->bit.marker == emark_minute ||
+			    ml->bit.marker == emark_late) && !ml->was_toolong) {
+				ml->stage = mls_time;
+				ev->minlen = ml->minlen;
+				return ev->type = eml_minute;
+			}
+			break;
+		case mls_time:
+			ml->dt.soft.enabled = ml->mlr.soft_decode;
+			ml->dt_res = decode_time_r(&ml->dt, ml->init_min,
+			    ml->minlen, get_acc_minlen_r(ml->gb),
+			    get_buffer_r(ml->gb), get_bits_r(ml->gb),
+			    get_confidence_r(ml->gb), &ml->curtime);
+			/* the first minute is partial */
+			if (ml->init_min < 2 && minute_failed(ml->dt_res)) {
+				int res = dump_recorder_r(ml->gb);
+
+				if (res != 0 && res != EAGAIN &&
+				    res != EBUSY && res != EINVAL) {
+					fprintf(stderr, "dump_recorder: %s\n",
+					    strerror(res));
+				}
+			}
+			ml->stage = mls_clock;
+			ev->dt = ml->dt_res;
+			ev->time = ml->curtime;
+			return ev->type = eml_time;
+		case mls_clock:
+			have_result = false;
+			ok = false;
+			edge = -1;
+			if (ml->mlr.settime || ml->mlr.refclock != NULL) {
+				ok = setclock_ok(ml->init_min, ml->dt_res,
+				    ml->bit) || (ml->mlr.quick_start &&
+				    setclock_quick_ok(ml->init_min, ml->dt_res,
+				    ml->bit, ml->curtime,
+				    ml->mlr.quick_window));
+				edge = get_minute_start_r(ml->gb);
+				ml->minute_ok = ok;
+			}
+			if (ml->mlr.refclock != NULL && ok && edge != -1) {
+				(void)refclock_sample(ml->mlr.refclock,
+				    ml->curtime, edge);
+			}
+			if (ml->mlr.settime) {
+				have_result = true;
+				if (ok && ml->mlr.discipline && edge != -1) {
+					ml->mlr.settime_result =
+					    setclock_discipline(ml->curtime,
+					    edge, ml->mlr.step_limit);
+				} else if (ok) {
+					ml->mlr.settime_result =
+					    setclock(ml->curtime);
+				} else {
+					ml->mlr.settime_result = esc_unsafe;
+				}
+			}
+			reset_acc_minlen_r(ml->gb);
+			if (ml->mlr.sleep_minutes > 0) {
+				duty_cycle(ml);
+			}
+			if (ml->init_min > 0) {
+				ml->init_min--;
+			}
+			ml->minute_done = true;
+			ml->stage = mls_checked;
+			if (have_result) {
+				ev->bitpos = ml->bitpos;
+				return ev->type = eml_setclock;
+			}
+			break;
+		case mls_checked:
+			if (ml->pass == 0) {
+				ml->was_toolong = true;
+				ml->stage = mls_marker;
+			} else {
+				ml->was_toolong = false;
+				ml->stage = mls_end;
+			}
+			break;
+		case mls_marker:
+			ml->stage = mls_second;
+			if (ml->bit.marker == emark_minute) {
+				/* minute marker is at bit 0 */
+				ml->minlen = ml->old_bitpos;
+			} else if (ml->bit.marker == emark_toolong ||
+			    ml->bit.marker == emark_late) {
+				ml->minlen = -1;
+				/*
+				 * leave acc_minlen alone, any minute marker
+				 * already processed
+				 */
+				return ev->type = eml_long_minute;
+			}
+			break;
+		case mls_second:
+			ml->pass = 1;
+			ml->stage = mls_check;
+			return ev->type = eml_new_second;
+		case mls_end:
+		default:
+			if (ml->mlr.refclock != NULL &&
+			    (edge = get_second_start_r(ml->gb)) != -1) {
+				(void)refclock_pulse(ml->mlr.refclock, edge,
+				    ml->minute_ok ? &ml->curtime : NULL);
+			}
+			if (ml->bit.done || ml->mlr.quit) {
+				ml->done = true;
+				return ev->type = eml_done;
+			}
+			ml->old_bitpos = ml->bitpos;
+			ml->stage = mls_bit;
+			break;
 		}
 	}
-	if (have_result && process_setclock_result != NULL) {
-		*mlr = process_setclock_result(*mlr, bitpos);
-	}
+}
+
+int
+mainloop_fd(struct ML_state *ml)
+{
+	return get_live_fd_r(ml->gb);
+}
+
+int
+mainloop_timeout(struct ML_state *ml)
+{
+	return get_live_timeout_r(ml->gb);
 }
 
 void
-mainloop(char *logfilename, struct GB_result (*get_bit)(void),
+mainloop_r(struct ML_state *ml, struct GB_result (*get_bit)(struct GB_state *),
     void (*display_bit)(struct GB_result, int),
     void (*display_long_minute)(void), void (*display_minute)(int),
     void (*display_new_second)(void),
@@ -59,69 +267,91 @@ mainloop(char *logfilename, struct GB_result (*get_bit)(void),
     struct ML_result (*process_input)(struct ML_result, int),
     struct ML_result (*post_process_input)(struct ML_result, int))
 {
-	int minlen = 0;
-	int bitpos = 0;
-	int old_bitpos = 0;
-	unsigned init_min = 2;
-	struct tm curtime;
-	struct ML_result mlr;
-	bool was_toolong = false;
-
-	(void)memset(&curtime, 0, sizeof(curtime));
-	(void)memset(&mlr, 0, sizeof(mlr));
-	mlr.logfilename = logfilename;
-
+	if (get_bit != NULL) {
+		ml->get_bit = get_bit;
+		ml->poll_bit = NULL;
+	}
 	for (;;) {
-		struct GB_result bit;
+		struct ML_event ev;
+		struct pollfd pfd;
 
-		bit = get_bit();
-		if (process_input != NULL) {
-			mlr = process_input(mlr, bitpos);
-			if (bit.done || mlr.quit) {
-				break;
+		switch (mainloop_step(ml, &ev)) {
+		case eml_none:
+			pfd.fd = mainloop_fd(ml);
+			pfd.events = POLLIN;
+			pfd.revents = 0;
+			(void)poll(&pfd, pfd.fd == -1 ? 0 : 1,
+			    mainloop_timeout(ml));
+			break;
+		case eml_bit:
+			if (process_input != NULL) {
+				ml->mlr = process_input(ml->mlr,
+				    ml->old_bitpos);
+				if (ev.bit.done || ml->mlr.quit) {
+					ml->done = true;
+					return;
+				}
 			}
-		}
-
-		bitpos = get_bitpos();
-		if (post_process_input != NULL) {
-			mlr = post_process_input(mlr, bitpos);
-		}
-		if (!bit.skip && !mlr.quit) {
-			display_bit(bit, bitpos);
-		}
-
-		bit = next_bit();
-		if (minlen == -1) {
-			check_handle_new_minute(bit, &mlr, bitpos, &curtime,
-			    minlen, was_toolong, &init_min, display_minute,
-			    display_time, process_setclock_result);
-			was_toolong = true;
-		}
-
-		if (bit.marker == emark_minute) {
-			/* minute marker is at bit 0 */
-			minlen = old_bitpos;
-		} else if (bit.marker == emark_toolong ||
-		    bit.marker == emark_late) {
-			minlen = -1;
-			/*
-			 * leave acc_minlen alone, any minute marker already
-			 * processed
-			 */
+			if (post_process_input != NULL) {
+				ml->mlr = post_process_input(ml->mlr,
+				    ev.bitpos);
+			}
+			if (!ev.bit.skip && !ml->mlr.quit) {
+				display_bit(ev.bit, ev.bitpos);
+			}
+			break;
+		case eml_long_minute:
 			display_long_minute();
-		}
-		if (display_new_second != NULL) {
-			display_new_second();
-		}
-
-		check_handle_new_minute(bit, &mlr, bitpos, &curtime, minlen,
-		    was_toolong, &init_min, display_minute,
-		    display_time, process_setclock_result);
-		was_toolong = false;
-		if (bit.done || mlr.quit) {
 			break;
+		case eml_minute:
+			display_minute(ev.minlen);
+			break;
+		case eml_time:
+			display_time(ev.dt, ev.time);
+			break;
+		case eml_setclock:
+			if (process_setclock_result != NULL) {
+				ml->mlr = process_setclock_result(ml->mlr,
+				    ev.bitpos);
+			}
+			break;
+		case eml_new_second:
+			if (display_new_second != NULL) {
+				display_new_second();
+			}
+			break;
+		case eml_end:
+		case eml_done:
+		default:
+			return;
 		}
-		old_bitpos = bitpos; 
 	}
+}
+
+/* Adapt the callback of mainloop() to mainloop_r(). */
+static struct GB_result
+get_bit_default(struct GB_state *s)
+{
+	(void)s;
+	return ml_get_bit();
+}
+
+void
+mainloop(char *logfilename, struct GB_result (*get_bit)(void),
+    void (*display_bit)(struct GB_result, int),
+    void (*display_long_minute)(void), void (*display_minute)(int),
+    void (*display_new_second)(void),
+    void (*display_time)(struct DT_result, struct tm),
+    struct ML_result (*process_setclock_result)(struct ML_result, int),
+    struct ML_result (*process_input)(struct ML_result, int),
+    struct ML_result (*post_process_input)(struct ML_result, int))
+{
+	struct ML_state ml;
+
+	mainloop_init(&ml, GB_default(), logfilename);
+	ml_get_bit = get_bit;
+	mainloop_r(&ml, get_bit_default, display_bit, display_long_minute,
+	    display_minute, display_new_second, display_time,
+	    process_setclock_result, process_input, post_process_input);
 	cleanup();
 }
@@ -4,14 +4,16 @@
 #ifndef NPLPI_MAINLOOP_H
 #define NPLPI_MAINLOOP_H
 
+#include "decode_time.h"
+#include "input.h"
 #include "setclock.h"
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
 
-struct DT_result;
-struct GB_result;
 struct alm;
-struct tm;
+struct refclock;
 
 /** User input which controls the client */
 struct ML_result {
@@ -23,6 +25,46 @@ struct ML_result {
 	bool settime;
 	/** Result of setting the system time */
 	enum eSC_status settime_result;
+	/**
+	 * Request to recover minutes with errors from the evidence of the
+	 * previous minutes, see {@link DT_soft}
+	 */
+	bool soft_decode;
+	/**
+	 * Request to set the system time from the first fully decoded minute,
+	 * see {@link setclock_quick_ok}
+	 */
+	bool quick_start;
+	/**
+	 * The maximum number of seconds the time set by quick_start may be
+	 * ahead of the host clock, or 0 for no limit
+	 */
+	unsigned quick_window;
+	/**
+	 * Request to slew the system time, see {@link setclock_discipline},
+	 * instead of stepping it every minute
+	 */
+	bool discipline;
+	/** The largest offset in ms to slew instead of step */
+	unsigned step_limit;
+	/**
+	 * Request to suspend sampling for this many minutes after a verified
+	 * minute, see {@link sleep_live}, or 0 to sample continuously. A
+	 * blocking get_bit does not return while asleep.
+	 */
+	unsigned sleep_minutes;
+	/**
+	 * The number of consecutive minutes which {@link setclock_ok} must
+	 * accept before the first sleep. After waking up a single one
+	 * suffices, unless the first complete minute after waking up fails,
+	 * then this many are needed again.
+	 */
+	unsigned sleep_after;
+	/**
+	 * The reference clock to publish each valid minute and each second
+	 * edge to, independent of settime, or NULL for none
+	 */
+	struct refclock *refclock;
 	/** The name of the log file */
 	char *logfilename;
 };
@@ -62,4 +104,168 @@ void mainloop(char *logfilename,
     struct ML_result (*process_input)(struct ML_result, int),
     struct ML_result (*post_process_input)(struct ML_result, int));
 
+/**
+ * The events reported by {@link mainloop_step}, each one corresponds to a
+ * callback of {@link mainloop} and they occur in the same order.
+ */
+enum eML_event {
+	/** no work is ready, see {@link mainloop_fd} */
+	eml_none,
+	/** a bit was received (bit, bitpos), see display_bit */
+	eml_bit,
+	/** the minute is too long, see display_long_minute */
+	eml_long_minute,
+	/** a minute ended (minlen), see display_minute */
+	eml_minute,
+	/** the time was decoded (dt, time), see display_time */
+	eml_time,
+	/** the system clock was set (bitpos), see process_setclock_result */
+	eml_setclock,
+	/** the processing of the bit is complete, see display_new_second */
+	eml_new_second,
+	/** the end offset ml->end was reached */
+	eml_end,
+	/** the end of the input was reached or the user quit */
+	eml_done
+};
+
+/** An event reported by {@link mainloop_step} */
+struct ML_event {
+	/** the kind of event, determines which fields are valid */
+	enum eML_event type;
+	/** the received bit */
+	struct GB_result bit;
+	/** the bit position */
+	int bitpos;
+	/** the length of the minute that ended */
+	int minlen;
+	/** the result of decoding the time */
+	struct DT_result dt;
+	/** the decoded time */
+	struct tm time;
+};
+
+/**
+ * The state of one main loop, which can be copied to resume the loop later
+ * from the same point.
+ */
+struct ML_state {
+	/** the bit decoder */
+	struct GB_state *gb;
+	/** the time decoder */
+	struct DT_state dt;
+	/** the current time */
+	struct tm curtime;
+	/** the user input */
+	struct ML_result mlr;
+	/** the length of the current minute, -1 if it is too long */
+	int minlen;
+	/** the current and previous bit position */
+	int bitpos, old_bitpos;
+	/** the initialization state, see {@link decode_time} */
+	unsigned init_min;
+	/** the previous minute was too long */
+	bool was_toolong;
+	/** a minute was decoded in the last iteration */
+	bool minute_done;
+	/** the minute started by the current bit is valid, see setclock_ok */
+	bool minute_ok;
+	/** the number of consecutive minutes accepted by setclock_ok */
+	unsigned ok_minutes;
+	/**
+	 * sampling was suspended before and the first complete minute after
+	 * waking up did not fail, see ML_result.sleep_minutes
+	 */
+	bool slept;
+	/** the next minute is the partial one after waking up */
+	bool woken;
+	/** the end of the input was reached or the user quit */
+	bool done;
+	/**
+	 * stop at the first minute boundary at or after this offset in the log
+	 * file (see {@link get_file_pos}), 0 to only stop when done
+	 */
+	size_t end;
+	/**
+	 * the non-blocking callback to obtain a bit from gb for
+	 * {@link mainloop_step}, returning false if no bit is ready yet, or
+	 * NULL to use get_bit
+	 */
+	bool (*poll_bit)(struct GB_state *, struct GB_result *);
+	/** the blocking callback to obtain a bit, used if poll_bit is NULL */
+	struct GB_result (*get_bit)(struct GB_state *);
+	/** the position of {@link mainloop_step} in the loop */
+	int stage;
+	/** the current pass of the minute check in the loop */
+	int pass;
+	/** the current bit */
+	struct GB_result bit;
+	/** the result of decoding the last minute */
+	struct DT_result dt_res;
+};
+
+/**
+ * Initialize the state of a main loop.
+ *
+ * @param ml The state to initialize.
+ * @param gb The bit decoder to use.
+ * @param logfilename The name of the log file, see {@link mainloop}.
+ */
+void mainloop_init(struct ML_state *ml, struct GB_state *gb,
+    char *logfilename);
+
+/**
+ * Perform the next step of the main loop without blocking if ml->poll_bit
+ * is set, for use in an event loop. Each call reports at most one event,
+ * the callbacks of {@link mainloop} map to these events. Handling user input
+ * like process_input is left to the caller, as is cleaning up the bit
+ * decoder.
+ *
+ * @param ml The state of the main loop, with poll_bit or get_bit set.
+ * @param ev Set to the event.
+ * @return The type of the event, {@link eml_none} if ml->poll_bit has no
+ * bit ready, {@link eml_end} or {@link eml_done} (repeatedly) at the end.
+ */
+enum eML_event mainloop_step(struct ML_state *ml, struct ML_event *ev);
+
+/**
+ * Retrieve the file descriptor to wait on after {@link mainloop_step}
+ * returned {@link eml_none}, see {@link get_live_fd}.
+ *
+ * @param ml The state of the main loop.
+ * @return The file descriptor, or -1 to only wait for
+ * {@link mainloop_timeout}.
+ */
+int mainloop_fd(struct ML_state *ml);
+
+/**
+ * Retrieve the maximum time to wait after {@link mainloop_step} returned
+ * {@link eml_none}, see {@link get_live_timeout}.
+ *
+ * @param ml The state of the main loop.
+ * @return The time in milliseconds.
+ */
+int mainloop_timeout(struct ML_state *ml);
+
+/**
+ * Reentrant version of {@link mainloop}, which runs until the end of the
+ * input, until the user quits or until ml->end is reached. The bit decoder
+ * is not cleaned up afterwards. This is a loop around
+ * {@link mainloop_step} which calls the callbacks for the events.
+ *
+ * @param ml The state of the main loop.
+ * @param get_bit The callback to obtain a bit from ml->gb, or NULL to use
+ * ml->poll_bit and wait for it using poll().
+ */
+void mainloop_r(struct ML_state *ml,
+    struct GB_result (*get_bit)(struct GB_state *),
+    void (*display_bit)(struct GB_result, int),
+    void (*display_long_minute)(void),
+    void (*display_minute)(int),
+    void (*display_new_second)(void),
+    void (*display_time)(struct DT_result, struct tm),
+    struct ML_result (*process_setclock_result)(struct ML_result, int),
+    struct ML_result (*process_input)(struct ML_result, int),
+    struct ML_result (*post_process_input)(struct ML_result, int));
+
 #endif
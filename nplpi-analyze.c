@@ -2,108 +2,178 @@
 // SPDX-License-Identifier: BSD-2-Clause
 
 #include "calendar.h"
+#include "capture.h"
 #include "decode_time.h"
 #include "input.h"
 #include "mainloop.h"
+#include "setclock.h"
 
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sysexits.h>
 #include <time.h>
+#include <unistd.h>
+
+/* Number of bytes of the log file per chunk in parallel mode. */
+#define CHUNK_LEN (1 << 20)
+
+/* The number of chunks decoded ahead of the output, per worker. */
+#define CHUNK_AHEAD 4
+
+/*
+ * The output and the bit decoder of the current thread, which are stdout and
+ * the process-wide decoder unless decoding in parallel.
+ */
+static __thread FILE *out;
+static __thread struct GB_state *decoder;
+
+/* The counters of a period in the quality report, see report(). */
+enum eQ_count {
+	q_bits, q_good, q_transmit, q_receive, q_random, q_none, q_bad_io,
+	q_freq_resets, q_bitlen_resets, q_minutes, q_valid, q_long, q_short,
+	q_minute_parity, q_minute_bcd, q_hour_parity, q_hour_bcd,
+	q_mday_parity, q_mday_bcd, q_wday_parity, q_wday_bcd,
+	q_month_parity, q_month_bcd, q_year_parity, q_year_bcd, q_jumps,
+	Q_COUNT
+};
+
+/* The names of the counters in the quality report. */
+static const char * const q_names[Q_COUNT] = {
+	"bits", "good_bits", "transmit", "receive", "random", "no_bit",
+	"bad_io", "freq_resets", "bitlen_resets", "minutes", "valid_minutes",
+	"long_minutes", "short_minutes", "minute_parity", "minute_bcd",
+	"hour_parity", "hour_bcd", "mday_parity", "mday_bcd", "wday_parity",
+	"wday_bcd", "month_parity", "month_bcd", "year_parity", "year_bcd",
+	"jumps"
+};
+
+/* The reception figures of one hour or day. */
+struct period {
+	char start[32];         /* in UTC, or "unknown" */
+	unsigned long long n[Q_COUNT];
+};
+
+/* A part of the log file, decoded by a worker in parallel mode. */
+struct chunk {
+	struct ML_state ml;     /* state at the start of the chunk */
+	char *buf;              /* the output */
+	size_t len;
+	bool done;
+};
+
+/* The chunks, which are queued in order by main() only. */
+static struct {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct chunk **chunk;
+	unsigned count, size;   /* queued, allocated */
+	unsigned next;          /* next chunk to decode */
+	bool finished;          /* all chunks are queued */
+} pool = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER
+};
 
 static void
 display_bit(struct GB_result bit, int bitpos)
 {
 	if (is_space_bit(bitpos)) {
-		printf(" ");
+		fprintf(out, " ");
 	}
 	if (bit.hwstat == ehw_receive) {
-		printf("r");
+		fprintf(out, "r");
 	} else if (bit.hwstat == ehw_transmit) {
-		printf("x");
+		fprintf(out, "x");
 	} else if (bit.hwstat == ehw_random) {
-		printf("#");
+		fprintf(out, "#");
 	} else if (bit.bitval == ebv_none) {
-		printf("_");
+		fprintf(out, "_");
 	} else {
-		printf("%i", get_buffer()[bitpos]);
+		fprintf(out, "%i", get_buffer_r(decoder)[bitpos]);
 	}
 }
 
 static void
 display_time(struct DT_result dt, struct tm time)
 {
-	printf("%s %04d-%02d-%02d %s %02d:%02d\n",
+	fprintf(out, "%s %04d-%02d-%02d %s %02d:%02d\n",
 	    time.tm_isdst == 1 ? "summer" : time.tm_isdst == 0 ? "winter" :
 	    "?     ",
 	    time.tm_year, time.tm_mon, time.tm_mday, weekday[time.tm_wday],
 	    time.tm_hour, time.tm_min);
 	if (dt.minute_length == emin_long) {
-		printf("Minute too long\n");
+		fprintf(out, "Minute too long\n");
 	} else if (dt.minute_length == emin_short) {
-		printf("Minute too short\n");
+		fprintf(out, "Minute too short\n");
 	}
 	if (dt.dst_status == eDST_jump) {
-		printf("Time offset jump (ignored)\n");
+		fprintf(out, "Time offset jump (ignored)\n");
 	} else if (dt.dst_status == eDST_done) {
-		printf("Time offset changed\n");
+		fprintf(out, "Time offset changed\n");
 	}
 	if (dt.minute_status == eval_parity) {
-		printf("Minute parity error\n");
+		fprintf(out, "Minute parity error\n");
 	} else if (dt.minute_status == eval_bcd) {
-		printf("Minute value error\n");
+		fprintf(out, "Minute value error\n");
 	} else if (dt.minute_status == eval_jump) {
-		printf("Minute value jump\n");
+		fprintf(out, "Minute value jump\n");
 	}
 	if (dt.hour_status == eval_parity) {
-		printf("Hour parity error\n");
+		fprintf(out, "Hour parity error\n");
 	} else if (dt.hour_status == eval_bcd) {
-		printf("Hour value error\n");
+		fprintf(out, "Hour value error\n");
 	} else if (dt.hour_status == eval_jump) {
-		printf("Hour value jump\n");
+		fprintf(out, "Hour value jump\n");
 	}
 	if (dt.mday_status == eval_parity) {
-		printf("Date parity error\n");
+		fprintf(out, "Date parity error\n");
 	}
 	if (dt.wday_status == eval_bcd) {
-		printf("Day-of-week value error\n");
+		fprintf(out, "Day-of-week value error\n");
 	} else if (dt.wday_status == eval_jump) {
-		printf("Day-of-week value jump\n");
+		fprintf(out, "Day-of-week value jump\n");
 	}
 	if (dt.mday_status == eval_bcd) {
-		printf("Day-of-month value error\n");
+		fprintf(out, "Day-of-month value error\n");
 	} else if (dt.mday_status == eval_jump) {
-		printf("Day-of-month value jump\n");
+		fprintf(out, "Day-of-month value jump\n");
 	}
 	if (dt.month_status == eval_bcd) {
-		printf("Month value error\n");
+		fprintf(out, "Month value error\n");
 	} else if (dt.month_status == eval_jump) {
-		printf("Month value jump\n");
+		fprintf(out, "Month value jump\n");
 	}
 	if (dt.year_status == eval_bcd) {
-		printf("Year value error\n");
+		fprintf(out, "Year value error\n");
 	} else if (dt.year_status == eval_jump) {
-		printf("Year value jump\n");
+		fprintf(out, "Year value jump\n");
 	}
 	if (!dt.bit0_ok) {
-		printf("Minute marker error\n");
+		fprintf(out, "Minute marker error\n");
+	}
+	if (dt.soft_fix) {
+		fprintf(out, "Time recovered from previous minutes\n");
 	}
 	if (dt.dst_announce) {
-		printf("Time offset change announced\n");
+		fprintf(out, "Time offset change announced\n");
 	}
 	if (dt.leapsecond_status == els_done) {
-		printf("Leap second processed\n");
+		fprintf(out, "Leap second processed\n");
 	} else if (dt.leapsecond_status == els_one) {
-		printf("Leap second processed with value 1 instead of 0\n");
+		fprintf(out,
+		    "Leap second processed with value 1 instead of 0\n");
 	}
-	printf("\n");
+	fprintf(out, "\n");
 }
 
 static void
 display_long_minute(void)
 {
-	printf(" L ");
+	fprintf(out, " L ");
 }
 
 static void
@@ -111,38 +181,557 @@ display_minute(int minlen)
 {
 	int cutoff;
 
-	cutoff = get_cutoff();
-	printf(" (%u) %i ", get_acc_minlen(), minlen);
+	cutoff = get_cutoff_r(decoder);
+	fprintf(out, " (%u) %i ", get_acc_minlen_r(decoder), minlen);
 	if (cutoff == -1) {
-		printf("?\n");
+		fprintf(out, "?\n");
+	} else {
+		fprintf(out, "%6.4f\n", cutoff / 1e4);
+	}
+}
+
+static void
+count_bit(struct period *p, struct GB_result bit, struct bitinfo bi)
+{
+	if (bit.skip || bit.newline) {
+		return;
+	}
+	p->n[q_bits]++;
+	if (bit.bad_io) {
+		p->n[q_bad_io]++;
+	} else if (bit.hwstat == ehw_receive) {
+		p->n[q_receive]++;
+	} else if (bit.hwstat == ehw_transmit) {
+		p->n[q_transmit]++;
+	} else if (bit.hwstat == ehw_random) {
+		p->n[q_random]++;
+	} else if (bit.bitval == ebv_none) {
+		p->n[q_none]++;
+	} else {
+		p->n[q_good]++;
+	}
+	if (bi.freq_reset) {
+		p->n[q_freq_resets]++;
+	}
+	if (bi.bitlen_reset) {
+		p->n[q_bitlen_resets]++;
+	}
+}
+
+/* Count a parity (at q) or BCD (at q + 1) error or a jump of a field. */
+static void
+count_field(struct period *p, enum eDT_tval status, enum eQ_count q)
+{
+	if (status == eval_parity) {
+		p->n[q]++;
+	} else if (status == eval_bcd) {
+		p->n[q + 1]++;
+	} else if (status == eval_jump) {
+		p->n[q_jumps]++;
+	}
+}
+
+static void
+count_minute(struct period *p, struct DT_result dt, bool valid)
+{
+	p->n[q_minutes]++;
+	if (valid) {
+		p->n[q_valid]++;
+	}
+	if (dt.minute_length == emin_long) {
+		p->n[q_long]++;
+	} else if (dt.minute_length == emin_short) {
+		p->n[q_short]++;
+	}
+	count_field(p, dt.minute_status, q_minute_parity);
+	count_field(p, dt.hour_status, q_hour_parity);
+	count_field(p, dt.mday_status, q_mday_parity);
+	count_field(p, dt.wday_status, q_wday_parity);
+	count_field(p, dt.month_status, q_month_parity);
+	count_field(p, dt.year_status, q_year_parity);
+	if (dt.dst_status == eDST_jump) {
+		p->n[q_jumps]++;
+	}
+}
+
+/* Write the figures of a period as a CSV line or a JSON object. */
+static void
+print_period(const char *kind, const struct period *p, bool json)
+{
+	double good = p->n[q_bits] > 0 ?
+	    (double)p->n[q_good] / p->n[q_bits] : 0;
+	double valid = p->n[q_minutes] > 0 ?
+	    (double)p->n[q_valid] / p->n[q_minutes] : 0;
+	unsigned i;
+
+	if (json) {
+		printf("{\"period\":\"%s\",\"start\":\"%s\"", kind,
+		    p->start);
 	} else {
-		printf("%6.4f\n", cutoff / 1e4);
+		printf("%s,%s", kind, p->start);
+	}
+	for (i = 0; i < Q_COUNT; i++) {
+		if (json) {
+			printf(",\"%s\":%llu", q_names[i], p->n[i]);
+		} else {
+			printf(",%llu", p->n[i]);
+		}
+	}
+	if (json) {
+		printf(",\"good_fraction\":%.4f,\"valid_fraction\":%.4f}\n",
+		    good, valid);
+	} else {
+		printf(",%.4f,%.4f\n", good, valid);
 	}
 }
 
+/* The period named next follows the period named cur, see add_minute_to(). */
+static bool
+later(const char *next, const char *cur)
+{
+	if (cur[0] == '\0' || strcmp(cur, "unknown") == 0) {
+		return strcmp(next, cur) != 0;
+	}
+	return strcmp(next, cur) > 0;
+}
+
+/*
+ * Add the figures of a minute to its hour and day, after writing out the
+ * hour and the day before if it is a new one. The minute starts at the given
+ * time in UTC, or belongs to the current hour and day if start is NULL.
+ * Periods only move forward, so each of them is written once.
+ */
+static void
+add_minute_to(struct period *hour, struct period *day,
+    const struct period *minute, const struct tm *start, bool json)
+{
+	char h[sizeof(hour->start)], d[sizeof(day->start)];
+	unsigned i;
+
+	if (start != NULL) {
+		(void)snprintf(d, sizeof(d), "%04d-%02d-%02d",
+		    start->tm_year, start->tm_mon, start->tm_mday);
+		(void)snprintf(h, sizeof(h), "%04d-%02d-%02dT%02d",
+		    start->tm_year, start->tm_mon, start->tm_mday,
+		    start->tm_hour);
+	} else if (hour->start[0] != '\0') {
+		strcpy(h, hour->start);
+		strcpy(d, day->start);
+	} else {
+		strcpy(h, "unknown");
+		strcpy(d, "unknown");
+	}
+	if (later(h, hour->start)) {
+		if (hour->start[0] != '\0') {
+			print_period("hour", hour, json);
+		}
+		memset(hour, 0, sizeof(*hour));
+		strcpy(hour->start, h);
+	}
+	if (later(d, day->start)) {
+		if (day->start[0] != '\0') {
+			print_period("day", day, json);
+		}
+		memset(day, 0, sizeof(*day));
+		strcpy(day->start, d);
+	}
+	for (i = 0; i < Q_COUNT; i++) {
+		hour->n[i] += minute->n[i];
+		day->n[i] += minute->n[i];
+	}
+}
+
+/*
+ * Write the reception quality of each hour and each day in one pass over
+ * the input, without displaying anything else. A minute belongs to the
+ * hour in UTC in which it started. Only minutes accepted by setclock_ok()
+ * are trusted for this, the start of any other minute is estimated from
+ * the last accepted one and the length of the minutes since then. Bits
+ * before the first accepted minute are counted as "unknown".
+ */
+static void
+report(struct GB_result (*get_bit)(struct GB_state *), bool soft, bool json)
+{
+	struct period hour, day, minute;
+	struct ML_state ml;
+	struct ML_event ev;
+	struct tm last, start;
+	unsigned long long since = 0;   /* ms since the end of last */
+	bool have_last = false;
+
+	memset(&hour, 0, sizeof(hour));
+	memset(&day, 0, sizeof(day));
+	memset(&minute, 0, sizeof(minute));
+	mainloop_init(&ml, decoder, NULL);
+	ml.mlr.soft_decode = soft;
+	ml.get_bit = get_bit;
+	if (!json) {
+		unsigned i;
+
+		printf("period,start");
+		for (i = 0; i < Q_COUNT; i++) {
+			printf(",%s", q_names[i]);
+		}
+		printf(",good_fraction,valid_fraction\n");
+	}
+	while (mainloop_step(&ml, &ev) != eml_done) {
+		bool valid;
+
+		if (ev.type == eml_bit) {
+			count_bit(&minute, ev.bit, get_bitinfo_r(ml.gb));
+			continue;
+		} else if (ev.type != eml_time) {
+			continue;
+		}
+		valid = setclock_ok(ml.init_min, ev.dt, ml.bit);
+		count_minute(&minute, ev.dt, valid);
+		since += get_acc_minlen_r(ml.gb);
+		if (valid) {
+			last = get_utctime(ev.time);
+			since = 0;
+			have_last = true;
+			start = substract_minute(last, false);
+		} else if (have_last) {
+			start = add_minutes(last,
+			    (int)((since + 30000) / 60000) - 1, false);
+		}
+		add_minute_to(&hour, &day, &minute, have_last ? &start : NULL,
+		    json);
+		memset(&minute, 0, sizeof(minute));
+	}
+	/* the bits after the last minute marker */
+	if (minute.n[q_bits] > 0 || hour.start[0] == '\0') {
+		add_minute_to(&hour, &day, &minute, NULL, json);
+	}
+	print_period("hour", &hour, json);
+	print_period("day", &day, json);
+	cleanup();
+}
+
+/* Check if the file is a capture file made in live mode. */
+static bool
+is_capture(const char * const filename)
+{
+	unsigned char hdr[CAPTURE_HDRLEN];
+	size_t len = 0;
+	FILE *f;
+
+	f = fopen(filename, "rb");
+	if (f != NULL) {
+		len = fread(hdr, 1, sizeof(hdr), f);
+		(void)fclose(f);
+	}
+	return capture_detect(hdr, len);
+}
+
+/* Display callbacks for finding the state at the start of each chunk. */
+static void
+ignore_bit(struct GB_result bit, int bitpos)
+{
+	(void)bit;
+	(void)bitpos;
+}
+
+static void
+ignore_long_minute(void)
+{
+}
+
+static void
+ignore_minute(int minlen)
+{
+	(void)minlen;
+}
+
+static void
+ignore_time(struct DT_result dt, struct tm time)
+{
+	(void)dt;
+	(void)time;
+}
+
+/* Decode chunks into memory until all chunks are decoded. */
+static void *
+worker(void *arg)
+{
+	(void)arg;
+	(void)pthread_mutex_lock(&pool.mutex);
+	for (;;) {
+		struct chunk *c;
+
+		while (pool.next == pool.count && !pool.finished) {
+			(void)pthread_cond_wait(&pool.cond, &pool.mutex);
+		}
+		if (pool.next == pool.count) {
+			break;
+		}
+		c = pool.chunk[pool.next++];
+		(void)pthread_mutex_unlock(&pool.mutex);
+
+		out = open_memstream(&c->buf, &c->len);
+		if (out != NULL) {
+			decoder = c->ml.gb;
+			mainloop_r(&c->ml, get_bit_file_r, display_bit,
+			    display_long_minute, display_minute, NULL,
+			    display_time, NULL, NULL, NULL);
+			if (fclose(out) == EOF) {
+				perror("fclose(chunk)");
+			}
+		} else {
+			perror("open_memstream");
+		}
+		GB_free(c->ml.gb);
+
+		(void)pthread_mutex_lock(&pool.mutex);
+		c->done = true;
+		(void)pthread_cond_broadcast(&pool.cond);
+	}
+	(void)pthread_mutex_unlock(&pool.mutex);
+	return NULL;
+}
+
+/* Write the decoded chunks in order until at most ahead chunks are left. */
+static void
+write_chunks(unsigned *written, unsigned ahead)
+{
+	(void)pthread_mutex_lock(&pool.mutex);
+	while (pool.count - *written > ahead) {
+		struct chunk *c = pool.chunk[*written];
+
+		while (!c->done) {
+			(void)pthread_cond_wait(&pool.cond, &pool.mutex);
+		}
+		pool.chunk[(*written)++] = NULL;
+		(void)pthread_mutex_unlock(&pool.mutex);
+		if (c->buf != NULL) {
+			(void)fwrite(c->buf, 1, c->len, stdout);
+		}
+		free(c->buf);
+		free(c);
+		(void)pthread_mutex_lock(&pool.mutex);
+	}
+	(void)pthread_mutex_unlock(&pool.mutex);
+}
+
+static int
+queue_chunk(struct chunk *c)
+{
+	int res = 0;
+
+	(void)pthread_mutex_lock(&pool.mutex);
+	if (pool.count == pool.size) {
+		struct chunk **nchunk;
+
+		nchunk = realloc(pool.chunk,
+		    (pool.size + 64) * sizeof(*pool.chunk));
+		if (nchunk != NULL) {
+			pool.chunk = nchunk;
+			pool.size += 64;
+		} else {
+			res = errno;
+		}
+	}
+	if (res == 0) {
+		pool.chunk[pool.count++] = c;
+		(void)pthread_cond_broadcast(&pool.cond);
+	}
+	(void)pthread_mutex_unlock(&pool.mutex);
+	return res;
+}
+
+/*
+ * Decode the log file with the given number of worker threads. A quick pass
+ * without any output finds the complete state of the decoder at a minute
+ * boundary every CHUNK_LEN bytes, from which the workers decode each chunk
+ * into memory. The output is the same as when decoding sequentially.
+ */
+static int
+analyze_parallel(struct GB_state *s, unsigned jobs, bool soft)
+{
+	struct ML_state ml;
+	pthread_t *thread;
+	unsigned i, n, written = 0;
+	int res = 0;
+
+	thread = calloc(jobs, sizeof(*thread));
+	if (thread == NULL) {
+		perror("calloc(threads)");
+		return EX_OSERR;
+	}
+	for (n = 0; n < jobs; n++) {
+		if (pthread_create(&thread[n], NULL, worker, NULL) != 0) {
+			break;
+		}
+	}
+	if (n == 0) {
+		fprintf(stderr, "Could not start any worker thread\n");
+		free(thread);
+		return EX_OSERR;
+	}
+
+	mainloop_init(&ml, s, NULL);
+	ml.mlr.soft_decode = soft;
+	while (!ml.done) {
+		struct chunk *c;
+
+		c = calloc(1, sizeof(*c));
+		if (c == NULL) {
+			perror("calloc(chunk)");
+			res = EX_OSERR;
+			break;
+		}
+		c->ml = ml;
+		c->ml.gb = GB_dup(s);
+		if (c->ml.gb == NULL) {
+			perror("GB_dup");
+			free(c);
+			res = EX_OSERR;
+			break;
+		}
+		ml.end = get_file_pos_r(s) + CHUNK_LEN;
+		mainloop_r(&ml, get_bit_file_r, ignore_bit,
+		    ignore_long_minute, ignore_minute, NULL, ignore_time, NULL,
+		    NULL, NULL);
+		c->ml.end = ml.done ? 0 : ml.end;
+		res = queue_chunk(c);
+		if (res != 0) {
+			perror("realloc(chunks)");
+			GB_free(c->ml.gb);
+			free(c);
+			res = EX_OSERR;
+			break;
+		}
+		write_chunks(&written, CHUNK_AHEAD * n);
+	}
+
+	(void)pthread_mutex_lock(&pool.mutex);
+	pool.finished = true;
+	(void)pthread_cond_broadcast(&pool.cond);
+	(void)pthread_mutex_unlock(&pool.mutex);
+	write_chunks(&written, 0);
+	for (i = 0; i < n; i++) {
+		(void)pthread_join(thread[i], NULL);
+	}
+	free(thread);
+	free(pool.chunk);
+	GB_free(s);
+	return res;
+}
+
+/* Decode the input of the default bit decoder. */
+static void
+analyze(struct GB_result (*get_bit)(struct GB_state *), bool soft)
+{
+	struct ML_state ml;
+
+	mainloop_init(&ml, decoder, NULL);
+	ml.mlr.soft_decode = soft;
+	mainloop_r(&ml, get_bit, display_bit, display_long_minute,
+	    display_minute, NULL, display_time, NULL, NULL, NULL);
+	cleanup();
+}
+
+static void
+usage(const char *name)
+{
+	printf("usage: %s [-j jobs] [-m minute] [-q csv|json] [-s] infile\n",
+	    name);
+}
+
 int
 main(int argc, char *argv[])
 {
-	int res;
+	int ch, res;
 	char *logfilename;
+	struct GB_state *s;
+	unsigned jobs = 1, minute = 0;
+	bool soft = false, quality = false, json = false;
 
-	if (argc == 2) {
-		logfilename = strdup(argv[1]);
+	while ((ch = getopt(argc, argv, "j:m:q:s")) != -1) {
+		switch (ch) {
+		case 'j':
+			jobs = (unsigned)strtoul(optarg, NULL, 10);
+			break;
+		case 'm':
+			minute = (unsigned)strtoul(optarg, NULL, 10);
+			break;
+		case 'q':
+			quality = true;
+			json = strcmp(optarg, "json") == 0;
+			if (!json && strcmp(optarg, "csv") != 0) {
+				usage(argv[0]);
+				return EX_USAGE;
+			}
+			break;
+		case 's':
+			soft = true;
+			break;
+		default:
+			usage(argv[0]);
+			return EX_USAGE;
+		}
+	}
+	if (argc - optind == 1) {
+		logfilename = strdup(argv[optind]);
 	} else {
-		printf("usage: %s infile\n", argv[0]);
+		usage(argv[0]);
 		return EX_USAGE;
 	}
+	if (quality) {
+		/* a single pass is fast enough without any output */
+		jobs = 1;
+	}
+	out = stdout;
+	decoder = GB_default();
+
+	if (is_capture(logfilename)) {
+		/* decode the raw samples, as fast as possible */
+		res = set_mode_replay(logfilename);
+		if (res != 0) {
+			cleanup();
+			free(logfilename);
+			return res;
+		}
+		if (quality) {
+			report(get_bit_live_r, soft, json);
+		} else {
+			analyze(get_bit_live_r, soft);
+		}
+		free(logfilename);
+		return res;
+	}
 
-	res = set_mode_file(logfilename);
+	s = jobs > 1 ? GB_new() : GB_default();
+	if (s == NULL) {
+		perror("GB_new");
+		free(logfilename);
+		return EX_OSERR;
+	}
+	res = set_mode_file_r(s, logfilename);
+	if (res == 0 && minute > 0) {
+		res = seek_minute_r(s, minute);
+		if (res != 0) {
+			fprintf(stderr, "Minute %u not found\n", minute);
+		}
+	}
 	if (res != 0) {
 		/* something went wrong */
-		cleanup();
+		if (jobs > 1) {
+			GB_free(s);
+		} else {
+			cleanup();
+		}
 		free(logfilename);
 		return res;
 	}
 
-	mainloop(NULL, get_bit_file, display_bit, display_long_minute,
-	    display_minute, NULL, display_time, NULL, NULL, NULL);
+	if (jobs > 1) {
+		res = analyze_parallel(s, jobs, soft);
+	} else if (quality) {
+		report(get_bit_file_r, soft, json);
+	} else {
+		analyze(get_bit_file_r, soft);
+	}
 	free(logfilename);
 	return res;
 }
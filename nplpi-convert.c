@@ -0,0 +1,124 @@
+// Copyright 2019 René Ladan
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include "binlog.h"
+#include "input.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+/* Convert a binary log file to a text log file. */
+static int
+to_text(const unsigned char *buf, size_t len, const char *outfilename)
+{
+	unsigned char *text;
+	size_t textlen;
+	FILE *out;
+	int res;
+
+	res = binlog_decode(buf, len, 0, &text, &textlen);
+	if (res != 0) {
+		fprintf(stderr, "Corrupt binary log file\n");
+		return EX_DATAERR;
+	}
+	out = fopen(outfilename, "w");
+	if (out == NULL) {
+		perror("fopen(outfile)");
+		free(text);
+		return EX_CANTCREAT;
+	}
+	if (fwrite(text, 1, textlen, out) != textlen) {
+		perror("fwrite(outfile)");
+		res = EX_IOERR;
+	}
+	free(text);
+	if (fclose(out) == EOF) {
+		perror("fclose(outfile)");
+		res = EX_IOERR;
+	}
+	return res;
+}
+
+/* Convert the log file opened by set_mode_file() to a binary log file. */
+static int
+to_binary(const char *outfilename)
+{
+	struct binlog bl;
+	unsigned acc;
+	int ch, res;
+
+	/* always start a new file */
+	if (unlink(outfilename) == -1 && errno != ENOENT) {
+		perror("unlink(outfile)");
+		return EX_CANTCREAT;
+	}
+	res = binlog_open(&bl, outfilename);
+	if (res != 0) {
+		fprintf(stderr, "binlog_open(outfile): %s\n", strerror(res));
+		return EX_CANTCREAT;
+	}
+	do {
+		ch = get_log_symbol(&acc);
+		binlog_put(&bl, ch, acc);
+	} while (ch != EOF && ch != BINLOG_END);
+	res = binlog_close(&bl);
+	if (res != 0) {
+		fprintf(stderr, "binlog_close(outfile): %s\n", strerror(res));
+		return EX_IOERR;
+	}
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned char *buf;
+	long size;
+	FILE *in;
+	int res;
+
+	if (argc != 3) {
+		printf("usage: %s infile outfile\n", argv[0]);
+		return EX_USAGE;
+	}
+
+	in = fopen(argv[1], "rb");
+	if (in == NULL) {
+		perror("fopen(infile)");
+		return EX_NOINPUT;
+	}
+	if (fseek(in, 0, SEEK_END) == -1 || (size = ftell(in)) == -1) {
+		perror("ftell(infile)");
+		(void)fclose(in);
+		return EX_NOINPUT;
+	}
+	rewind(in);
+	buf = malloc(size > 0 ? (size_t)size : 1);
+	if (buf == NULL || fread(buf, 1, (size_t)size, in) != (size_t)size) {
+		perror("fread(infile)");
+		free(buf);
+		(void)fclose(in);
+		return EX_IOERR;
+	}
+	(void)fclose(in);
+
+	if (binlog_detect(buf, (size_t)size)) {
+		res = to_text(buf, (size_t)size, argv[2]);
+		free(buf);
+		return res;
+	}
+	free(buf);
+
+	res = set_mode_file(argv[1]);
+	if (res != 0) {
+		cleanup();
+		return EX_NOINPUT;
+	}
+	res = to_binary(argv[2]);
+	cleanup();
+	return res;
+}
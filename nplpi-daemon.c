@@ -0,0 +1,339 @@
+// Copyright 2019 René Ladan
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include "decode_time.h"
+#include "input.h"
+#include "mainloop.h"
+#include "refclock.h"
+#include "setclock.h"
+
+#include "json_object.h"
+#include "json_util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/*
+ * Receive the time like nplpi, without a terminal. Every client connecting
+ * to the status socket gets one line of JSON with the current state of the
+ * decoder, after which the connection is closed, e.g.:
+ *
+ *   nc -U /var/run/nplpi.sock
+ *
+ * Enumerations are reported with their numeric values from input.h,
+ * decode_time.h and setclock.h, settime_result is -1 until the first attempt
+ * to set the time.
+ *
+ * With "sleepminutes" set, sampling is suspended for that many minutes once
+ * "sleepafter" (default 3) consecutive minutes were valid, and resumed just
+ * before a minute marker to check a single minute against the predicted
+ * time, see ML_result.sleep_minutes.
+ */
+
+#define STATUSLEN 4096
+
+static volatile sig_atomic_t running = 1;
+static int settime_result = -1; /* of the last minute, -1 for none yet */
+
+/* what the decoder did since the start */
+static struct {
+	unsigned long bits;
+	unsigned long minutes;
+	unsigned long valid_minutes;
+	unsigned long long_minutes;
+	unsigned long bad_io;
+	unsigned long hw_errors;
+	unsigned long freq_resets;
+	unsigned long bitlen_resets;
+} counters;
+
+static void
+sig_handler(/*@unused@*/ int sig)
+{
+	running = 0;
+}
+
+static int
+open_status_socket(const char *path)
+{
+	struct sockaddr_un sun;
+	int fd;
+
+	if (strlen(path) >= sizeof(sun.sun_path)) {
+		fprintf(stderr, "Status socket name too long\n");
+		return -1;
+	}
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	strcpy(sun.sun_path, path);
+	(void)unlink(path);
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1) {
+		perror("socket(statussocket)");
+		return -1;
+	}
+	if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) == -1 ||
+	    listen(fd, 8) == -1 ||
+	    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == -1) {
+		perror("bind(statussocket)");
+		(void)close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* Format the state of the decoder as a single line of JSON. */
+static int
+format_status(char *buf, size_t len, struct ML_state *ml, bool have_time,
+    time_t start)
+{
+	struct bitinfo bi = get_bitinfo_r(ml->gb);
+	struct hardware hw = get_hardware_parameters_r(ml->gb);
+	struct DT_result dt = ml->dt_res;
+	struct tm t = ml->curtime;
+	struct sample_stats st = get_sample_stats_r(ml->gb);
+	char timebuf[32] = "null", latbuf[SS_BUCKETS * 21 + 3];
+	unsigned i;
+	int pos = 0;
+
+	for (i = 0; i < SS_BUCKETS; i++) {
+		pos += snprintf(latbuf + pos, sizeof(latbuf) - (size_t)pos,
+		    "%c%llu", i == 0 ? '[' : ',', st.latency[i]);
+	}
+	(void)snprintf(latbuf + pos, sizeof(latbuf) - (size_t)pos, "]");
+	if (have_time) {
+		(void)snprintf(timebuf, sizeof(timebuf),
+		    "\"%04d-%02d-%02dT%02d:%02d\"", t.tm_year, t.tm_mon,
+		    t.tm_mday, t.tm_hour, t.tm_min);
+	}
+	return snprintf(buf, len, "{\"uptime\":%lld,"
+	    "\"bit\":{\"bitpos\":%d,\"bitval\":%d,\"marker\":%d,"
+	    "\"hwstat\":%d,\"bad_io\":%s,\"confidence\":%u},"
+	    "\"bitinfo\":{\"freq\":%u,\"realfreq\":%llu,\"bit0\":%llu,"
+	    "\"bit5x\":%llu,\"tlow\":%d,\"tlast0\":%d,\"t\":%u,"
+	    "\"freq_reset\":%s,\"bitlen_reset\":%s},"
+	    "\"time\":%s,\"isdst\":%d,"
+	    "\"dt\":{\"bit0_ok\":%s,\"bit52_ok\":%s,\"bit59_ok\":%s,"
+	    "\"minute_length\":%d,\"minute\":%d,\"hour\":%d,\"mday\":%d,"
+	    "\"wday\":%d,\"month\":%d,\"year\":%d,\"dst\":%d,"
+	    "\"leapsecond\":%d,\"dst_announce\":%s,\"marker\":%d,"
+	    "\"soft_fix\":%s},"
+	    "\"settime\":%s,\"settime_result\":%d,\"asleep\":%s,"
+	    "\"counters\":{\"bits\":%lu,\"minutes\":%lu,"
+	    "\"valid_minutes\":%lu,\"long_minutes\":%lu,\"bad_io\":%lu,"
+	    "\"hw_errors\":%lu,\"freq_resets\":%lu,\"bitlen_resets\":%lu},"
+	    "\"sampling\":{\"latency\":%s,\"overruns\":%llu,\"skipped\":%llu,"
+	    "\"lost\":%llu,\"reads\":%llu,\"read_ns\":%llu,"
+	    "\"read_max_ns\":%llu,\"minute_freq_resets\":%u,"
+	    "\"minute_bitlen_resets\":%u}}\n",
+	    (long long)(time(NULL) - start),
+	    ml->bitpos, ml->bit.bitval, ml->bit.marker, ml->bit.hwstat,
+	    ml->bit.bad_io ? "true" : "false", ml->bit.confidence,
+	    hw.freq, bi.realfreq, bi.bit0, bi.bit5x, bi.tlow, bi.tlast0, bi.t,
+	    bi.freq_reset ? "true" : "false",
+	    bi.bitlen_reset ? "true" : "false",
+	    timebuf, t.tm_isdst,
+	    dt.bit0_ok ? "true" : "false", dt.bit52_ok ? "true" : "false",
+	    dt.bit59_ok ? "true" : "false", dt.minute_length,
+	    dt.minute_status, dt.hour_status, dt.mday_status, dt.wday_status,
+	    dt.month_status, dt.year_status, dt.dst_status,
+	    dt.leapsecond_status, dt.dst_announce ? "true" : "false",
+	    dt.marker_status, dt.soft_fix ? "true" : "false",
+	    ml->mlr.settime ? "true" : "false", settime_result,
+	    get_wake_time_r(ml->gb) != -1 ? "true" : "false",
+	    counters.bits, counters.minutes, counters.valid_minutes,
+	    counters.long_minutes, counters.bad_io, counters.hw_errors,
+	    counters.freq_resets, counters.bitlen_resets,
+	    latbuf, st.overruns, st.skipped, st.lost, st.reads, st.read_ns,
+	    st.read_max_ns, st.prev_freq_resets, st.prev_bitlen_resets);
+}
+
+/* Answer all pending clients, never blocking on a slow one. */
+static void
+serve_status(int lfd, struct ML_state *ml, bool have_time, time_t start)
+{
+	char buf[STATUSLEN];
+	int fd, len;
+
+	while ((fd = accept(lfd, NULL, NULL)) != -1) {
+		len = format_status(buf, sizeof(buf), ml, have_time, start);
+		if (len > 0 && (size_t)len < sizeof(buf) &&
+		    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) != -1) {
+			/* fits in the socket buffer, so sent at once */
+			(void)send(fd, buf, (size_t)len, 0);
+		}
+		(void)close(fd);
+	}
+}
+
+static void
+count_bit(struct GB_state *gb, struct GB_result bit)
+{
+	struct bitinfo bi = get_bitinfo_r(gb);
+
+	counters.bits++;
+	if (bit.bad_io) {
+		counters.bad_io++;
+	}
+	if (bit.hwstat != ehw_ok) {
+		counters.hw_errors++;
+	}
+	if (bi.freq_reset) {
+		counters.freq_resets++;
+	}
+	if (bi.bitlen_reset) {
+		counters.bitlen_resets++;
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct json_object *config, *value;
+	struct sigaction sigact;
+	struct refclock refclock;
+	struct ML_state ml;
+	struct ML_event ev;
+	char *logfilename = NULL;
+	const char *statuspath = "/var/run/nplpi.sock";
+	bool have_time = false;
+	time_t start;
+	int lfd, res;
+
+	if (argc != 1) {
+		printf("usage: %s\n", argv[0]);
+		return EX_USAGE;
+	}
+	config = json_object_from_file(ETCDIR "/config.json");
+	if (config == NULL) {
+		return EX_NOINPUT;
+	}
+
+	mainloop_init(&ml, GB_default(), NULL);
+	ml.poll_bit = poll_bit_live_r;
+	ml.mlr.step_limit = 128;
+	ml.mlr.sleep_after = 3;
+	if (json_object_object_get_ex(config, "outlogfile", &value)) {
+		logfilename = (char *)json_object_get_string(value);
+	}
+	if (json_object_object_get_ex(config, "statussocket", &value)) {
+		statuspath = json_object_get_string(value);
+	}
+	if (json_object_object_get_ex(config, "settime", &value)) {
+		ml.mlr.settime = (bool)json_object_get_boolean(value);
+	}
+	if (json_object_object_get_ex(config, "softdecode", &value)) {
+		ml.mlr.soft_decode = (bool)json_object_get_boolean(value);
+	}
+	if (json_object_object_get_ex(config, "quickstart", &value)) {
+		ml.mlr.quick_start = (bool)json_object_get_boolean(value);
+	}
+	if (json_object_object_get_ex(config, "quickwindow", &value)) {
+		ml.mlr.quick_window = (unsigned)json_object_get_int(value);
+	}
+	if (json_object_object_get_ex(config, "discipline", &value)) {
+		ml.mlr.discipline = (bool)json_object_get_boolean(value);
+	}
+	if (json_object_object_get_ex(config, "steplimit", &value)) {
+		ml.mlr.step_limit = (unsigned)json_object_get_int(value);
+	}
+	if (json_object_object_get_ex(config, "sleepminutes", &value)) {
+		ml.mlr.sleep_minutes = (unsigned)json_object_get_int(value);
+	}
+	if (json_object_object_get_ex(config, "sleepafter", &value)) {
+		ml.mlr.sleep_after = (unsigned)json_object_get_int(value);
+	}
+	res = refclock_open_config(&refclock, config);
+	if (res != 0) {
+		refclock_close(&refclock);
+		return res;
+	}
+	ml.mlr.refclock = refclock_active(&refclock) ? &refclock : NULL;
+	res = set_log_policy(config);
+	if (res == 0 && logfilename != NULL && strlen(logfilename) != 0) {
+		res = append_logfile(logfilename);
+		if (res != 0) {
+			perror("fopen(logfile)");
+		}
+	}
+	if (res == 0) {
+		res = set_mode_live(config);
+	}
+	if (res != 0) {
+		refclock_close(&refclock);
+		cleanup();
+		return res;
+	}
+	lfd = open_status_socket(statuspath);
+	if (lfd == -1) {
+		refclock_close(&refclock);
+		cleanup();
+		return EX_CANTCREAT;
+	}
+
+	sigact.sa_handler = sig_handler;
+	sigemptyset(&sigact.sa_mask);
+	sigact.sa_flags = 0;
+	(void)sigaction(SIGINT, &sigact, NULL);
+	(void)sigaction(SIGTERM, &sigact, NULL);
+	sigact.sa_handler = SIG_IGN;
+	(void)sigaction(SIGPIPE, &sigact, NULL);
+
+	start = time(NULL);
+	while (running && !ml.done) {
+		switch (mainloop_step(&ml, &ev)) {
+		case eml_none: {
+			struct pollfd pfd[2];
+
+			pfd[0].fd = mainloop_fd(&ml);
+			pfd[0].events = POLLIN | POLLPRI;
+			pfd[1].fd = lfd;
+			pfd[1].events = POLLIN;
+			if (poll(pfd, 2, mainloop_timeout(&ml)) == -1 &&
+			    errno != EINTR) {
+				perror("poll");
+				running = 0;
+			}
+			if (pfd[1].revents & POLLIN) {
+				serve_status(lfd, &ml, have_time, start);
+			}
+			break;
+		}
+		case eml_bit:
+			count_bit(ml.gb, ev.bit);
+			break;
+		case eml_long_minute:
+			counters.long_minutes++;
+			break;
+		case eml_time:
+			counters.minutes++;
+			if (setclock_ok(ml.init_min, ev.dt, ml.bit)) {
+				counters.valid_minutes++;
+			}
+			have_time = true;
+			break;
+		case eml_setclock:
+			settime_result = (int)ml.mlr.settime_result;
+			break;
+		default:
+			break;
+		}
+	}
+
+	(void)close(lfd);
+	(void)unlink(statuspath);
+	refclock_close(&refclock);
+	cleanup();
+	return 0;
+}
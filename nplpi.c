@@ -5,6 +5,7 @@
 #include "decode_time.h"
 #include "input.h"
 #include "mainloop.h"
+#include "refclock.h"
 #include "setclock.h"
 
 #include "json_object.h"
@@ -12,6 +13,7 @@
 
 #include <curses.h>
 #include <errno.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -22,6 +24,7 @@
 #include <sys/ioctl.h>
 
 #define MAXBUF 255
+#define RENDER_INTERVAL 100000000 /* minimum ns between screen updates */
 
 static char *logfilename;
 static int old_bitpos = -1; /* timer for statusbar inactive */
@@ -30,6 +33,30 @@ static char keybuf[MAXBUF]; /* accumulator for string input */
 static bool show_utc;       /* show time in UTC */
 static bool set_time;       /* set host time, copy from mlr in [post_]process_input() */
 static bool toosmall;       /* terminal is less than 80x25 after a KEY_RESIZE */
+static bool soft_decode;    /* recover the time from several minutes */
+static bool quick_start;    /* set the time after the first full minute */
+static unsigned quick_window; /* limit for quick_start, 0 for none */
+static bool discipline;     /* slew the time instead of stepping it */
+static unsigned step_limit = 128; /* largest offset in ms to slew */
+static struct refclock refclock; /* for ntpd or chronyd */
+
+/*
+ * The screen is only written to the terminal by the render thread, so that
+ * a slow terminal never holds up the reception. The main thread holds
+ * screen_lock while it draws to stdscr, which is all the time except while
+ * waiting for the next bit. The render thread copies stdscr under the lock,
+ * which needs no I/O, and sends the changed cells to the terminal after
+ * releasing it, holding term_lock instead. Keys are read from keywin, which
+ * is never drawn to, so that wgetch() does not refresh the screen. It can
+ * still resize the screen, so keys are only read if term_lock is free.
+ */
+static pthread_mutex_t screen_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t term_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t render_thread;
+static bool rendering;      /* the render thread is running */
+static bool render_stop;    /* request to stop the render thread */
+static bool screen_dirty;   /* stdscr changed since the last update */
+static WINDOW *keywin;      /* the window to read the keyboard from */
 
 static void
 statusbar(int bitpos, const char * const fmt, ...)
@@ -47,7 +74,6 @@ statusbar(int bitpos, const char * const fmt, ...)
 	vw_printw(stdscr, fmt, ap);
 	va_end(ap);
 	clrtoeol();
-	refresh();
 }
 
 static void
@@ -66,13 +92,75 @@ draw_keys(void)
 	mvchgat(24, 10, 1, A_NORMAL, 5, NULL); /* [L] */
 	mvchgat(24, 30, 1, A_NORMAL, 5, NULL); /* [S] */
 	mvchgat(24, 48, 1, A_NORMAL, 5, NULL); /* [u] */
-	refresh();
+}
+
+static void *
+renderer(void *arg)
+{
+	const struct timespec interval = { 0, RENDER_INTERVAL };
+
+	(void)arg;
+	for (;;) {
+		bool update;
+
+		(void)nanosleep(&interval, NULL);
+		(void)pthread_mutex_lock(&screen_lock);
+		if (render_stop) {
+			(void)pthread_mutex_unlock(&screen_lock);
+			break;
+		}
+		update = screen_dirty && !toosmall;
+		if (update) {
+			(void)wnoutrefresh(stdscr);
+			screen_dirty = false;
+		}
+		(void)pthread_mutex_unlock(&screen_lock);
+		if (update) {
+			int res;
+
+			(void)pthread_mutex_lock(&term_lock);
+			res = doupdate();
+			(void)pthread_mutex_unlock(&term_lock);
+			if (res == ERR) {
+				/* the terminal is gone, keep on receiving */
+				break;
+			}
+		}
+	}
+	return NULL;
+}
+
+static void
+stop_renderer(void)
+{
+	if (!rendering) {
+		return;
+	}
+	(void)pthread_mutex_lock(&screen_lock);
+	render_stop = true;
+	(void)pthread_mutex_unlock(&screen_lock);
+	(void)pthread_join(render_thread, NULL);
+	rendering = false;
+}
+
+/* Obtain the next bit without holding the screen lock. */
+static struct GB_result
+get_bit_unlocked(void)
+{
+	struct GB_result bit;
+
+	screen_dirty = true;
+	(void)pthread_mutex_unlock(&screen_lock);
+	bit = get_bit_live();
+	(void)pthread_mutex_lock(&screen_lock);
+	return bit;
 }
 
 static void
 client_cleanup(const char * const reason)
 {
 	/* Caller is supposed to exit the program after this */
+	stop_renderer();
 	endwin();
 	if (reason != NULL) {
 		printf("%s\n", reason);
@@ -80,6 +168,7 @@ client_cleanup(const char * const reason)
 	}
 	free(logfilename);
 	logfilename = NULL;
+	refclock_close(&refclock);
 }
 
 static void
@@ -158,7 +247,6 @@ display_bit(struct GB_result bit, int bitpos)
 	}
 
 	mvprintw(1, 29, "%10u", get_acc_minlen());
-	refresh();
 }
 
 static void
@@ -232,7 +320,6 @@ display_time(struct DT_result dt, struct tm time)
 	} else {
 		mvchgat(1, 67, 5, A_NORMAL, 8, NULL);
 	}
-	refresh();
 }
 
 static struct ML_result
@@ -245,7 +332,17 @@ process_input(struct ML_result in_ml, int bitpos)
 	int inkey;
 
 	mlr = in_ml;
-	inkey = getch();
+	mlr.soft_decode = soft_decode;
+	mlr.quick_start = quick_start;
+	mlr.quick_window = quick_window;
+	mlr.discipline = discipline;
+	mlr.step_limit = step_limit;
+	mlr.refclock = refclock_active(&refclock) ? &refclock : NULL;
+	if (pthread_mutex_trylock(&term_lock) != 0) {
+		/* the terminal is being updated, read the keys next time */
+		return mlr;
+	}
+	inkey = wgetch(keywin);
 	if (input_mode == 0 && inkey != ERR) {
 		switch (inkey) {
 		case 'Q':
@@ -262,7 +359,6 @@ process_input(struct ML_result in_ml, int bitpos)
 			    "(none)");
 			mvprintw(24, 0, "Log file (empty for none):");
 			clrtoeol();
-			refresh();
 			input_mode = 1;
 			input_count = 0;
 			input_xpos = 26;
@@ -275,7 +371,6 @@ process_input(struct ML_result in_ml, int bitpos)
 			mlr.settime = !mlr.settime;
 			set_time = mlr.settime;
 			mvprintw(24, 43, mlr.settime ? "off" : "on ");
-			refresh();
 			break;
 		case 'u':
 			if (toosmall) {
@@ -283,7 +378,6 @@ process_input(struct ML_result in_ml, int bitpos)
 			}
 			show_utc = !show_utc;
 			mvprintw(24, 63, show_utc ? "off" : "on ");
-			refresh();
 			break;
 		case KEY_RESIZE:
 			endwin();
@@ -294,8 +388,6 @@ process_input(struct ML_result in_ml, int bitpos)
 				 * when the screen was too small.
 				*/
 				draw_initial_screen();
-			} else {
-				refresh();
 			}
 			toosmall = (getmaxx(stdscr) < 80) |
 			    (getmaxy(stdscr) < 25);
@@ -322,7 +414,6 @@ process_input(struct ML_result in_ml, int bitpos)
 				move(24, input_xpos + 1);
 				clrtoeol();
 			}
-			refresh();
 		} else if (input_count == MAXBUF - 1 ||
 		    (inkey == KEY_ENTER || inkey == '\r' || inkey == '\n')) {
 			/* terminate to prevent overflow */
@@ -341,10 +432,10 @@ process_input(struct ML_result in_ml, int bitpos)
 			} else {
 				mvprintw(24, input_xpos, "%c", inkey);
 			}
-			refresh();
 		}
-		inkey = getch();
+		inkey = wgetch(keywin);
 	}
+	(void)pthread_mutex_unlock(&term_lock);
 	return mlr;
 }
 
@@ -370,7 +461,6 @@ post_process_input(struct ML_result in_ml, int bitpos)
 
 			move(23, 0);
 			clrtoeol();
-			refresh();
 
 			if (in_ml.logfilename == NULL) {
 				mlr.logfilename = strdup("");
@@ -406,7 +496,6 @@ post_process_input(struct ML_result in_ml, int bitpos)
 		}
 		input_mode = 0;
 	}
-	refresh();
 	return mlr;
 }
 
@@ -416,7 +505,6 @@ wipe_input()
 	if (!toosmall && get_bitpos() == 1) {
 		move(6, 3);
 		clrtoeol();
-		refresh();
 	}
 }
 
@@ -460,7 +548,6 @@ display_minute(int minlen)
 		mvchgat(1, 40, 6, A_NORMAL, 7, NULL);
 	}
 
-	refresh();
 }
 
 static struct ML_result
@@ -485,6 +572,9 @@ process_setclock_result(struct ML_result in_ml, int bitpos)
 	case esc_ok:
 		statusbar(bitpos, "Time set");
 		break;
+	case esc_slewed:
+		statusbar(bitpos, "Time adjusted");
+		break;
 	}
 	return mlr;
 }
@@ -504,6 +594,31 @@ main(int argc, char *argv[])
 	if (json_object_object_get_ex(config, "outlogfile", &value)) {
 		logfilename = (char *)json_object_get_string(value);
 	}
+	if (json_object_object_get_ex(config, "softdecode", &value)) {
+		soft_decode = (bool)json_object_get_boolean(value);
+	}
+	if (json_object_object_get_ex(config, "quickstart", &value)) {
+		quick_start = (bool)json_object_get_boolean(value);
+	}
+	if (json_object_object_get_ex(config, "quickwindow", &value)) {
+		quick_window = (unsigned)json_object_get_int(value);
+	}
+	if (json_object_object_get_ex(config, "discipline", &value)) {
+		discipline = (bool)json_object_get_boolean(value);
+	}
+	if (json_object_object_get_ex(config, "steplimit", &value)) {
+		step_limit = (unsigned)json_object_get_int(value);
+	}
+	res = refclock_open_config(&refclock, config);
+	if (res != 0) {
+		client_cleanup(NULL);
+		return res;
+	}
+	res = set_log_policy(config);
+	if (res != 0) {
+		client_cleanup(NULL);
+		return res;
+	}
 	if (logfilename != NULL && strlen(logfilename) != 0) {
 		res = append_logfile(logfilename);
 		if (res != 0) {
@@ -539,16 +654,33 @@ main(int argc, char *argv[])
 	noecho();
 	nonl();
 	cbreak();
-	nodelay(stdscr, TRUE);
-	keypad(stdscr, TRUE);
 	curs_set(0);
+	keywin = newwin(1, 1, 0, 0);
+	if (keywin == NULL) {
+		client_cleanup("Could not create the keyboard window.");
+		return 0;
+	}
+	nodelay(keywin, TRUE);
+	keypad(keywin, TRUE);
+	/* untouched from now on, so wgetch() does not refresh it */
+	(void)wnoutrefresh(keywin);
 
 	draw_initial_screen();
+	screen_dirty = true;
+	(void)pthread_mutex_lock(&screen_lock);
+	res = pthread_create(&render_thread, NULL, renderer, NULL);
+	if (res != 0) {
+		(void)pthread_mutex_unlock(&screen_lock);
+		client_cleanup("Could not start the render thread.");
+		return res;
+	}
+	rendering = true;
 
-	mainloop(logfilename, get_bit_live, display_bit, display_long_minute,
-	    display_minute, wipe_input, display_time, process_setclock_result,
-	    process_input, post_process_input);
+	mainloop(logfilename, get_bit_unlocked, display_bit,
+	    display_long_minute, display_minute, wipe_input, display_time,
+	    process_setclock_result, process_input, post_process_input);
 
+	(void)pthread_mutex_unlock(&screen_lock);
 	client_cleanup(NULL);
 	return res;
 }
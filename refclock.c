@@ -0,0 +1,261 @@
+// Copyright 2019 René Ladan
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include "refclock.h"
+
+#include "setclock.h"
+
+#include "json_object.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sysexits.h>
+#include <unistd.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+/* key of unit 0 of the NTP shared memory segment, "NTP0" */
+#define RC_SHMKEY 0x4e545030
+/* magic number of a chrony SOCK sample, "SOCK" */
+#define RC_SOCKMAGIC 0x534f434b
+/* precision of the decoded time as a power of 2 seconds, about 1 ms */
+#define RC_PRECISION (-10)
+
+/* Layout of the NTP shared memory segment, shared with ntpd and chronyd. */
+struct shm_time {
+	int mode;
+	volatile int count;
+	time_t clock_sec;
+	int clock_usec;
+	time_t receive_sec;
+	int receive_usec;
+	int leap;
+	int precision;
+	int nsamples;
+	volatile int valid;
+	unsigned clock_nsec;
+	unsigned receive_nsec;
+	int dummy[8];
+};
+
+/* Layout of a sample of the chrony SOCK refclock. */
+struct sock_sample {
+	struct timeval tv;
+	double offset;
+	int pulse;
+	int leap;
+	int pad;
+	int magic;
+};
+
+int
+refclock_open_config(struct refclock *rc, struct json_object *config)
+{
+	struct json_object *value;
+	const char *kind = "", *path = "/var/run/chrony.nplpi.sock";
+	unsigned unit = 2;
+	int res;
+
+	rc->kind = erc_none;
+	rc->edges = NULL;
+	if (json_object_object_get_ex(config, "edgefile", &value)) {
+		rc->edges = fopen(json_object_get_string(value), "a");
+		if (rc->edges == NULL) {
+			perror("fopen(edgefile)");
+			return EX_CANTCREAT;
+		}
+	}
+	if (json_object_object_get_ex(config, "refclock", &value)) {
+		kind = json_object_get_string(value);
+	}
+	if (json_object_object_get_ex(config, "refclockunit", &value)) {
+		unit = (unsigned)json_object_get_int(value);
+	}
+	if (json_object_object_get_ex(config, "refclocksocket", &value)) {
+		path = json_object_get_string(value);
+	}
+	if (strcmp(kind, "shm") == 0) {
+		res = refclock_open_shm(rc, unit);
+	} else if (strcmp(kind, "sock") == 0) {
+		res = refclock_open_sock(rc, path);
+	} else if (strlen(kind) == 0) {
+		return 0;
+	} else {
+		fprintf(stderr, "Unknown refclock '%s'\n", kind);
+		return EX_DATAERR;
+	}
+	if (res != 0) {
+		fprintf(stderr, "refclock: %s\n", strerror(res));
+		return EX_OSERR;
+	}
+	return 0;
+}
+
+bool
+refclock_active(const struct refclock *rc)
+{
+	return rc->kind != erc_none || rc->edges != NULL;
+}
+
+int
+refclock_open_shm(struct refclock *rc, unsigned unit)
+{
+	void *p;
+	int id;
+
+	rc->kind = erc_none;
+	id = shmget((key_t)(RC_SHMKEY + unit), sizeof(struct shm_time),
+	    IPC_CREAT | (unit < 2 ? 0600 : 0666));
+	if (id == -1) {
+		return errno;
+	}
+	p = shmat(id, NULL, 0);
+	if (p == (void *)-1) {
+		return errno;
+	}
+	rc->shm = p;
+	rc->kind = erc_shm;
+	return 0;
+}
+
+int
+refclock_open_sock(struct refclock *rc, const char *path)
+{
+	rc->kind = erc_none;
+	if (strlen(path) >= sizeof(rc->addr.sun_path)) {
+		return ENAMETOOLONG;
+	}
+	memset(&rc->addr, 0, sizeof(rc->addr));
+	rc->addr.sun_family = AF_UNIX;
+	strcpy(rc->addr.sun_path, path);
+	rc->fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if (rc->fd == -1) {
+		return errno;
+	}
+	rc->kind = erc_sock;
+	return 0;
+}
+
+static void
+put_shm(volatile struct shm_time *shm, time_t reftime, struct timespec rx)
+{
+	shm->valid = 0;
+	shm->count++;
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	shm->mode = 1;
+	shm->clock_sec = reftime;
+	shm->clock_usec = 0;
+	shm->clock_nsec = 0;
+	shm->receive_sec = rx.tv_sec;
+	shm->receive_usec = (int)(rx.tv_nsec / 1000);
+	shm->receive_nsec = (unsigned)rx.tv_nsec;
+	shm->leap = 0;
+	shm->precision = RC_PRECISION;
+	shm->nsamples = 3;
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	shm->count++;
+	shm->valid = 1;
+}
+
+static int
+put_sock(struct refclock *rc, time_t reftime, struct timespec rx, bool pulse)
+{
+	struct sock_sample sample;
+
+	memset(&sample, 0, sizeof(sample));
+	sample.tv.tv_sec = rx.tv_sec;
+	sample.tv.tv_usec = rx.tv_nsec / 1000;
+	sample.offset = (double)(reftime - rx.tv_sec) -
+	    (double)(sample.tv.tv_usec) / 1e6;
+	sample.pulse = pulse ? 1 : 0;
+	sample.magic = RC_SOCKMAGIC;
+	/* not connected, so that chronyd can be (re)started at any time */
+	if (sendto(rc->fd, &sample, sizeof(sample), 0,
+	    (struct sockaddr *)&rc->addr, sizeof(rc->addr)) == -1) {
+		return errno;
+	}
+	return 0;
+}
+
+/* Convert a time of CLOCK_MONOTONIC to the system time. */
+static struct timespec
+get_realtime(long long mono_ns)
+{
+	struct timespec real, mono;
+	long long ns;
+
+	(void)clock_gettime(CLOCK_REALTIME, &real);
+	(void)clock_gettime(CLOCK_MONOTONIC, &mono);
+	ns = real.tv_sec * 1000000000LL + real.tv_nsec -
+	    (mono.tv_sec * 1000000000LL + mono.tv_nsec - mono_ns);
+	real.tv_sec = (time_t)(ns / 1000000000);
+	real.tv_nsec = (long)(ns % 1000000000);
+	return real;
+}
+
+int
+refclock_sample(struct refclock *rc, struct tm time, long long edge_ns)
+{
+	struct timespec rx;
+	time_t reftime;
+
+	if (rc->kind == erc_none) {
+		return 0;
+	}
+	if (setclock_epochtime(time, &reftime) != esc_ok) {
+		return EINVAL;
+	}
+	rx = get_realtime(edge_ns);
+	if (rc->kind == erc_shm) {
+		put_shm(rc->shm, reftime, rx);
+		return 0;
+	}
+	return put_sock(rc, reftime, rx, false);
+}
+
+int
+refclock_pulse(struct refclock *rc, long long edge_ns,
+    const struct tm *minute)
+{
+	struct timespec rx;
+	time_t reftime;
+	int res = 0;
+
+	rx = get_realtime(edge_ns);
+	if (rc->kind == erc_sock) {
+		/* the nearest second, chronyd only uses the fraction */
+		res = put_sock(rc, rx.tv_sec +
+		    (rx.tv_nsec >= 500000000 ? 1 : 0), rx, true);
+	}
+	if (rc->edges != NULL) {
+		fprintf(rc->edges, "%lld.%09ld %lld", (long long)rx.tv_sec,
+		    rx.tv_nsec, edge_ns);
+		if (minute != NULL &&
+		    setclock_epochtime(*minute, &reftime) == esc_ok) {
+			fprintf(rc->edges, " %lld", (long long)reftime);
+		}
+		fprintf(rc->edges, "\n");
+		if (fflush(rc->edges) == EOF && res == 0) {
+			res = errno;
+		}
+	}
+	return res;
+}
+
+void
+refclock_close(struct refclock *rc)
+{
+	if (rc->kind == erc_shm) {
+		(void)shmdt((const void *)rc->shm);
+	} else if (rc->kind == erc_sock) {
+		(void)close(rc->fd);
+	}
+	rc->kind = erc_none;
+	if (rc->edges != NULL) {
+		(void)fclose(rc->edges);
+		rc->edges = NULL;
+	}
+}
@@ -0,0 +1,126 @@
+// Copyright 2019 René Ladan
+// SPDX-License-Identifier: BSD-2-Clause
+
+#ifndef NPLPI_REFCLOCK_H
+#define NPLPI_REFCLOCK_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/un.h>
+struct json_object;
+
+/** The protocol to publish samples with */
+enum eRC_kind {
+	/** not publishing */
+	erc_none,
+	/** the shared memory segment of the ntpd SHM driver */
+	erc_shm,
+	/** the SOCK refclock of chronyd */
+	erc_sock
+};
+
+/**
+ * A reference clock for ntpd or chronyd, which combine its samples with
+ * their other sources instead of nplpi setting the clock itself.
+ */
+struct refclock {
+	/** the protocol */
+	enum eRC_kind kind;
+	/** the attached shared memory segment for {@link erc_shm} */
+	volatile struct shm_time *shm;
+	/** the socket for {@link erc_sock} */
+	int fd;
+	/** the address of the socket of chronyd for {@link erc_sock} */
+	struct sockaddr_un addr;
+	/** the stream of second edges, or NULL, see {@link refclock_pulse} */
+	FILE *edges;
+};
+
+/**
+ * Open the reference clock and the stream of edges from the configuration.
+ *
+ * The optional "refclock" key is "shm" for {@link refclock_open_shm} with
+ * unit "refclockunit" (default 2) or "sock" for {@link refclock_open_sock}
+ * with path "refclocksocket" (default /var/run/chrony.nplpi.sock). The
+ * optional "edgefile" key names the file to append the stream of edges to,
+ * see {@link refclock_pulse}.
+ *
+ * @param rc The reference clock.
+ * @param config The JSON object containing the parsed configuration from
+ * config.json
+ * @return Opening was successful (0), EX_DATAERR for an unknown refclock,
+ * or EX_CANTCREAT or EX_OSERR if opening failed.
+ */
+int refclock_open_config(struct refclock *rc, struct json_object *config);
+
+/**
+ * Check if the reference clock or the stream of edges is open.
+ *
+ * @param rc The reference clock.
+ * @return Samples or edges are published.
+ */
+bool refclock_active(const struct refclock *rc);
+
+/**
+ * Attach to the NTP shared memory segment, creating it if needed. Units 0
+ * and 1 are only accessible by root, higher units by everyone.
+ *
+ * @param rc The reference clock.
+ * @param unit The unit number, as in the configuration of ntpd or chronyd.
+ * @return Attaching was successful (0), or errno otherwise.
+ */
+int refclock_open_shm(struct refclock *rc, unsigned unit);
+
+/**
+ * Prepare to send samples to the SOCK refclock socket of chronyd, which
+ * does not need to be running yet.
+ *
+ * @param rc The reference clock.
+ * @param path The path of the socket, as in the configuration of chronyd.
+ * @return Preparing was successful (0), or errno otherwise.
+ */
+int refclock_open_sock(struct refclock *rc, const char *path);
+
+/**
+ * Publish a sample: the decoded time and the time of the system clock at
+ * the start of the minute.
+ *
+ * @param rc The reference clock.
+ * @param time The decoded time, in ISO or NPL format.
+ * @param edge_ns The start of second 0 of time in ns of CLOCK_MONOTONIC,
+ * see {@link get_minute_start}.
+ * @return Publishing was successful (0), or errno otherwise. A SOCK
+ * refclock returns ECONNREFUSED while chronyd is not running.
+ */
+int refclock_sample(struct refclock *rc, struct tm time, long long edge_ns);
+
+/**
+ * Publish the on-time edge of a second, like a PPS signal. A SOCK refclock
+ * receives it as a pulse sample, which chronyd combines with the samples of
+ * {@link refclock_sample} or another source to number the seconds. The SHM
+ * driver has no pulses, ntpd users can read the stream of edges instead.
+ *
+ * Each line of the stream of edges holds the system time and the time of
+ * CLOCK_MONOTONIC of the edge in ns. The line of second 0 of a minute which
+ * is valid according to {@link setclock_ok} also holds its decoded time in
+ * seconds since the epoch.
+ *
+ * @param rc The reference clock.
+ * @param edge_ns The time of the edge in ns of CLOCK_MONOTONIC, see
+ * {@link get_second_start}.
+ * @param minute The decoded time if the edge starts a valid minute, or NULL.
+ * @return Publishing was successful (0), or errno otherwise.
+ */
+int refclock_pulse(struct refclock *rc, long long edge_ns,
+    const struct tm *minute);
+
+/**
+ * Detach from the shared memory segment or close the socket, and close
+ * the stream of edges.
+ *
+ * @param rc The reference clock.
+ */
+void refclock_close(struct refclock *rc);
+
+#endif
@@ -0,0 +1,69 @@
+// Copyright 2019 René Ladan
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include "ring.h"
+
+#include <errno.h>
+#include <stdlib.h>
+
+/*
+ * head and tail run freely and wrap around at UINT_MAX, which is a multiple
+ * of the size. The acquire/release pairs make sure an item is completely
+ * written before the consumer can see the updated head, and read before the
+ * producer can see the updated tail.
+ */
+
+int
+ring_init(struct ring *r, unsigned size)
+{
+	r->size = 1;
+	while (r->size < size) {
+		r->size <<= 1;
+	}
+	r->buf = malloc(r->size);
+	if (r->buf == NULL) {
+		return errno;
+	}
+	r->head = r->tail = 0;
+	return 0;
+}
+
+void
+ring_free(struct ring *r)
+{
+	free(r->buf);
+	r->buf = NULL;
+}
+
+bool
+ring_put(struct ring *r, unsigned char item)
+{
+	unsigned head = r->head;
+
+	if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == r->size) {
+		return false;
+	}
+	r->buf[head & (r->size - 1)] = item;
+	__atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+int
+ring_get(struct ring *r)
+{
+	unsigned tail = r->tail;
+	int item;
+
+	if (__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == tail) {
+		return -1;
+	}
+	item = r->buf[tail & (r->size - 1)];
+	__atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+	return item;
+}
+
+unsigned
+ring_count(struct ring *r)
+{
+	return __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) - r->tail;
+}
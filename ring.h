@@ -0,0 +1,66 @@
+// Copyright 2019 René Ladan
+// SPDX-License-Identifier: BSD-2-Clause
+
+#ifndef NPLPI_RING_H
+#define NPLPI_RING_H
+
+#include <stdbool.h>
+
+/**
+ * Lock-free ring buffer for one producer thread and one consumer thread:
+ */
+struct ring {
+	/** the stored items */
+	unsigned char *buf;
+	/** number of items in buf, a power of two */
+	unsigned size;
+	/** position to write the next item to, only updated by the producer */
+	unsigned head;
+	/** position to read the next item from, only updated by the consumer */
+	unsigned tail;
+};
+
+/**
+ * Initialize the ring buffer.
+ *
+ * @param r The ring buffer.
+ * @param size The minimum number of items the ring buffer must hold, it is
+ * rounded up to the next power of two.
+ * @return Initialization was successful (0), or errno otherwise.
+ */
+int ring_init(struct ring *r, unsigned size);
+
+/**
+ * Free the memory used by the ring buffer.
+ *
+ * @param r The ring buffer.
+ */
+void ring_free(struct ring *r);
+
+/**
+ * Append an item to the ring buffer, only to be called by the producer.
+ *
+ * @param r The ring buffer.
+ * @param item The item to append.
+ * @return The item was appended, false if the ring buffer is full.
+ */
+bool ring_put(struct ring *r, unsigned char item);
+
+/**
+ * Remove the oldest item from the ring buffer, only to be called by the
+ * consumer.
+ *
+ * @param r The ring buffer.
+ * @return The oldest item, or -1 if the ring buffer is empty.
+ */
+int ring_get(struct ring *r);
+
+/**
+ * Count the items in the ring buffer, only to be called by the consumer.
+ *
+ * @param r The ring buffer.
+ * @return The number of items which ring_get() can remove right now.
+ */
+unsigned ring_count(struct ring *r);
+
+#endif
@@ -0,0 +1,76 @@
+// Copyright 2019 René Ladan
+// SPDX-License-Identifier: BSD-2-Clause
+
+#if defined(__linux__)
+#  define _GNU_SOURCE /* pthread_setaffinity_np() */
+#endif
+
+#include "rtsched.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#if defined(__FreeBSD__)
+#  include <sys/param.h>
+#  include <sys/cpuset.h>
+#  include <pthread_np.h>
+#endif
+
+static int
+set_affinity(int cpu)
+{
+#if defined(__linux__) || defined(__FreeBSD__)
+#  if defined(__linux__)
+	cpu_set_t set;
+#  else
+	cpuset_t set;
+#  endif
+	int res;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	res = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (res != 0) {
+		fprintf(stderr, "pthread_setaffinity_np(%i): %s\n", cpu,
+		    strerror(res));
+	}
+	return res;
+#else
+	fprintf(stderr, "CPU affinity not supported on this platform\n");
+	return ENOTSUP;
+#endif
+}
+
+int
+set_realtime(struct rtsched rt)
+{
+	int res;
+
+	if (rt.mlock && mlockall(MCL_CURRENT | MCL_FUTURE) == -1) {
+		perror("mlockall");
+		return errno;
+	}
+	if (rt.cpu >= 0) {
+		res = set_affinity(rt.cpu);
+		if (res != 0) {
+			return res;
+		}
+	}
+	if (rt.priority > 0) {
+		struct sched_param sp;
+
+		memset(&sp, 0, sizeof(sp));
+		sp.sched_priority = rt.priority;
+		res = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+		if (res != 0) {
+			fprintf(stderr, "pthread_setschedparam(SCHED_FIFO, %i): "
+			    "%s\n", rt.priority, strerror(res));
+			return res;
+		}
+	}
+	return 0;
+}
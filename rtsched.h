@@ -0,0 +1,29 @@
+// Copyright 2019 René Ladan
+// SPDX-License-Identifier: BSD-2-Clause
+
+#ifndef NPLPI_RTSCHED_H
+#define NPLPI_RTSCHED_H
+
+#include <stdbool.h>
+
+/**
+ * Real-time scheduling parameters for the sampling loop:
+ */
+struct rtsched {
+	/** SCHED_FIFO priority (1..99), or 0 to keep the normal scheduler */
+	int priority;
+	/** CPU number to pin the sampling thread to, or -1 for any CPU */
+	int cpu;
+	/** lock all current and future memory of the process into RAM */
+	bool mlock;
+};
+
+/**
+ * Apply the real-time scheduling parameters to the calling thread.
+ *
+ * @param rt The scheduling parameters to apply.
+ * @return The parameters were applied successfully (0), or errno otherwise.
+ */
+int set_realtime(struct rtsched rt);
+
+#endif
@@ -8,8 +8,15 @@
 #include "input.h"
 
 #include <locale.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#if !defined(MACOS)
+#include <sys/timex.h>
+#endif
+
+/* time constant of the kernel PLL, suitable for an update every minute */
+#define SC_TIMECONST 2
 
 bool
 setclock_ok(unsigned init_min, struct DT_result dt, struct GB_result bit)
@@ -20,16 +27,15 @@ setclock_ok(unsigned init_min, struct DT_result dt, struct GB_result bit)
 	    dt.mday_status == eval_ok && dt.wday_status == eval_ok &&
 	    dt.month_status == eval_ok && dt.year_status == eval_ok &&
 	    (dt.dst_status == eDST_ok || dt.dst_status == eDST_done) &&
-	    dt.leapsecond_status != els_one && !bit.bad_io &&
+	    dt.leapsecond_status != els_one && !dt.soft_fix && !bit.bad_io &&
 	    bit.bitval != ebv_none && bit.hwstat == ehw_ok;
 }
 
 enum eSC_status
-setclock(struct tm settime)
+setclock_epochtime(struct tm settime, time_t *epochtime)
 {
-	time_t epochtime, t1, t2;
+	time_t t1, t2;
 	struct tm it;
-	struct timespec ts;
 
 	/* determine time difference of host to UTC (t1 - t2) */
 	(void)time(&t1);
@@ -48,15 +54,90 @@ setclock(struct tm settime)
 	}
 	it.tm_isdst = -1; /* allow mktime() when host timezone is UTC */
 	it.tm_sec = 0;
-	epochtime = mktime(&it);
-	if (epochtime == -1) {
+	*epochtime = mktime(&it);
+	if (*epochtime == -1) {
 		return esc_invalid;
 	}
-	ts.tv_sec = epochtime;
 	/* UTC if t1 == t2, so adjust from local time in that case */
 	if (t1 == t2) {
-		ts.tv_sec -= 3600 * settime.tm_isdst;
+		*epochtime -= 3600 * settime.tm_isdst;
+	}
+	return esc_ok;
+}
+
+bool
+setclock_quick_ok(unsigned init_min, struct DT_result dt,
+    struct GB_result bit, struct tm settime, unsigned window)
+{
+	time_t epochtime, now;
+
+	if (init_min != 1 || !setclock_ok(0, dt, bit) ||
+	    dt.marker_status != emk_zero ||
+	    setclock_epochtime(settime, &epochtime) != esc_ok) {
+		return false;
+	}
+	(void)time(&now);
+	return epochtime >= now - 60 &&
+	    (window == 0 || epochtime <= now + (time_t)window);
+}
+
+enum eSC_status
+setclock(struct tm settime)
+{
+	struct timespec ts;
+	enum eSC_status res;
+
+	res = setclock_epochtime(settime, &ts.tv_sec);
+	if (res != esc_ok) {
+		return res;
 	}
 	ts.tv_nsec = 50000000; /* adjust for bit reception algorithm */
 	return (clock_settime(CLOCK_REALTIME, &ts) == -1) ? esc_fail : esc_ok;
 }
+
+enum eSC_status
+setclock_discipline(struct tm settime, long long edge_ns, unsigned step_limit)
+{
+	struct timespec real, mono;
+	long long offset;
+	time_t epochtime;
+	enum eSC_status res;
+
+	res = setclock_epochtime(settime, &epochtime);
+	if (res != esc_ok) {
+		return res;
+	}
+	(void)clock_gettime(CLOCK_REALTIME, &real);
+	(void)clock_gettime(CLOCK_MONOTONIC, &mono);
+	/* the clock is behind the received time if the offset is positive */
+	offset = epochtime * 1000000000LL - (real.tv_sec * 1000000000LL +
+	    real.tv_nsec - (mono.tv_sec * 1000000000LL + mono.tv_nsec -
+	    edge_ns));
+
+#if !defined(MACOS)
+	if (llabs(offset) <= step_limit * 1000000LL) {
+		struct timex tx;
+
+		memset(&tx, 0, sizeof(tx));
+		tx.modes = MOD_OFFSET | MOD_STATUS | MOD_NANO | MOD_TIMECONST |
+		    MOD_MAXERROR | MOD_ESTERROR;
+		tx.status = STA_PLL;
+		tx.offset = (long)offset;
+		tx.constant = SC_TIMECONST;
+		tx.esterror = (long)(llabs(offset) / 1000);
+		tx.maxerror = tx.esterror + 1000;
+		return ntp_adjtime(&tx) == -1 ? esc_fail : esc_slewed;
+	}
+#endif
+	(void)clock_gettime(CLOCK_REALTIME, &real);
+	real.tv_sec += offset / 1000000000;
+	real.tv_nsec += offset % 1000000000;
+	if (real.tv_nsec >= 1000000000) {
+		real.tv_sec++;
+		real.tv_nsec -= 1000000000;
+	} else if (real.tv_nsec < 0) {
+		real.tv_sec--;
+		real.tv_nsec += 1000000000;
+	}
+	return clock_settime(CLOCK_REALTIME, &real) == -1 ? esc_fail : esc_ok;
+}
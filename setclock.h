@@ -5,6 +5,7 @@
 #define NPLPI_SETCLOCK_H
 
 #include <stdbool.h>
+#include <time.h>
 struct DT_result;
 struct GB_result;
 struct tm;
@@ -18,11 +19,14 @@ enum eSC_status {
 	/** Settting the clock failed */
 	esc_fail,
 	/** Too early or unsafe to set the time */
-	esc_unsafe
+	esc_unsafe,
+	/** The clock is being steered towards the time */
+	esc_slewed
 };
 
 /**
- * Check if it is OK to set the system clock.
+ * Check if it is OK to set the system clock. A time recovered by the soft
+ * decoder is never OK, it only shows the most likely time.
  *
  * @param init_min Indicates whether the state of the decoder is initial
  * @param dt The status of the currently decoded time
@@ -31,6 +35,36 @@ enum eSC_status {
  */
 bool setclock_ok(unsigned init_min, struct DT_result dt, struct GB_result bit);
 
+/**
+ * Check if it is OK to set the system clock from the first fully decoded
+ * minute, one minute before {@link setclock_ok} allows it. All checks of
+ * {@link setclock_ok} must pass, the minute marker must be at its normal
+ * position, and the time must not be more than a minute before the last
+ * known time, which is the host clock as restored from the RTC. A host
+ * clock which is still at 1970 after a power failure therefore accepts any
+ * time.
+ *
+ * @param init_min Indicates whether the state of the decoder is initial
+ * @param dt The status of the currently decoded time
+ * @param bit The current bit information
+ * @param settime The decoded time
+ * @param window The maximum number of seconds the time may be ahead of the
+ * last known time, or 0 for no limit
+ * @return Whether it is OK to set the system clock
+ */
+bool setclock_quick_ok(unsigned init_min, struct DT_result dt,
+    struct GB_result bit, struct tm settime, unsigned window);
+
+/**
+ * Convert the decoded time to seconds since the epoch.
+ *
+ * @param settime The decoded time, in ISO or NPL format.
+ * @param epochtime Set to the number of seconds since the epoch.
+ * @return Whether the time could be converted ({@link esc_ok}) or not
+ * ({@link esc_invalid}).
+ */
+enum eSC_status setclock_epochtime(struct tm settime, time_t *epochtime);
+
 /**
  * Set the system clock according to the given time.
  *
@@ -39,4 +73,20 @@ bool setclock_ok(unsigned init_min, struct DT_result dt, struct GB_result bit);
  */
 enum eSC_status setclock(struct tm settime);
 
+/**
+ * Discipline the system clock with the time of the minute which started
+ * with the edge at edge_ns. The offset of the clock at that edge is handed
+ * to the PLL/FLL of the kernel through ntp_adjtime(), which slews the clock
+ * instead of stepping it. Only offsets larger than step_limit are stepped.
+ *
+ * @param settime The time to set the system clock to, in ISO or NPL format.
+ * @param edge_ns The start of second 0 of settime in ns of CLOCK_MONOTONIC,
+ * see {@link get_minute_start}.
+ * @param step_limit The largest offset in ms to slew instead of stepping.
+ * @return Whether the clock was stepped ({@link esc_ok}) or slewed
+ * ({@link esc_slewed}) successfully.
+ */
+enum eSC_status setclock_discipline(struct tm settime, long long edge_ns,
+    unsigned step_limit);
+
 #endif
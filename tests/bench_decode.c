@@ -0,0 +1,411 @@
+// Copyright 2019 René Ladan
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include "siggen.h"
+
+#include "input.h"
+#include "mainloop.h"
+#include "setclock.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Measure the speed and the accuracy of the decoder on a synthetic signal.
+ * The signal is decoded through collect_pulses(), get_bit_live() and
+ * decode_time() as generated with set_mode_source() and replayed from a
+ * capture file, and through get_bit_file() and decode_time() from a log
+ * file. A minute is decoded correctly if setclock_ok() accepts it and it
+ * holds the transmitted time, it is wrong if setclock_ok() accepts any
+ * other time. The live paths also check the start of each correct minute
+ * from get_minute_start() on the virtual clock, and report the average
+ * sample rate, which -m lets the source path adapt down to minfreq. With
+ * -w the live paths sleep for that many minutes after each verified
+ * minute, see ML_result.sleep_minutes, and -R dumps the last three minutes
+ * of samples of the source path to that directory for each failed minute,
+ * see set_recorder(). With -S all paths use the soft decoder, and each
+ * minute it recovers must hold the transmitted time as well. The benchmark
+ * fails if any path accepts a wrong time, and with -r unless each path
+ * decodes at least that percentage of the minutes correctly. -f sets the
+ * sample rate of the live paths.
+ */
+
+/* the options of the live paths */
+struct source_opts {
+	unsigned minfreq;
+	unsigned sleep;
+	const char *recdir;     /* or NULL */
+	bool soft;
+};
+
+/* the result of decoding one file */
+struct bench {
+	unsigned long long samples;
+	double seconds;
+	unsigned minutes;
+	unsigned valid;
+	unsigned correct;
+	unsigned wrong;
+	unsigned recovered;     /* by the soft decoder */
+	unsigned recovered_wrong;
+	long long edge_max;     /* largest error of get_minute_start() */
+	unsigned long long rate_sum;    /* of the sample rate of each bit */
+	unsigned long bits;
+};
+
+static bool
+same_time(const struct tm *a, const struct tm *b)
+{
+	return a->tm_year == b->tm_year && a->tm_mon == b->tm_mon &&
+	    a->tm_mday == b->tm_mday && a->tm_hour == b->tm_hour &&
+	    a->tm_min == b->tm_min;
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* Missed minute markers merge minutes, so search ahead from next. */
+static unsigned
+find_time(const struct tm *time, const struct tm *times, unsigned next,
+    unsigned minutes)
+{
+	unsigned i;
+
+	for (i = next; i < minutes; i++) {
+		if (same_time(time, &times[i])) {
+			break;
+		}
+	}
+	return i;
+}
+
+/* Decode the prepared input of s and compare it with the expected times. */
+static void
+decode(struct GB_state *s, struct GB_result (*get_bit)(struct GB_state *),
+    const struct tm *times, const long long *edges, unsigned minutes,
+    unsigned sleep, bool soft, struct bench *r)
+{
+	struct ML_state ml;
+	struct ML_event ev;
+	unsigned next = 0, i;
+	double t0;
+
+	mainloop_init(&ml, s, NULL);
+	ml.get_bit = get_bit;
+	ml.mlr.sleep_minutes = sleep;
+	ml.mlr.sleep_after = 3;
+	ml.mlr.soft_decode = soft;
+	t0 = now();
+	while (mainloop_step(&ml, &ev) != eml_done) {
+		if (ev.type == eml_bit) {
+			r->rate_sum += get_hardware_parameters_r(s).freq;
+			r->bits++;
+		}
+		if (ev.type != eml_time) {
+			continue;
+		}
+		r->minutes++;
+		if (ml.init_min == 0 && ev.dt.soft_fix) {
+			r->recovered++;
+			i = find_time(&ev.time, times, next, minutes);
+			if (i < minutes) {
+				next = i + 1;
+			} else {
+				r->recovered_wrong++;
+			}
+			continue;
+		}
+		if (!setclock_ok(ml.init_min, ev.dt, ml.bit)) {
+			continue;
+		}
+		r->valid++;
+		i = find_time(&ev.time, times, next, minutes);
+		if (i < minutes) {
+			r->correct++;
+			next = i + 1;
+			if (edges != NULL) {
+				long long d = get_minute_start_r(s) - edges[i];
+
+				d = d < 0 ? -d : d;
+				r->edge_max = d > r->edge_max ? d : r->edge_max;
+			}
+		} else {
+			r->wrong++;
+		}
+	}
+	r->seconds = now() - t0;
+}
+
+static void
+report(const char *path, const struct bench *r, unsigned minutes)
+{
+	printf("%-7s %u minutes in %.3f s (%.0f minutes/s", path, minutes,
+	    r->seconds, r->seconds > 0 ? minutes / r->seconds : 0);
+	if (r->samples > 0) {
+		printf(", %.2f Msamples/s", r->seconds > 0 ?
+		    r->samples / r->seconds / 1e6 : 0);
+	}
+	printf("), %u decoded, %u valid, %u correct (%.1f%%), %u wrong",
+	    r->minutes, r->valid, r->correct, 100.0 * r->correct / minutes,
+	    r->wrong);
+	if (r->samples > 0) {
+		printf(", edges within %.1f ms, %.0f Hz", r->edge_max / 1e6,
+		    r->bits > 0 ? (double)r->rate_sum / r->bits : 0);
+	}
+	if (r->recovered > 0) {
+		printf(", %u recovered, %u wrong", r->recovered,
+		    r->recovered_wrong);
+	}
+	printf("\n");
+}
+
+/* The start of the minute marker ending each minute on the virtual clock. */
+static void
+minute_edges(const struct siggen *g, time_t start, unsigned minutes,
+    long long *edges)
+{
+	int a[SG_MAXSEC], b[SG_MAXSEC];
+	unsigned long long sec = 0;
+	unsigned m;
+
+	for (m = 0; m < minutes; m++) {
+		struct tm tm;
+
+		sec += (unsigned long long)siggen_minute(g,
+		    start + 60 * (time_t)m, a, b, &tm);
+		edges[m] = siggen_edge_ns(g, sec);
+	}
+}
+
+static int
+bench_source(struct siggen *g, const struct source_opts *o, time_t start,
+    unsigned minutes, struct tm *times, const long long *edges,
+    struct bench *r)
+{
+	struct siggen_stream st;
+	struct pulse_source src;
+	struct GB_state *s;
+	int res;
+
+	res = siggen_open(&st, g, start, minutes, times);
+	if (res != 0) {
+		fprintf(stderr, "siggen_open: %s\n", strerror(res));
+		return EX_OSERR;
+	}
+	s = GB_new();
+	if (s == NULL) {
+		perror("GB_new");
+		siggen_close(&st);
+		return EX_OSERR;
+	}
+	src.next = siggen_next;
+	src.arg = &st;
+	src.freq = g->freq;
+	src.start_ns = 0;
+	src.min_freq = o->minfreq;
+	res = set_mode_source_r(s, &src);
+	if (res == 0 && o->recdir != NULL) {
+		res = set_recorder_r(s, 3, o->recdir);
+		if (res != 0) {
+			fprintf(stderr, "set_recorder: %s\n", strerror(res));
+		}
+	}
+	if (res == 0) {
+		decode(s, get_bit_live_r, times, edges, minutes, o->sleep,
+		    o->soft, r);
+		r->samples = st.samples;
+	}
+	GB_free(s);
+	siggen_close(&st);
+	return res;
+}
+
+static int
+bench_capture(struct siggen *g, const char *name, time_t start,
+    unsigned minutes, struct tm *times, const long long *edges,
+    const struct source_opts *o, struct bench *r)
+{
+	struct GB_state *s;
+	int res;
+
+	res = siggen_capture(g, name, start, minutes, times, &r->samples);
+	if (res != 0) {
+		fprintf(stderr, "%s: %s\n", name, strerror(res));
+		return EX_CANTCREAT;
+	}
+	s = GB_new();
+	if (s == NULL) {
+		perror("GB_new");
+		return EX_OSERR;
+	}
+	res = set_mode_replay_r(s, name);
+	if (res == 0) {
+		decode(s, get_bit_live_r, times, edges, minutes, o->sleep,
+		    o->soft, r);
+	}
+	GB_free(s);
+	return res;
+}
+
+static int
+bench_log(struct siggen *g, const char *name, time_t start,
+    unsigned minutes, struct tm *times, bool soft, struct bench *r)
+{
+	struct GB_state *s;
+	int res;
+
+	res = siggen_log(g, name, start, minutes, times);
+	if (res != 0) {
+		fprintf(stderr, "%s: %s\n", name, strerror(res));
+		return EX_CANTCREAT;
+	}
+	s = GB_new();
+	if (s == NULL) {
+		perror("GB_new");
+		return EX_OSERR;
+	}
+	res = set_mode_file_r(s, name);
+	if (res == 0) {
+		decode(s, get_bit_file_r, times, NULL, minutes, 0, soft, r);
+	}
+	GB_free(s);
+	return res;
+}
+
+/* Create an empty temporary file and return its name in buf. */
+static int
+make_temp(char *buf, size_t len)
+{
+	const char *dir = getenv("TMPDIR");
+	int fd;
+
+	(void)snprintf(buf, len, "%s/nplpi-bench.XXXXXX",
+	    dir != NULL ? dir : "/tmp");
+	fd = mkstemp(buf);
+	if (fd == -1) {
+		perror("mkstemp");
+		return EX_CANTCREAT;
+	}
+	(void)close(fd);
+	return 0;
+}
+
+static void
+usage(const char *name)
+{
+	printf("usage: %s [-m minfreq] [-R recdir] [-r rate] [-S] [-w sleep] "
+	    SG_USAGE " start minutes\n", name);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct siggen g;
+	struct source_opts o = { 0, 0, NULL, false };
+	struct bench gen, cap, log;
+	struct tm *times;
+	long long *edges;
+	char name[256];
+	unsigned long long seed;
+	double rate = 0;
+	time_t start;
+	unsigned minutes;
+	int ch, res;
+
+	siggen_init(&g);
+	while ((ch = getopt(argc, argv, "m:R:r:Sw:" SG_OPTSTRING)) != -1) {
+		if (ch == 'm') {
+			o.minfreq = (unsigned)strtoul(optarg, NULL, 10);
+		} else if (ch == 'R') {
+			o.recdir = optarg;
+		} else if (ch == 'r') {
+			rate = strtod(optarg, NULL);
+		} else if (ch == 'S') {
+			o.soft = true;
+		} else if (ch == 'w') {
+			o.sleep = (unsigned)strtoul(optarg, NULL, 10);
+		} else if (!siggen_option(&g, ch, optarg)) {
+			usage(argv[0]);
+			return EX_USAGE;
+		}
+	}
+	if (argc - optind != 2) {
+		usage(argv[0]);
+		return EX_USAGE;
+	}
+	start = siggen_parse(argv[optind]);
+	minutes = (unsigned)strtoul(argv[optind + 1], NULL, 10);
+	if (start == -1 || minutes == 0) {
+		usage(argv[0]);
+		return EX_USAGE;
+	}
+	times = malloc(minutes * sizeof(*times));
+	edges = malloc(minutes * sizeof(*edges));
+	if (times == NULL || edges == NULL) {
+		perror("malloc(times)");
+		free(times);
+		return EX_OSERR;
+	}
+	minute_edges(&g, start, minutes, edges);
+	memset(&gen, 0, sizeof(gen));
+	memset(&cap, 0, sizeof(cap));
+	memset(&log, 0, sizeof(log));
+
+	/* generate all signals from the same seed */
+	seed = g.seed;
+	res = bench_source(&g, &o, start, minutes, times, edges, &gen);
+	g.seed = seed;
+	if (res == 0) {
+		res = make_temp(name, sizeof(name));
+	}
+	if (res == 0) {
+		res = bench_capture(&g, name, start, minutes, times, edges,
+		    &o, &cap);
+		(void)unlink(name);
+	}
+	g.seed = seed;
+	if (res == 0) {
+		res = make_temp(name, sizeof(name));
+	}
+	if (res == 0) {
+		res = bench_log(&g, name, start, minutes, times, o.soft,
+		    &log);
+		(void)unlink(name);
+	}
+	free(times);
+	free(edges);
+	if (res != 0) {
+		return res;
+	}
+	report("source", &gen, minutes);
+	report("capture", &cap, minutes);
+	report("log", &log, minutes);
+	if (100.0 * gen.correct < rate * minutes ||
+	    100.0 * cap.correct < rate * minutes ||
+	    100.0 * log.correct < rate * minutes) {
+		printf("Less than %.1f%% of the minutes decoded correctly\n",
+		    rate);
+		return EX_SOFTWARE;
+	}
+	if (gen.wrong + cap.wrong + log.wrong > 0) {
+		printf("A wrong time was accepted\n");
+		return EX_SOFTWARE;
+	}
+	if (gen.recovered_wrong + cap.recovered_wrong + log.recovered_wrong >
+	    0) {
+		printf("The soft decoder recovered a wrong time\n");
+		return EX_SOFTWARE;
+	}
+	return 0;
+}
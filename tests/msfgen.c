@@ -0,0 +1,65 @@
+// Copyright 2019 René Ladan
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include "siggen.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+/*
+ * Write a synthetic MSF signal to a log file, or to a capture file with -c,
+ * which nplpi-analyze decodes like a real one, e.g.:
+ *
+ *   msfgen -c -l 1 2016-12-31T23:00 120 leap.npc
+ */
+
+static void
+usage(const char *name)
+{
+	printf("usage: %s [-c] " SG_USAGE " start minutes outfile\n", name);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct siggen g;
+	bool capture = false;
+	time_t start;
+	unsigned minutes;
+	int ch, res;
+
+	siggen_init(&g);
+	while ((ch = getopt(argc, argv, "c" SG_OPTSTRING)) != -1) {
+		if (ch == 'c') {
+			capture = true;
+		} else if (!siggen_option(&g, ch, optarg)) {
+			usage(argv[0]);
+			return EX_USAGE;
+		}
+	}
+	if (argc - optind != 3) {
+		usage(argv[0]);
+		return EX_USAGE;
+	}
+	start = siggen_parse(argv[optind]);
+	minutes = (unsigned)strtoul(argv[optind + 1], NULL, 10);
+	if (start == -1 || minutes == 0) {
+		usage(argv[0]);
+		return EX_USAGE;
+	}
+	if (capture) {
+		res = siggen_capture(&g, argv[optind + 2], start, minutes, NULL,
+		    NULL);
+	} else {
+		res = siggen_log(&g, argv[optind + 2], start, minutes, NULL);
+	}
+	if (res != 0) {
+		fprintf(stderr, "%s: %s\n", argv[optind + 2], strerror(res));
+		return EX_CANTCREAT;
+	}
+	return 0;
+}
@@ -0,0 +1,435 @@
+// Copyright 2019 René Ladan
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include "siggen.h"
+
+#include "capture.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* carrier off, as read from the receiver */
+#define SG_OFF 1
+
+/* days since the epoch of a date in the proleptic Gregorian calendar */
+static long
+days_from_civil(int year, int mon, int mday)
+{
+	int y = mon <= 2 ? year - 1 : year;
+	int era = (y >= 0 ? y : y - 399) / 400;
+	int yoe = y - era * 400;
+	int doy = (153 * (mon + (mon > 2 ? -3 : 9)) + 2) / 5 + mday - 1;
+	int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+	return (long)era * 146097 + doe - 719468;
+}
+
+/* 01:00 UTC on the last Sunday of the month (31 days) */
+static time_t
+last_sunday(int year, int mon)
+{
+	long days = days_from_civil(year, mon, 31);
+
+	/* 1970-01-01 was a Thursday */
+	days -= (days + 4) % 7;
+	return (time_t)days * 86400 + 3600;
+}
+
+/* UK summer time is in effect at the given time */
+static int
+is_summer(time_t utc)
+{
+	struct tm tm;
+
+	(void)gmtime_r(&utc, &tm);
+	return utc >= last_sunday(tm.tm_year + 1900, 3) &&
+	    utc < last_sunday(tm.tm_year + 1900, 10);
+}
+
+/* xorshift64, uniform in [0, 1) */
+static double
+rnd(struct siggen *g)
+{
+	g->seed ^= g->seed << 13;
+	g->seed ^= g->seed >> 7;
+	g->seed ^= g->seed << 17;
+	return (double)(g->seed >> 11) / 9007199254740992.0;
+}
+
+static void
+putbcd(int *a, int start, int len, int value)
+{
+	int x = (value / 10) << 4 | value % 10;
+	int i;
+
+	for (i = 0; i < len; i++) {
+		a[start + i] = (x >> (len - 1 - i)) & 1;
+	}
+}
+
+/* odd parity over a[start..stop] */
+static int
+parity(const int *a, int start, int stop)
+{
+	int i, sum = 1;
+
+	for (i = start; i <= stop; i++) {
+		sum += a[i];
+	}
+	return sum & 1;
+}
+
+void
+siggen_init(struct siggen *g)
+{
+	g->freq = 1000;
+	g->jitter = 0;
+	g->noise = 0;
+	g->burst = 20;
+	g->dropout = 0;
+	g->leap = 0;
+	g->ppm = -1000;
+	g->seed = 1;
+}
+
+bool
+siggen_option(struct siggen *g, int ch, const char *arg)
+{
+	char *end;
+
+	errno = 0;
+	switch (ch) {
+	case 'b':
+		g->burst = (unsigned)strtoul(arg, &end, 10);
+		break;
+	case 'd':
+		g->dropout = strtod(arg, &end);
+		break;
+	case 'f':
+		g->freq = (unsigned)strtoul(arg, &end, 10);
+		if (g->freq < 10 || g->freq > 120000 || (g->freq & 1) == 1) {
+			return false;
+		}
+		break;
+	case 'j':
+		g->jitter = (unsigned)strtoul(arg, &end, 10);
+		break;
+	case 'l':
+		g->leap = (int)strtol(arg, &end, 10);
+		break;
+	case 'n':
+		g->noise = strtod(arg, &end);
+		break;
+	case 'p':
+		g->ppm = (int)strtol(arg, &end, 10);
+		if (g->ppm < -500000 || g->ppm > 500000) {
+			return false;
+		}
+		break;
+	case 's':
+		g->seed = strtoull(arg, &end, 10);
+		if (g->seed == 0) {
+			return false;
+		}
+		break;
+	default:
+		return false;
+	}
+	return errno == 0 && end != arg && *end == '\0';
+}
+
+time_t
+siggen_parse(const char *iso)
+{
+	int year, mon, mday, hour, min;
+	char end;
+
+	if (sscanf(iso, "%d-%d-%dT%d:%d%c", &year, &mon, &mday, &hour, &min,
+	    &end) != 5 || mon < 1 || mon > 12 || mday < 1 || mday > 31 ||
+	    hour < 0 || hour > 23 || min < 0 || min > 59) {
+		return -1;
+	}
+	return (time_t)days_from_civil(year, mon, mday) * 86400 +
+	    hour * 3600 + min * 60;
+}
+
+int
+siggen_minute(const struct siggen *g, time_t utc, int a[SG_MAXSEC],
+    int b[SG_MAXSEC], struct tm *tm)
+{
+	struct tm ut, lt;
+	time_t next = utc + 60, local;
+	int summer = is_summer(next);
+	int i, len = 60;
+
+	(void)gmtime_r(&utc, &ut);
+	local = next + (summer ? 3600 : 0);
+	(void)gmtime_r(&local, &lt);
+
+	memset(a, 0, SG_MAXSEC * sizeof(int));
+	memset(b, 0, SG_MAXSEC * sizeof(int));
+	a[0] = b[0] = 1;
+	putbcd(a, 17, 8, lt.tm_year % 100);
+	putbcd(a, 25, 5, lt.tm_mon + 1);
+	putbcd(a, 30, 6, lt.tm_mday);
+	putbcd(a, 36, 3, lt.tm_wday);
+	putbcd(a, 39, 6, lt.tm_hour);
+	putbcd(a, 45, 7, lt.tm_min);
+	for (i = 53; i < 59; i++) {
+		a[i] = 1;
+	}
+	b[53] = is_summer(next + 3600) != summer;
+	b[54] = parity(a, 17, 24);
+	b[55] = parity(a, 25, 35);
+	b[56] = parity(a, 36, 38);
+	b[57] = parity(a, 39, 51);
+	b[58] = summer;
+
+	if (g->leap != 0 && ut.tm_hour == 23 && ut.tm_min == 59 &&
+	    ((ut.tm_mon == 5 && ut.tm_mday == 30) ||
+	    (ut.tm_mon == 11 && ut.tm_mday == 31))) {
+		if (g->leap > 0) {
+			/* an extra zero bit between seconds 16 and 17 */
+			memmove(a + 18, a + 17, 43 * sizeof(int));
+			memmove(b + 18, b + 17, 43 * sizeof(int));
+			a[17] = b[17] = 0;
+			len = 61;
+		} else {
+			memmove(a + 16, a + 17, 44 * sizeof(int));
+			memmove(b + 16, b + 17, 44 * sizeof(int));
+			len = 59;
+		}
+	}
+
+	memset(tm, 0, sizeof(*tm));
+	tm->tm_year = lt.tm_year + 1900;
+	tm->tm_mon = lt.tm_mon + 1;
+	tm->tm_mday = lt.tm_mday;
+	tm->tm_wday = lt.tm_wday;
+	tm->tm_hour = lt.tm_hour;
+	tm->tm_min = lt.tm_min;
+	tm->tm_isdst = summer;
+	return len;
+}
+
+/* shift an edge in samples by the jitter, keeping it within the second */
+static int
+jitter(struct siggen *g, int pos, int n)
+{
+	int j = (int)(g->jitter * g->freq / 1000);
+
+	if (j > 0) {
+		pos += (int)(rnd(g) * (2 * j + 1)) - j;
+	}
+	return pos < 0 ? 0 : pos > n ? n : pos;
+}
+
+/* the n samples of one second, with the carrier off during the pulses */
+static void
+second_samples(struct siggen *g, int marker, int a, int b, char *buf, int n)
+{
+	int ms = n / 10;
+	int i, end;
+
+	memset(buf, 1 - SG_OFF, (size_t)n);
+	if (rnd(g) < g->dropout) {
+		return;
+	}
+	if (marker) {
+		memset(buf, SG_OFF, (size_t)jitter(g, 5 * ms, n));
+	} else if (a || !b) {
+		end = jitter(g, b ? 3 * ms : a ? 2 * ms : ms, n);
+		memset(buf, SG_OFF, (size_t)end);
+	} else {
+		/* separate pulse for B */
+		int start;
+
+		end = jitter(g, ms, n);
+		memset(buf, SG_OFF, (size_t)end);
+		start = jitter(g, 2 * ms, n);
+		start = start < end ? end : start;
+		end = jitter(g, 3 * ms, n);
+		end = end < start ? start : end;
+		memset(buf + start, SG_OFF, (size_t)(end - start));
+	}
+	if (rnd(g) < g->noise) {
+		int start = (int)(rnd(g) * n);
+		int len = (int)(g->burst * g->freq / 1000);
+
+		for (i = start; i < start + len && i < n; i++) {
+			buf[i] = rnd(g) < 0.5 ? 0 : 1;
+		}
+	}
+}
+
+/* the first sample of second sec, the sample clock runs off by ppm */
+static unsigned long long
+first_sample(const struct siggen *g, unsigned long long sec)
+{
+	return (unsigned long long)(sec * (g->freq * (1 + g->ppm / 1e6)) +
+	    0.5);
+}
+
+long long
+siggen_edge_ns(const struct siggen *g, unsigned long long sec)
+{
+	return (long long)(first_sample(g, sec) * 1000000000ULL / g->freq);
+}
+
+int
+siggen_open(struct siggen_stream *st, struct siggen *g, time_t start,
+    unsigned minutes, struct tm *times)
+{
+	/* room for a sample clock running fast by up to 50% */
+	st->buf = malloc(g->freq * 3 / 2 + 2);
+	if (st->buf == NULL) {
+		return errno;
+	}
+	st->g = g;
+	st->start = start;
+	st->minutes = minutes;
+	st->minute = 0;
+	st->times = times;
+	st->len = st->sec = 0;
+	st->n = st->pos = 0;
+	st->seconds = 0;
+	st->samples = 0;
+	st->done = false;
+	return 0;
+}
+
+/* Generate the samples of the next second, false at the end. */
+static bool
+next_second(struct siggen_stream *st)
+{
+	int marker, a = 0, b = 0;
+
+	if (st->sec == st->len) {
+		struct tm tm;
+
+		if (st->minute == st->minutes) {
+			if (st->done) {
+				return false;
+			}
+			/* the minute marker which ends the last minute */
+			st->done = true;
+		} else {
+			st->len = siggen_minute(st->g, st->start +
+			    60 * (time_t)st->minute, st->a, st->b, &tm);
+			if (st->times != NULL) {
+				st->times[st->minute] = tm;
+			}
+			st->minute++;
+			st->sec = 0;
+		}
+	}
+	marker = st->done || st->sec == 0;
+	if (!st->done) {
+		a = st->a[st->sec];
+		b = st->b[st->sec];
+		st->sec++;
+	}
+	st->n = (int)(first_sample(st->g, st->seconds + 1) -
+	    first_sample(st->g, st->seconds));
+	st->pos = 0;
+	st->seconds++;
+	second_samples(st->g, marker, a, b, st->buf, st->n);
+	return true;
+}
+
+int
+siggen_next(void *arg)
+{
+	struct siggen_stream *st = arg;
+
+	while (st->pos == st->n) {
+		if (!next_second(st)) {
+			return -1;
+		}
+	}
+	st->samples++;
+	return st->buf[st->pos++];
+}
+
+void
+siggen_close(struct siggen_stream *st)
+{
+	free(st->buf);
+	st->buf = NULL;
+}
+
+int
+siggen_capture(struct siggen *g, const char *name, time_t start,
+    unsigned minutes, struct tm *times, unsigned long long *nsamples)
+{
+	struct siggen_stream st;
+	struct capture c;
+	int p, res;
+
+	res = siggen_open(&st, g, start, minutes, times);
+	if (res != 0) {
+		return res;
+	}
+	res = capture_create(&c, name, g->freq, false, 0);
+	if (res != 0) {
+		siggen_close(&st);
+		return res;
+	}
+	while ((p = siggen_next(&st)) != -1) {
+		capture_sample(&c, p);
+	}
+	if (nsamples != NULL) {
+		*nsamples = st.samples;
+	}
+	siggen_close(&st);
+	return capture_close(&c);
+}
+
+int
+siggen_log(struct siggen *g, const char *name, time_t start,
+    unsigned minutes, struct tm *times)
+{
+	FILE *f;
+	int a[SG_MAXSEC], b[SG_MAXSEC];
+	unsigned m;
+	int res = 0, sec, len;
+
+	f = fopen(name, "w");
+	if (f == NULL) {
+		return errno;
+	}
+	/* as written by nplpi when it starts a log */
+	fprintf(f, "\n--new log--\n\n");
+	for (m = 0; m < minutes; m++) {
+		struct tm tm;
+
+		len = siggen_minute(g, start + 60 * (time_t)m, a, b, &tm);
+		if (times != NULL) {
+			times[m] = tm;
+		}
+		/* a line runs up to and including the next minute marker */
+		for (sec = 1; sec <= len; sec++) {
+			int s = sec == len ? 4 : a[sec] | b[sec] << 1;
+
+			if (rnd(g) < g->dropout) {
+				(void)fputc('_', f);
+				continue;
+			}
+			if (rnd(g) < g->noise) {
+				s = (s + 1 + (int)(rnd(g) * 4)) % 5;
+			}
+			(void)fputc('0' + s, f);
+		}
+		fprintf(f, "a%d\n", len * 1000);
+	}
+	if (ferror(f)) {
+		res = errno;
+	}
+	if (fclose(f) == EOF && res == 0) {
+		res = errno;
+	}
+	return res;
+}
@@ -0,0 +1,197 @@
+// Copyright 2019 René Ladan
+// SPDX-License-Identifier: BSD-2-Clause
+
+#ifndef NPLPI_SIGGEN_H
+#define NPLPI_SIGGEN_H
+
+#include <stdbool.h>
+#include <time.h>
+
+/** Maximum number of seconds in a minute, including a leap second */
+#define SG_MAXSEC 61
+
+/** The getopt() options parsed by {@link siggen_option} */
+#define SG_OPTSTRING "b:d:f:j:l:n:p:s:"
+/** Usage text of the options parsed by {@link siggen_option} */
+#define SG_USAGE "[-f freq] [-j jitter] [-n noise] [-b burst] [-d dropout] " \
+    "[-l leap] [-p ppm] [-s seed]"
+
+/**
+ * Parameters of the synthetic MSF signal. All random choices are made with
+ * a private generator seeded from seed, so a signal can be reproduced.
+ */
+struct siggen {
+	/** sample rate in Hz of capture files */
+	unsigned freq;
+	/**
+	 * maximum random shift in ms of the edges within each second, the
+	 * start of each second is exact
+	 */
+	unsigned jitter;
+	/** probability per second of a burst of random samples */
+	double noise;
+	/** length of a burst of random samples in ms */
+	unsigned burst;
+	/** probability per second of losing the whole second */
+	double dropout;
+	/**
+	 * insert (1) or remove (-1) a leap second at the end of June and
+	 * December, or none (0)
+	 */
+	int leap;
+	/**
+	 * deviation of the sample clock of the receiver in ppm, negative to
+	 * take fewer than freq samples per second
+	 */
+	int ppm;
+	/** state of the random generator, must not be 0 */
+	unsigned long long seed;
+};
+
+/**
+ * Set the parameters to a clean signal at 1000 Hz, sampled by a receiver
+ * whose clock runs 1000 ppm slow, with bursts of 20 ms if noise is enabled.
+ *
+ * @param g The parameters.
+ */
+void siggen_init(struct siggen *g);
+
+/**
+ * Set a parameter from a command line option, see {@link SG_OPTSTRING}.
+ *
+ * @param g The parameters.
+ * @param ch The option character.
+ * @param arg The argument of the option.
+ * @return The option is known and its argument valid.
+ */
+bool siggen_option(struct siggen *g, int ch, const char *arg);
+
+/**
+ * Parse a time in UTC in the form YYYY-MM-DDTHH:MM.
+ *
+ * @param iso The time.
+ * @return The time in seconds since the epoch, or -1 if iso is invalid.
+ */
+time_t siggen_parse(const char *iso);
+
+/**
+ * Encode the minute starting at the given time. The minute transmits the
+ * UK time of its end, with the summer time warning (bit 53B) set during
+ * the hour before a change and a leap second inserted between seconds 16
+ * and 17 or second 16 removed, which moves the 01111110 marker by +1 or
+ * -1 second.
+ *
+ * @param g The parameters, only leap is used.
+ * @param utc The start of the minute in UTC.
+ * @param a Set to the A bits, position 0 is the minute marker.
+ * @param b Set to the B bits.
+ * @param tm Set to the transmitted time in NPL format, see
+ * {@link decode_time}.
+ * @return The number of seconds in the minute (59, 60 or 61).
+ */
+int siggen_minute(const struct siggen *g, time_t utc, int a[SG_MAXSEC],
+    int b[SG_MAXSEC], struct tm *tm);
+
+/**
+ * Generate the samples of a signal one at a time, like a receiver, see
+ * {@link siggen_open}.
+ */
+struct siggen_stream {
+	/** the parameters */
+	struct siggen *g;
+	/** the start of the first minute in UTC */
+	time_t start;
+	/** the number of minutes */
+	unsigned minutes;
+	/** the number of minutes started */
+	unsigned minute;
+	/** the transmitted time of each minute, or NULL */
+	struct tm *times;
+	/** the bits of the current minute */
+	int a[SG_MAXSEC], b[SG_MAXSEC];
+	/** the length of the current minute and the next second in it */
+	int len, sec;
+	/** the samples of the current second */
+	char *buf;
+	/** the number of samples in buf and the next one */
+	int n, pos;
+	/** the number of seconds started */
+	unsigned long long seconds;
+	/** the number of samples returned */
+	unsigned long long samples;
+	/** the minute marker ending the last minute is started */
+	bool done;
+};
+
+/**
+ * Start generating a signal. The samples are those of
+ * {@link siggen_capture}.
+ *
+ * @param st The stream.
+ * @param g The parameters, kept by st.
+ * @param start The start of the first minute in UTC.
+ * @param minutes The number of minutes.
+ * @param times Set to the transmitted time of each minute as it starts, or
+ * NULL.
+ * @return Starting was successful (0), or errno otherwise.
+ */
+int siggen_open(struct siggen_stream *st, struct siggen *g, time_t start,
+    unsigned minutes, struct tm *times);
+
+/**
+ * Generate the next sample, usable as {@link pulse_source.next}.
+ *
+ * @param arg The stream.
+ * @return The sample (0 or 1), or -1 at the end of the signal.
+ */
+int siggen_next(void *arg);
+
+/**
+ * Free the stream.
+ *
+ * @param st The stream.
+ */
+void siggen_close(struct siggen_stream *st);
+
+/**
+ * The start of a second of the signal on the virtual clock of
+ * {@link set_mode_source} starting at 0, which counts the samples of the
+ * receiver.
+ *
+ * @param g The parameters, only freq and ppm are used.
+ * @param sec The second, counted from the start of the signal.
+ * @return The time in ns.
+ */
+long long siggen_edge_ns(const struct siggen *g, unsigned long long sec);
+
+/**
+ * Write a capture file of samples, see capture.h, which starts with the
+ * minute marker at start.
+ *
+ * @param g The parameters.
+ * @param name The name of the capture file.
+ * @param start The start of the first minute in UTC.
+ * @param minutes The number of minutes.
+ * @param times Set to the transmitted time of each minute, or NULL.
+ * @param nsamples Set to the number of samples, or NULL.
+ * @return Writing was successful (0), or errno otherwise.
+ */
+int siggen_capture(struct siggen *g, const char *name, time_t start,
+    unsigned minutes, struct tm *times, unsigned long long *nsamples);
+
+/**
+ * Write a log file as written by nplpi, see {@link get_bit_file}. Noise
+ * replaces the symbol of the second by a random other one, a dropout
+ * replaces it by '_'.
+ *
+ * @param g The parameters, freq and jitter are not used.
+ * @param name The name of the log file.
+ * @param start The start of the first minute in UTC.
+ * @param minutes The number of minutes.
+ * @param times Set to the transmitted time of each minute, or NULL.
+ * @return Writing was successful (0), or errno otherwise.
+ */
+int siggen_log(struct siggen *g, const char *name, time_t start,
+    unsigned minutes, struct tm *times);
+
+#endif
@@ -24,6 +24,42 @@ init_fwd_tm(struct tm * const time)
 	time->tm_yday = 0;
 }
 
+/* century_offset() must not accept any other day of the week */
+static int
+test_wrong_wday(char *name, struct tm time, int century)
+{
+	int wday = time.tm_wday;
+
+	for (time.tm_wday = 1; time.tm_wday < 8; time.tm_wday++) {
+		if (time.tm_wday != wday && century_offset(time) == century) {
+			printf("%s: %d-%d-%d,%d: co must not be %d\n",
+			    name, time.tm_year, time.tm_mon, time.tm_mday,
+			    time.tm_wday, century);
+			return EX_SOFTWARE;
+		}
+	}
+	return EX_OK;
+}
+
+static int
+test_minutes(char *name, struct tm start, int n, struct tm expect)
+{
+	struct tm time;
+
+	time = add_minutes(start, n, false);
+	if (time.tm_year != expect.tm_year || time.tm_mon != expect.tm_mon ||
+	    time.tm_mday != expect.tm_mday || time.tm_wday != expect.tm_wday ||
+	    time.tm_hour != expect.tm_hour || time.tm_min != expect.tm_min) {
+		printf("%s: add_minutes %d: %d-%d-%d,%d %d:%d must be "
+		    "%d-%d-%d,%d %d:%d\n", name, n, time.tm_year, time.tm_mon,
+		    time.tm_mday, time.tm_wday, time.tm_hour, time.tm_min,
+		    expect.tm_year, expect.tm_mon, expect.tm_mday,
+		    expect.tm_wday, expect.tm_hour, expect.tm_min);
+		return EX_SOFTWARE;
+	}
+	return EX_OK;
+}
+
 static int
 test_utc(char *name, int hours)
 {
@@ -33,9 +69,7 @@ test_utc(char *name, int hours)
 	time.tm_min = 0;
 	/* initialize to UTC */
 	init_fwd_tm(&time2);
-	for (int i = 0; i < 60 * hours; i++) {
-		time2 = substract_minute(time2, false);
-	}
+	time2 = add_minutes(time2, -60 * hours, false);
 
 	for (time.tm_year = base_year; time.tm_year < base_year + 400;
 	    time.tm_year++) {
@@ -66,10 +100,7 @@ test_utc(char *name, int hours)
 						    time2.tm_hour);
 						return EX_SOFTWARE;
 					}
-					for (int i = 0; i < 60; i++) {
-						time2 = add_minute(time2,
-						    false);
-					}
+					time2 = add_minutes(time2, 60, false);
 				}
 				if (++time.tm_wday == 8) {
 					time.tm_wday = 1;
@@ -83,12 +114,15 @@ test_utc(char *name, int hours)
 int
 main(int argc, char *argv[])
 {
-	struct tm time, time2;
-	int i;
+	struct tm time, time2, start;
+	int i, n;
 
 	/* isleapyear() and lastday() are OK by definition */
 
-	/* century_offset(): check for every date if it matches */
+	/*
+	 * century_offset(): check for every date if it matches, and only for
+	 * the right day of the week
+	 */
 	time.tm_wday = 1; /* base_year-01-01 is a Monday */
 	for (int century = 0; century < 4; century++) {
 		for (time.tm_year = 0; time.tm_year < 100; time.tm_year++) {
@@ -111,6 +145,10 @@ main(int argc, char *argv[])
 						    co, century);
 						return EX_SOFTWARE;
 					}
+					if (test_wrong_wday(argv[0], time,
+					    century) != EX_OK) {
+						return EX_SOFTWARE;
+					}
 					if (++time.tm_wday == 8) {
 						time.tm_wday = 1;
 					}
@@ -118,8 +156,14 @@ main(int argc, char *argv[])
 			}
 		}
 	}
-	/* add_minute(): check for every minute increase if it matches */
+	/*
+	 * add_minute(): check for every minute increase if it matches,
+	 * add_minutes(): check if it matches for the total increase, every
+	 * 997 minutes to reach all minutes of the hour and hours of the day
+	 */
 	init_fwd_tm(&time2);
+	start = time2;
+	n = 0;
 	time.tm_wday = 1;
 	for (time.tm_year = base_year; time.tm_year < base_year + 400;
 	    time.tm_year++) {
@@ -164,8 +208,15 @@ main(int argc, char *argv[])
 							    time.tm_min);
 							return EX_SOFTWARE;
 						}
+						if (n % 997 == 0 &&
+						    test_minutes(argv[0],
+						    start, n, time) !=
+						    EX_OK) {
+							return EX_SOFTWARE;
+						}
 						time2 = add_minute(time2,
 						    false);
+						n++;
 					}
 				}
 				if (++time.tm_wday == 8) {
@@ -175,7 +226,16 @@ main(int argc, char *argv[])
 		}
 	}
 
-	/* substract_minute(): check for every minute increase if it matches */
+	/* add_minutes(): wrap around the 400-year cycle */
+	if (test_minutes(argv[0], start, n, start) != EX_OK ||
+	    test_minutes(argv[0], start, -n, start) != EX_OK) {
+		return EX_SOFTWARE;
+	}
+
+	/*
+	 * substract_minute(): check for every minute decrease if it matches,
+	 * add_minutes(): check if it matches for the total decrease
+	 */
 	time2.tm_year = base_year + 399;
 	time2.tm_mon = 12;
 	time2.tm_mday = 31;
@@ -186,6 +246,8 @@ main(int argc, char *argv[])
 	/* extra fields: */
 	time2.tm_sec = 0;
 	time2.tm_yday = 0;
+	start = time2;
+	n = 0;
 	time.tm_wday = 7;
 	for (time.tm_year = base_year + 399; time.tm_year >= base_year;
 	    time.tm_year--) {
@@ -231,8 +293,15 @@ main(int argc, char *argv[])
 							    time.tm_min);
 							return EX_SOFTWARE;
 						}
+						if (n % 997 == 0 &&
+						    test_minutes(argv[0],
+						    start, -n, time) !=
+						    EX_OK) {
+							return EX_SOFTWARE;
+						}
 						time2 = substract_minute(time2,
 						    false);
+						n++;
 					}
 				}
 				if (--time.tm_wday == 0) {
@@ -0,0 +1,102 @@
+// Copyright 2019 René Ladan
+// SPDX-License-Identifier: BSD-2-Clause
+
+#include "input.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sysexits.h>
+
+/*
+ * Decode a receiver pin stuck at either level through set_mode_source() and
+ * get_bit_live(). Each bit must end as a reception timeout before it runs
+ * past the raw signal of four seconds kept in bitinfo.signal, at any
+ * sample rate.
+ */
+
+/* a pin stuck at level for the given number of samples */
+struct stuck {
+	int level;
+	unsigned long long left;
+};
+
+static int
+stuck_next(void *arg)
+{
+	struct stuck *st = arg;
+
+	if (st->left == 0) {
+		return -1;
+	}
+	st->left--;
+	return st->level;
+}
+
+static int
+test_stuck(unsigned freq, int level, unsigned seconds)
+{
+	struct stuck st;
+	struct pulse_source src;
+	struct GB_state *s;
+	struct GB_result bit;
+	unsigned bits = 0;
+	int res;
+
+	s = GB_new();
+	if (s == NULL) {
+		perror("GB_new");
+		return EX_OSERR;
+	}
+	st.level = level;
+	st.left = (unsigned long long)freq * seconds;
+	src.next = stuck_next;
+	src.arg = &st;
+	src.freq = freq;
+	src.start_ns = 0;
+	src.min_freq = 0;
+	res = set_mode_source_r(s, &src);
+	if (res != 0) {
+		GB_free(s);
+		return res;
+	}
+	do {
+		bit = get_bit_live_r(s);
+		if (get_bitinfo_r(s).t >= 4 * freq) {
+			printf("%u Hz, pin %d: bit %u ran for %u samples\n",
+			    freq, level, bits, get_bitinfo_r(s).t);
+			res = EX_SOFTWARE;
+		} else if (!bit.done && bit.hwstat == ehw_ok) {
+			printf("%u Hz, pin %d: bit %u did not time out\n",
+			    freq, level, bits);
+			res = EX_SOFTWARE;
+		}
+		bits++;
+	} while (res == 0 && !bit.done && bits <= seconds);
+	/* a timeout takes at most 2.25 seconds */
+	if (res == 0 && bits < seconds * 4 / 9) {
+		printf("%u Hz, pin %d: only %u bits in %u seconds\n", freq,
+		    level, bits, seconds);
+		res = EX_SOFTWARE;
+	}
+	GB_free(s);
+	return res;
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned freq;
+	int res;
+
+	if (argc != 2) {
+		printf("usage: %s freq\n", argv[0]);
+		return EX_USAGE;
+	}
+	freq = (unsigned)strtoul(argv[1], NULL, 10);
+	res = test_stuck(freq, 0, 20);
+	if (res == 0) {
+		res = test_stuck(freq, 1, 20);
+	}
+	return res;
+}